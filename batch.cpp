@@ -0,0 +1,144 @@
+#include "batch.h"
+#include "diskcache.h"
+#include "expression.h"
+#include <cstring>
+
+namespace {
+
+const size_t blockSize = 8 << 20;
+
+void AppendResult(std::string& output, double value, int digits) {
+    char text[numberBufferSize];
+    size_t length = FormatNumber(value, text, digits);
+    text[length] = '\n';
+    output.append(text, length + 1);
+}
+
+}
+
+void EvaluateLines(const char* begin, const char* end, EvaluationContext& context, std::string& output,
+                   int digits) {
+    while (begin < end) {
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+        const char* lineEnd = newline != NULL ? newline : end;
+        const char* next = newline != NULL ? newline + 1 : end;
+
+        if (lineEnd > begin && lineEnd[-1] == '\r') {
+            lineEnd--;
+        }
+
+        if (lineEnd == begin) {
+            output += '\n';
+        } else {
+            EvalResult result = TryEvaluateExpression(begin, lineEnd - begin, context);
+            if (result.ok()) {
+                AppendResult(output, result.value, digits);
+            } else {
+                output += "Error: ";
+                AppendErrorMessage(output, result.error, begin);
+                output += '\n';
+            }
+        }
+
+        begin = next;
+    }
+}
+
+BatchEvaluator::BatchEvaluator(size_t threadCount, AngleMode angleMode, size_t chunkSize)
+    : pool(threadCount), chunkSize(chunkSize), digits(displayDigits) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        contexts.push_back(std::unique_ptr<EvaluationContext>(new EvaluationContext(angleMode)));
+    }
+}
+
+BatchEvaluator::~BatchEvaluator() {
+}
+
+size_t BatchEvaluator::getThreadCount() const {
+    return pool.size();
+}
+
+void BatchEvaluator::setLogSink(LogSink* sink) {
+    for (const std::unique_ptr<EvaluationContext>& context : contexts) {
+        context->setLogSink(sink);
+    }
+}
+
+void BatchEvaluator::setResultCache(ResultCache* cache) {
+    for (const std::unique_ptr<EvaluationContext>& context : contexts) {
+        context->setResultCache(cache);
+    }
+}
+
+void BatchEvaluator::setDiskCache(DiskCache* cache) {
+    diskCacheBatches.clear();
+    for (const std::unique_ptr<EvaluationContext>& context : contexts) {
+        context->setDiskCache(cache);
+        if (cache != NULL) {
+            diskCacheBatches.push_back(std::unique_ptr<DiskCacheBatch>(new DiskCacheBatch(*cache)));
+        }
+        context->setDiskCacheBatch(cache != NULL ? diskCacheBatches.back().get() : NULL);
+    }
+}
+
+void BatchEvaluator::setDigits(int digits) {
+    this->digits = digits;
+}
+
+const std::vector<std::string>& BatchEvaluator::evaluate(const char* data, size_t length) {
+    const char* end = data + length;
+
+    chunkBounds.clear();
+    chunkBounds.push_back(data);
+    const char* cursor = data;
+    while (cursor < end) {
+        const char* target = (static_cast<size_t>(end - cursor) > chunkSize) ? cursor + chunkSize : end;
+        const char* newline = target < end
+            ? static_cast<const char*>(std::memchr(target, '\n', end - target))
+            : NULL;
+        cursor = newline != NULL ? newline + 1 : end;
+        chunkBounds.push_back(cursor);
+    }
+
+    size_t chunkCount = chunkBounds.size() - 1;
+    results.resize(chunkCount);
+    for (size_t i = 0; i < chunkCount; i++) {
+        results[i].clear();
+    }
+
+    pool.parallelFor(chunkCount, [this](size_t chunk, size_t worker) {
+        EvaluateLines(chunkBounds[chunk], chunkBounds[chunk + 1], *contexts[worker], results[chunk], digits);
+        if (!diskCacheBatches.empty()) {
+            diskCacheBatches[worker]->flush();
+        }
+    });
+
+    return results;
+}
+
+void BatchEvaluator::run(FILE* input, OutputBuffer& output) {
+    LineReader reader(input, blockSize);
+    const char* data;
+    size_t length;
+
+    while (reader.nextBlock(data, length)) {
+        const std::vector<std::string>& chunks = evaluate(data, length);
+        for (const std::string& chunk : chunks) {
+            output.write(chunk.data(), chunk.size());
+        }
+    }
+}
+
+// Expressions are lexed straight from the mapping, so the input is never
+// copied.
+void BatchEvaluator::run(MappedFile& input, OutputBuffer& output) {
+    const char* data;
+    size_t length;
+
+    while (input.nextBlock(data, length)) {
+        const std::vector<std::string>& chunks = evaluate(data, length);
+        for (const std::string& chunk : chunks) {
+            output.write(chunk.data(), chunk.size());
+        }
+    }
+}
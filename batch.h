@@ -0,0 +1,65 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdio>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "context.h"
+#include "lineio.h"
+#include "numberformat.h"
+#include "threadpool.h"
+
+// Evaluates every newline-delimited expression in [begin, end) and appends
+// one line per input line to output: the result, formatted with
+// FormatNumber to the given digits, "Error: <message>", or an empty line
+// for an empty input line.
+void EvaluateLines(const char* begin, const char* end, EvaluationContext& context, std::string& output,
+                   int digits = displayDigits);
+
+// Evaluates large inputs across a work-stealing pool. Input is read in
+// blocks of whole lines, each block is cut into chunks of roughly
+// chunkSize bytes, and chunk outputs are written back in input order.
+// Every worker has its own EvaluationContext, so nothing is shared while
+// evaluating.
+class BatchEvaluator {
+public:
+    explicit BatchEvaluator(size_t threadCount, AngleMode angleMode = AngleMode::Degrees,
+                            size_t chunkSize = 64 * 1024);
+    ~BatchEvaluator();
+
+    size_t getThreadCount() const;
+
+    // Attaches sink to every worker's context; it must accept messages
+    // from several threads at once.
+    void setLogSink(LogSink* sink);
+
+    // Shares cache between every worker's context; NULL detaches it.
+    void setResultCache(ResultCache* cache);
+
+    // As setResultCache(); each worker queues the results it adds and
+    // appends them under one lock at the end of every chunk.
+    void setDiskCache(DiskCache* cache);
+
+    // Significant digits of each result; shortestDigits round-trips.
+    void setDigits(int digits);
+
+    // Evaluates one in-memory block; the returned chunk outputs, in order,
+    // stay valid until the next call.
+    const std::vector<std::string>& evaluate(const char* data, size_t length);
+
+    void run(FILE* input, OutputBuffer& output);
+    void run(MappedFile& input, OutputBuffer& output);
+
+private:
+    WorkStealingPool pool;
+    size_t chunkSize;
+    int digits;
+    std::vector<std::unique_ptr<EvaluationContext>> contexts;
+    std::vector<std::unique_ptr<DiskCacheBatch>> diskCacheBatches;
+    std::vector<const char*> chunkBounds;
+    std::vector<std::string> results;
+};
+
+#endif
@@ -0,0 +1,1984 @@
+#include "expression.h"
+#include "batch.h"
+#include "columnar.h"
+#include "csv.h"
+#include "debuglog.h"
+#include "vectormath.h"
+#include "numberformat.h"
+#include "optimizer.h"
+#include "jit.h"
+#include "resultcache.h"
+#include "diskcache.h"
+#include "variables.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// Every heap allocation in the process is counted so the steady-state
+// evaluation paths can be checked for zero allocations. The replacements
+// are kept out of line: GCC otherwise sees the malloc inside an inlined
+// operator new and warns when a sized operator delete frees it.
+static std::atomic<size_t> allocationCount(0);
+
+#if defined(__GNUC__)
+#define CALC_NOINLINE __attribute__((noinline))
+#else
+#define CALC_NOINLINE
+#endif
+
+CALC_NOINLINE void* operator new(size_t size) {
+    allocationCount++;
+    void* memory = std::malloc(size != 0 ? size : 1);
+    if (memory == NULL) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+CALC_NOINLINE void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+CALC_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+CALC_NOINLINE void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+CALC_NOINLINE void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+CALC_NOINLINE void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+CALC_NOINLINE void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+CALC_NOINLINE void operator delete[](void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+CALC_NOINLINE void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+CALC_NOINLINE void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+// Over-aligned allocations take extra room to round the block up to the
+// alignment and keep malloc's pointer just before it, so they work
+// wherever malloc does.
+CALC_NOINLINE void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount++;
+    size_t align = static_cast<size_t>(alignment);
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    void* block = std::malloc(size + align + sizeof(void*));
+    if (block == NULL) {
+        throw std::bad_alloc();
+    }
+    uintptr_t first = reinterpret_cast<uintptr_t>(block) + sizeof(void*);
+    void* memory = reinterpret_cast<void*>((first + align - 1) & ~static_cast<uintptr_t>(align - 1));
+    static_cast<void**>(memory)[-1] = block;
+    return memory;
+}
+
+CALC_NOINLINE void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+CALC_NOINLINE void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size, alignment);
+    } catch (const std::bad_alloc&) {
+        return NULL;
+    }
+}
+
+CALC_NOINLINE void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return operator new(size, alignment, std::nothrow);
+}
+
+CALC_NOINLINE void operator delete(void* memory, std::align_val_t) noexcept {
+    if (memory != NULL) {
+        std::free(static_cast<void**>(memory)[-1]);
+    }
+}
+
+CALC_NOINLINE void operator delete[](void* memory, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+CALC_NOINLINE void operator delete(void* memory, size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+CALC_NOINLINE void operator delete[](void* memory, size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+
+CALC_NOINLINE void operator delete(void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    operator delete(memory, alignment);
+}
+
+CALC_NOINLINE void operator delete[](void* memory, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    operator delete(memory, alignment);
+}
+
+namespace {
+
+volatile double sink;
+
+// Runs body repeatedly for roughly the given time budget and returns the
+// average cost of one call in nanoseconds.
+template <typename Body>
+double MeasureNanoseconds(Body body, double budgetMs = 200.0) {
+    typedef std::chrono::steady_clock Clock;
+
+    size_t iterations = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            body();
+        }
+        double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        if (elapsed >= budgetMs * 1e6 || iterations >= (size_t(1) << 30)) {
+            return elapsed / iterations;
+        }
+        iterations *= 2;
+    }
+}
+
+void BenchmarkBytecode() {
+    const std::vector<std::string> expressions = {
+        "2+3*4",
+        "(1+2)*(3+4)/5-6^2",
+        "sin(30)*cos(60)+tan(15)",
+        "5^2 + sqrt(16) - ln(10)",
+        "log(sqrt(16))+abs(-3.5)*fact(5)",
+        "((((1+2)*3-4)/5+6)*7-8)/9+10*11-12^2",
+    };
+
+    EvaluationContext context;
+
+    std::printf("== Bytecode VM vs. parse-per-call ==\n");
+    std::printf("%-40s %14s %14s %9s\n", "expression", "parse+eval ns", "bytecode ns", "speedup");
+
+    for (const std::string& expression : expressions) {
+        double parseAndEvaluate = MeasureNanoseconds([&]() {
+            sink = CompiledExpression(expression).evaluate(context);
+        });
+
+        CompiledExpression compiled(expression);
+        double bytecode = MeasureNanoseconds([&]() {
+            sink = compiled.evaluate(context);
+        });
+
+        std::printf("%-40s %14.1f %14.1f %8.1fx\n", expression.c_str(),
+                    parseAndEvaluate, bytecode, parseAndEvaluate / bytecode);
+    }
+    std::printf("\n");
+}
+
+// Builds a random expression that reuses earlier subexpressions, so that
+// both folding and sharing have something to do. Some fail on purpose.
+std::string RandomExpression(std::mt19937_64& random, std::vector<std::string>& pool, int depth) {
+    static const char* const leaves[] = { "2", "3", "8", "0", "0.5", "30", "pi", "e", "-1", "1e3" };
+    static const char* const functions[] = { "sin", "cos", "tan", "asin", "sqrt", "log", "ln", "abs", "fact" };
+    static const char operators[] = { '+', '-', '*', '/', '%', '^' };
+    const size_t leafCount = sizeof(leaves) / sizeof(leaves[0]);
+    const size_t functionCount = sizeof(functions) / sizeof(functions[0]);
+
+    unsigned choice = static_cast<unsigned>(random() % 10);
+    if (!pool.empty() && choice < 2) {
+        return pool[random() % pool.size()];
+    }
+    std::string text;
+    if (depth == 0 || choice < 4) {
+        text = leaves[random() % leafCount];
+    } else if (choice < 6) {
+        text = std::string(functions[random() % functionCount]) + "(" + RandomExpression(random, pool, depth - 1) + ")";
+    } else {
+        text = "(" + RandomExpression(random, pool, depth - 1) + operators[random() % 6] +
+               RandomExpression(random, pool, depth - 1) + ")";
+    }
+    pool.push_back(text);
+    return text;
+}
+
+bool SameOutcome(bool okA, double a, const EvalError& errorA, bool okB, double b, const EvalError& errorB) {
+    if (okA != okB) {
+        return false;
+    }
+    if (okA) {
+        return a == b || (a != a && b != b);
+    }
+    return errorA.kind == errorB.kind && errorA.position == errorB.position;
+}
+
+struct OptimizerCase {
+    const char* name;
+    bool foldConstants;
+    bool fastMath;
+    bool checkErrors;
+};
+
+double MeasureEvaluation(const CompiledExpression& expression, EvaluationContext& context) {
+    return MeasureNanoseconds([&]() {
+        double value = 0.0;
+        EvalError error = EvalError();
+        expression.tryEvaluate(context, value, error);
+        sink = value;
+    });
+}
+
+// Compares optimized programs against the parsed tree's on random
+// expressions in both angle modes, then times a few typical ones. The
+// default options must reproduce every result and error; fast-math is
+// expected to differ, so it only reports how often and by how much.
+// Folding is turned off in the rewrite cases so that the rules see
+// literal operands, as they will see variables.
+bool BenchmarkOptimizer() {
+    const OptimizerCase cases[] = {
+        { "default", true, false, true },
+        { "no folding", false, false, true },
+        { "fast-math", false, true, true },
+        { "fast-math, unchecked", false, true, false },
+    };
+
+    std::mt19937_64 random(5);
+    std::vector<std::string> texts;
+    for (int i = 0; i < 20000; i++) {
+        std::vector<std::string> pool;
+        texts.push_back(RandomExpression(random, pool, 5));
+    }
+
+    EvaluationContext degrees(AngleMode::Degrees);
+    EvaluationContext radians(AngleMode::Radians);
+    bool ok = true;
+
+    std::printf("== Optimizer (%zu random expressions) ==\n", texts.size());
+    std::printf("%-22s %16s %8s %8s %10s %10s %10s\n", "options", "nodes", "folded", "shared", "rewritten",
+                "differing", "max error");
+
+    for (const OptimizerCase& optimizerCase : cases) {
+        OptimizerOptions options;
+        options.foldConstants = optimizerCase.foldConstants;
+        options.fastMath = optimizerCase.fastMath;
+        options.checkErrors = optimizerCase.checkErrors;
+        OptimizerStats stats = OptimizerStats();
+        size_t differing = 0;
+        double maxError = 0.0;
+
+        for (const std::string& text : texts) {
+            CompiledExpression plain(text);
+            CompiledExpression optimized(text);
+            optimized.optimize(&stats, &options);
+
+            for (EvaluationContext* context : { &degrees, &radians }) {
+                double a = 0.0;
+                double b = 0.0;
+                EvalError errorA = EvalError();
+                EvalError errorB = EvalError();
+                bool okA = plain.tryEvaluate(*context, a, errorA);
+                bool okB = optimized.tryEvaluate(*context, b, errorB);
+                if (SameOutcome(okA, a, errorA, okB, b, errorB)) {
+                    continue;
+                }
+                if (!options.fastMath && differing < 5) {
+                    std::printf("FAIL: %s optimization changes %s\n", optimizerCase.name, text.c_str());
+                }
+                differing++;
+                if (okA && okB && std::isfinite(a) && std::isfinite(b) && std::fabs(a) > 1e-300) {
+                    maxError = std::max(maxError, std::fabs((b - a) / a));
+                }
+            }
+        }
+
+        char nodes[48];
+        std::snprintf(nodes, sizeof(nodes), "%zu->%zu", stats.nodesBefore, stats.nodesAfter);
+        std::printf("%-22s %16s %8zu %8zu %10zu %10zu %10.1e\n", optimizerCase.name, nodes, stats.folded,
+                    stats.shared, stats.rewritten, differing, maxError);
+        if (!options.fastMath && differing != 0) {
+            ok = false;
+        }
+    }
+    std::printf("\n");
+
+    const std::vector<std::string> expressions = {
+        "sin(pi/6)*2 + sin(pi/6)*3",
+        "2*3*4+sqrt(16)-ln(10)",
+        "(1+2)*(3+4)/5-6^2",
+        "sqrt(2-3)*cos(60) + sqrt(2-3)*sin(30)",
+    };
+
+    std::printf("%-40s %8s %12s %12s %9s\n", "expression", "nodes", "tree ns", "optimized ns", "speedup");
+    for (const std::string& expression : expressions) {
+        CompiledExpression plain(expression);
+        CompiledExpression optimized(expression);
+        OptimizerStats stats = OptimizerStats();
+        optimized.optimize(&stats);
+
+        double before = MeasureEvaluation(plain, degrees);
+        double after = MeasureEvaluation(optimized, degrees);
+        char nodes[32];
+        std::snprintf(nodes, sizeof(nodes), "%zu->%zu", stats.nodesBefore, stats.nodesAfter);
+        std::printf("%-40s %8s %12.1f %12.1f %8.1fx\n", expression.c_str(), nodes, before, after, before / after);
+    }
+    std::printf("\n");
+
+    // Rewrites alone, with folding off.
+    const std::vector<std::string> rewrites = {
+        "1.7^2 + 2.3^3 + 0.9^8",
+        "5.5/4 + 7.25/3",
+        "log(7) + log(13)",
+        "2.5^0.5 * 3.5^0.5",
+    };
+    OptimizerOptions exact;
+    exact.foldConstants = false;
+    OptimizerOptions fast = exact;
+    fast.fastMath = true;
+    fast.checkErrors = false;
+
+    std::printf("%-40s %12s %12s %12s\n", "expression (no folding)", "tree ns", "exact ns", "fast-math ns");
+    for (const std::string& expression : rewrites) {
+        CompiledExpression plain(expression);
+        CompiledExpression exactProgram(expression);
+        CompiledExpression fastProgram(expression);
+        exactProgram.optimize(NULL, &exact);
+        fastProgram.optimize(NULL, &fast);
+
+        std::printf("%-40s %12.1f %12.1f %12.1f\n", expression.c_str(), MeasureEvaluation(plain, degrees),
+                    MeasureEvaluation(exactProgram, degrees), MeasureEvaluation(fastProgram, degrees));
+    }
+    std::printf("\n");
+    return ok;
+}
+
+// Checks native code against the interpreter on the optimizer's random
+// expressions, unfolded so that every operation runs, then times both.
+bool BenchmarkJit() {
+    if (!JitCode::isSupported()) {
+        std::printf("== JIT ==\nnot supported on this platform; expressions are interpreted\n\n");
+        return true;
+    }
+
+    std::mt19937_64 random(7);
+    EvaluationContext degrees(AngleMode::Degrees);
+    EvaluationContext radians(AngleMode::Radians);
+    OptimizerOptions unfolded;
+    unfolded.foldConstants = false;
+    size_t mismatches = 0;
+    size_t compiled = 0;
+
+    const int expressionCount = 20000;
+    for (int i = 0; i < expressionCount; i++) {
+        std::vector<std::string> pool;
+        std::string text = RandomExpression(random, pool, 5);
+        CompiledExpression interpreted(text);
+        interpreted.optimize(NULL, &unfolded);
+        CompiledExpression native = interpreted;
+        if (!native.jit()) {
+            continue;
+        }
+        compiled++;
+
+        for (EvaluationContext* context : { &degrees, &radians }) {
+            double a = 0.0;
+            double b = 0.0;
+            EvalError errorA = EvalError();
+            EvalError errorB = EvalError();
+            bool okA = interpreted.tryEvaluate(*context, a, errorA);
+            bool okB = native.tryEvaluate(*context, b, errorB);
+            bool same = okA == okB && (okA ? std::memcmp(&a, &b, sizeof(a)) == 0 || (a != a && b != b)
+                                            : DescribeError(errorA, text.c_str()) == DescribeError(errorB, text.c_str()) &&
+                                              errorA.position == errorB.position);
+            if (!same && mismatches++ < 5) {
+                std::printf("FAIL: native code differs on %s\n", text.c_str());
+            }
+        }
+    }
+
+    std::printf("== JIT (%zu of %d random expressions compiled, %zu mismatches) ==\n", compiled, expressionCount,
+                mismatches);
+
+    const std::vector<std::string> expressions = {
+        "2+3*4",
+        "(1+2)*(3+4)/5-6^2",
+        "sin(30)*cos(60)+tan(15)",
+        "log(sqrt(16))+abs(-3.5)*fact(5)",
+        "((((1+2)*3-4)/5+6)*7-8)/9+10*11-12^2",
+    };
+
+    std::printf("%-40s %10s %14s %12s %9s\n", "expression (no folding)", "code bytes", "interpreter ns",
+                "native ns", "speedup");
+    for (const std::string& expression : expressions) {
+        CompiledExpression interpreted(expression);
+        interpreted.optimize(NULL, &unfolded);
+        CompiledExpression native = interpreted;
+        native.jit();
+        JitCode code;
+        code.compile(native.getBytecode());
+
+        double before = MeasureEvaluation(interpreted, degrees);
+        double after = MeasureEvaluation(native, degrees);
+        std::printf("%-40s %10zu %14.1f %12.1f %8.1fx\n", expression.c_str(), code.getCodeSize(), before, after,
+                    before / after);
+    }
+    std::printf("\n");
+    return mismatches == 0 && compiled == static_cast<size_t>(expressionCount);
+}
+
+// Replaces every variable of table in text with its value, as a literal in
+// parentheses, giving the text a user would otherwise have had to build.
+std::string SubstituteVariables(const std::string& text, const VariableTable& table) {
+    std::string result;
+    size_t i = 0;
+    while (i < text.length()) {
+        size_t end = i;
+        while (end < text.length() && isalnum(static_cast<unsigned char>(text[end]))) {
+            end++;
+        }
+        unsigned int slot = end > i && isalpha(static_cast<unsigned char>(text[i]))
+            ? table.find(text.data() + i, end - i) : VariableTable::notFound;
+        if (slot != VariableTable::notFound) {
+            result += '(';
+            AppendNumber(result, table.get(slot));
+            result += ')';
+            i = end;
+        } else if (end > i) {
+            result.append(text, i, end - i);
+            i = end;
+        } else {
+            result += text[i++];
+        }
+    }
+    return result;
+}
+
+// Evaluates formulas over random variable values, compiled once against a
+// VariableTable (interpreted, optimized and native), and checks each
+// result against evaluating the text with the values substituted in,
+// which is what a caller without variables has to do for every row.
+bool BenchmarkVariables() {
+    const std::vector<std::string> formulas = {
+        "x*rate+qty",
+        "x^2*rate-sqrt(abs(x))/qty",
+        "(x+rate)*(x+rate)-sin(x)*cos(x)",
+        "ln(abs(x)+1)*x1+x1%qty",
+    };
+
+    VariableTable table;
+    table.define("x");
+    table.define("x1");
+    table.define("rate");
+    table.define("qty");
+
+    EvaluationContext context(AngleMode::Radians);
+    context.setVariables(&table);
+    EvaluationContext plain(AngleMode::Radians);
+    std::mt19937_64 random(11);
+    std::uniform_real_distribution<double> values(-100.0, 100.0);
+    size_t mismatches = 0;
+    const int rows = 2000;
+
+    for (const std::string& formula : formulas) {
+        CompiledExpression interpreted(formula, &table);
+        CompiledExpression optimized = interpreted;
+        optimized.optimize();
+        CompiledExpression native = optimized;
+        native.jit();
+
+        for (int row = 0; row < rows; row++) {
+            for (unsigned int slot = 0; slot < table.size(); slot++) {
+                table.set(slot, values(random));
+            }
+            std::string substituted = SubstituteVariables(formula, table);
+            EvalResult expected = TryEvaluateExpression(substituted, plain);
+
+            for (const CompiledExpression* expression : { &interpreted, &optimized, &native }) {
+                double value = 0.0;
+                EvalError error = EvalError();
+                bool ok = expression->tryEvaluate(context, value, error);
+                if (!SameOutcome(expected.ok(), expected.value, expected.error, ok, value, error) &&
+                    mismatches++ < 5) {
+                    std::printf("FAIL: %s gives %s, substituted %s gives %s\n", formula.c_str(),
+                                NumberToString(value).c_str(), substituted.c_str(),
+                                NumberToString(expected.value).c_str());
+                }
+            }
+        }
+    }
+
+    EvaluationContext unbound;
+    EvalError error = EvalError();
+    double value = 0.0;
+    CompiledExpression needsRate("2*rate", &table);
+    if (needsRate.tryEvaluate(unbound, value, error) || error.kind != EvalErrorKind::UnboundVariable ||
+        DescribeError(error, "2*rate") != "No value for variable: 'rate'") {
+        std::printf("FAIL: unbound variable not reported\n");
+        mismatches++;
+    }
+    // With only x bound, the error points at rate, the first variable the
+    // context lacks, not at x.
+    VariableTable onlyX;
+    onlyX.define("x");
+    EvaluationContext partial;
+    partial.setVariables(&onlyX);
+    CompiledExpression needsRateAfterX("x*rate", &table);
+    error = EvalError();
+    if (needsRateAfterX.tryEvaluate(partial, value, error) || error.position != 2 || error.length != 4) {
+        std::printf("FAIL: unbound variable reported at %zu, not at rate\n", error.position);
+        mismatches++;
+    }
+    // Compiled in place the expression keeps no source, so the name's
+    // length has to come from the bytecode.
+    const std::string inPlaceText = "1 + qty*rate";
+    CompiledExpression inPlace;
+    error = EvalError();
+    inPlace.tryCompileInPlace(inPlaceText, error, &table);
+    inPlace.optimize();
+    if (inPlace.tryEvaluate(unbound, value, error) ||
+        DescribeError(error, inPlaceText.c_str()) != "No value for variable: 'qty'") {
+        std::printf("FAIL: unbound variable in an in-place expression not named\n");
+        mismatches++;
+    }
+
+    std::printf("== Variables (%d rows per formula, %zu mismatches) ==\n", rows, mismatches);
+    std::printf("%-36s %14s %12s %12s %10s\n", "formula", "substitute ns", "compiled ns", "optimized ns",
+                "native ns");
+    for (const std::string& formula : formulas) {
+        CompiledExpression compiled(formula, &table);
+        CompiledExpression optimized = compiled;
+        optimized.optimize();
+        CompiledExpression native = optimized;
+        native.jit();
+
+        // x cycles through the same 64 values in every measurement, so each
+        // one sees numbers of the same size (and the same text lengths).
+        unsigned int step = 0;
+        std::string text;
+        double substitute = MeasureNanoseconds([&]() {
+            table.set(0, 0.5 + (step++ % 64));
+            text = SubstituteVariables(formula, table);
+            sink = TryEvaluateExpression(text, plain).value;
+        });
+        double times[3];
+        const CompiledExpression* expressions[3] = { &compiled, &optimized, &native };
+        for (int i = 0; i < 3; i++) {
+            step = 0;
+            times[i] = MeasureNanoseconds([&]() {
+                table.set(0, 0.5 + (step++ % 64));
+                double result = 0.0;
+                EvalError ignored = EvalError();
+                expressions[i]->tryEvaluate(context, result, ignored);
+                sink = result;
+            });
+        }
+        std::printf("%-36s %14.1f %12.1f %12.1f %10.1f\n", formula.c_str(), substitute, times[0], times[1],
+                    times[2]);
+    }
+    std::printf("\n");
+    return mismatches == 0;
+}
+
+// Evaluates formulas over columns of random values with a ColumnEvaluator
+// and checks every row, errors included, against evaluating the compiled
+// expression row by row. Then compares rows per second with
+// EvaluateExpression per row, which parses the text every time.
+bool BenchmarkColumnar() {
+    const std::vector<std::string> formulas = {
+        "x*y+1",
+        "x/(y-1)+x%y",
+        "sqrt(x)*y-x^2",
+        "sin(x)*cos(y)+ln(abs(x*y)+1)",
+        "(x+y)*(x+y)/(x-y)",
+    };
+
+    VariableTable table;
+    table.define("x");
+    table.define("y");
+
+    const size_t rowCount = 200000;
+    std::mt19937_64 random(13);
+    std::uniform_int_distribution<int> small(-3, 3);
+    std::uniform_real_distribution<double> values(-50.0, 50.0);
+    std::vector<double> x(rowCount);
+    std::vector<double> y(rowCount);
+    for (size_t row = 0; row < rowCount; row++) {
+        // Some small integers so that divisions by zero and the like occur.
+        x[row] = row % 7 == 0 ? small(random) : values(random);
+        y[row] = row % 5 == 0 ? small(random) : values(random);
+    }
+    const double* columns[2] = { x.data(), y.data() };
+    std::vector<double> output(rowCount);
+
+    ColumnEvaluator evaluator(1, AngleMode::Radians);
+    EvaluationContext context(AngleMode::Radians);
+    size_t mismatches = 0;
+
+    std::printf("== Columnar evaluation (%zu rows) ==\n", rowCount);
+    std::printf("%-32s %7s %16s %16s %16s\n", "formula", "errors", "per-row text/s", "per-row comp/s",
+                "columnar rows/s");
+    for (const std::string& formula : formulas) {
+        CompiledExpression expression(formula, &table);
+        expression.optimize();
+
+        EvalError error = EvalError();
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        if (!evaluator.evaluate(expression, columns, 2, rowCount, output.data(), error)) {
+            std::printf("FAIL: %s: %s\n", formula.c_str(), DescribeError(error, formula.c_str()).c_str());
+            mismatches++;
+            continue;
+        }
+        double columnar = rowCount / std::chrono::duration<double>(Clock::now() - start).count();
+
+        const std::vector<ColumnError>& failures = evaluator.getErrors();
+        size_t nextFailure = 0;
+        double rowValues[2];
+        context.setVariableValues(rowValues, 2);
+        start = Clock::now();
+        for (size_t row = 0; row < rowCount; row++) {
+            rowValues[0] = x[row];
+            rowValues[1] = y[row];
+            double value = 0.0;
+            EvalError rowError = EvalError();
+            bool ok = expression.tryEvaluate(context, value, rowError);
+            bool listed = nextFailure < failures.size() && failures[nextFailure].row == row;
+            bool same = listed ? !ok && DescribeError(rowError, formula.c_str()) ==
+                                        DescribeError(failures[nextFailure].error, formula.c_str())
+                               : ok && std::memcmp(&value, &output[row], sizeof(value)) == 0;
+            nextFailure += listed ? 1 : 0;
+            if (!same && mismatches++ < 5) {
+                std::printf("FAIL: %s differs at row %zu (x=%g, y=%g)\n", formula.c_str(), row, x[row], y[row]);
+            }
+        }
+        double compiled = rowCount / std::chrono::duration<double>(Clock::now() - start).count();
+
+        context.setVariables(&table);
+        const size_t textRows = rowCount / 10;
+        start = Clock::now();
+        for (size_t row = 0; row < textRows; row++) {
+            table.set(0, x[row]);
+            table.set(1, y[row]);
+            sink = TryEvaluateExpression(formula, context).value;
+        }
+        double text = textRows / std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::printf("%-32s %7zu %16.0f %16.0f %16.0f\n", formula.c_str(), failures.size(), text, compiled,
+                    columnar);
+    }
+    std::printf("%zu mismatches\n\n", mismatches);
+    return mismatches == 0;
+}
+
+// Derives many columns from the same inputs, once as separate columnar
+// passes and once as a fused ExpressionSet, and checks that every result
+// and error is the same. The set shares x^2+y^2, y/x and the like across
+// expressions.
+bool BenchmarkFusedColumns() {
+    const std::vector<std::string> formulas = {
+        "sqrt(x^2+y^2)",
+        "atan(y/x)",
+        "ln(x)",
+        "ln(sqrt(x^2+y^2))",
+        "x^2+y^2",
+        "(x^2+y^2)/(x*y)",
+        "y/x*100",
+        "abs(x-y)/sqrt(x^2+y^2)",
+        "x*y",
+        "sin(atan(y/x))",
+        "cos(atan(y/x))",
+        "sqrt(x^2+y^2)*cos(atan(y/x))-x",
+    };
+
+    VariableTable table;
+    table.define("x");
+    table.define("y");
+
+    const size_t rowCount = 1000000;
+    std::mt19937_64 random(17);
+    std::uniform_real_distribution<double> values(0.0, 20.0);
+    std::vector<double> x(rowCount);
+    std::vector<double> y(rowCount);
+    for (size_t row = 0; row < rowCount; row++) {
+        // Occasional zeros and negatives make some results fail.
+        x[row] = row % 1009 == 0 ? 0.0 : row % 1013 == 0 ? -values(random) : values(random);
+        y[row] = values(random) - 1.0;
+    }
+    const double* columns[2] = { x.data(), y.data() };
+
+    ExpressionSet set;
+    std::vector<CompiledExpression> separate;
+    size_t separateInstructions = 0;
+    for (const std::string& formula : formulas) {
+        set.add(formula, &table);
+        separate.push_back(CompiledExpression(formula, &table));
+        separate.back().optimize();
+        separateInstructions += separate.back().getBytecode().getInstructions().size();
+    }
+    OptimizerStats stats = OptimizerStats();
+    set.optimize(&stats);
+
+    std::vector<std::vector<double>> expected(formulas.size(), std::vector<double>(rowCount));
+    std::vector<std::vector<double>> fused(formulas.size(), std::vector<double>(rowCount));
+    std::vector<double*> outputs;
+    for (std::vector<double>& output : fused) {
+        outputs.push_back(output.data());
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    ColumnEvaluator evaluator(1, AngleMode::Radians);
+    EvalError error = EvalError();
+    std::vector<ColumnError> expectedErrors;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < formulas.size(); i++) {
+        evaluator.evaluate(separate[i], columns, 2, rowCount, expected[i].data(), error);
+        for (ColumnError failure : evaluator.getErrors()) {
+            failure.expression = i;
+            expectedErrors.push_back(failure);
+        }
+    }
+    double separateSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    start = Clock::now();
+    evaluator.evaluate(set, columns, 2, rowCount, outputs.data(), error);
+    double fusedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < formulas.size(); i++) {
+        if (std::memcmp(expected[i].data(), fused[i].data(), rowCount * sizeof(double)) != 0 && mismatches++ < 5) {
+            std::printf("FAIL: fused results differ for %s\n", formulas[i].c_str());
+        }
+    }
+    std::vector<ColumnError> fusedErrors = evaluator.getErrors();
+    std::sort(expectedErrors.begin(), expectedErrors.end(), [](const ColumnError& a, const ColumnError& b) {
+        return a.row != b.row ? a.row < b.row : a.expression < b.expression;
+    });
+    bool sameErrors = expectedErrors.size() == fusedErrors.size();
+    for (size_t i = 0; sameErrors && i < fusedErrors.size(); i++) {
+        const char* text = formulas[fusedErrors[i].expression].c_str();
+        sameErrors = expectedErrors[i].row == fusedErrors[i].row &&
+                     expectedErrors[i].expression == fusedErrors[i].expression &&
+                     DescribeError(expectedErrors[i].error, text) == DescribeError(fusedErrors[i].error, text);
+    }
+    if (!sameErrors) {
+        std::printf("FAIL: fused errors differ (%zu separate, %zu fused)\n", expectedErrors.size(),
+                    fusedErrors.size());
+        mismatches++;
+    }
+
+    std::printf("== Fused columns (%zu expressions over %zu rows, %zu failed results) ==\n", formulas.size(),
+                rowCount, fusedErrors.size());
+    std::printf("%-10s %14s %14s\n", "", "instructions", "rows/s");
+    std::printf("%-10s %14zu %14.0f\n", "separate", separateInstructions, rowCount / separateSeconds);
+    std::printf("%-10s %14zu %14.0f\n", "fused", set.getBytecode().getInstructions().size(),
+                rowCount / fusedSeconds);
+    std::printf("%zu subexpressions shared, %zu mismatches\n\n", stats.shared, mismatches);
+    return mismatches == 0;
+}
+
+void BenchmarkFunctionDispatch() {
+    const std::vector<std::string> names = { "sqrt", "abs", "ln", "sinh", "fact", "cos" };
+    const double argValue = 3.0;
+    Calculator calculator;
+
+    // The dispatch the registry replaced: a linear scan to recognise the
+    // name, then a map of type-erased lambdas to call it.
+    const std::vector<std::string> legacyNames = {
+        "sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh",
+        "sqrt", "log", "ln", "abs", "fact"
+    };
+    std::map<std::string, std::function<double(double)>> legacyFunctions;
+    legacyFunctions["sqrt"] = [&calculator](double a) { return calculator.squareRoot(a); };
+    legacyFunctions["abs"] = [&calculator](double a) { return calculator.absolute(a); };
+    legacyFunctions["ln"] = [&calculator](double a) { return calculator.naturalLogarithm(a); };
+    legacyFunctions["sinh"] = [&calculator](double a) { return calculator.sineH(a); };
+    legacyFunctions["fact"] = [&calculator](double a) { return calculator.factorial(a); };
+    legacyFunctions["cos"] = [&calculator](double a) { return calculator.cosine(a); };
+
+    std::vector<MathFunction> resolved;
+    for (const std::string& name : names) {
+        MathFunction function;
+        LookupFunction(name.data(), name.length(), function);
+        resolved.push_back(function);
+    }
+
+    std::printf("== Function dispatch (%zu calls per iteration) ==\n", names.size());
+    std::printf("%-40s %14s\n", "path", "ns/call");
+
+    double legacy = MeasureNanoseconds([&]() {
+        for (const std::string& name : names) {
+            if (std::find(legacyNames.begin(), legacyNames.end(), name) != legacyNames.end()) {
+                sink = legacyFunctions.find(name)->second(argValue);
+            }
+        }
+    });
+    std::printf("%-40s %14.1f\n", "linear scan + map<string, function>", legacy / names.size());
+
+    double byName = MeasureNanoseconds([&]() {
+        for (const std::string& name : names) {
+            sink = calculator.calculateFunction(name, argValue);
+        }
+    });
+    std::printf("%-40s %14.1f\n", "calculateFunction (perfect hash)", byName / names.size());
+
+    double byId = MeasureNanoseconds([&]() {
+        for (MathFunction function : resolved) {
+            sink = ApplyFunction(calculator, function, argValue);
+        }
+    });
+    std::printf("%-40s %14.1f\n", "ApplyFunction (resolved at parse time)", byId / names.size());
+    std::printf("\n");
+}
+
+// Distance between two doubles in units in the last place; NaN only
+// matches NaN.
+double UlpDistance(double a, double b) {
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::isnan(a) && std::isnan(b) ? 0.0 : HUGE_VAL;
+    }
+    long long x, y;
+    std::memcpy(&x, &a, sizeof(x));
+    std::memcpy(&y, &b, sizeof(y));
+    if (x < 0) x = -(x & 0x7FFFFFFFFFFFFFFFLL);
+    if (y < 0) y = -(y & 0x7FFFFFFFFFFFFFFFLL);
+    return static_cast<double>(x > y ? x - y : y - x);
+}
+
+struct VectorCase {
+    const char* name;
+    double low;
+    double high;
+    double allowedUlp;
+    void (*batch)(Calculator&, const double*, double*, size_t);
+    double (*scalar)(Calculator&, double);
+};
+
+// Compares the batch kernels with a loop of scalar Calculator calls: the
+// maximum ULP error over random inputs, which fails past the bound
+// vectormath.h documents, then throughput with the kernels forced to their
+// scalar fallback and at the CPU's best SIMD level.
+bool BenchmarkVectorMath() {
+    const VectorCase cases[] = {
+        { "sqrt", 0.0, 1e6, 0,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.squareRoot(in, out, n); },
+          [](Calculator& c, double x) { return c.squareRoot(x); } },
+        { "ln", 1e-300, 1e300, 1,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.naturalLogarithm(in, out, n); },
+          [](Calculator& c, double x) { return c.naturalLogarithm(x); } },
+        { "sin (radians)", -1e4, 1e4, 1,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.sine(in, out, n, false); },
+          [](Calculator& c, double x) { return c.sine(x, false); } },
+        { "cos (radians)", -1e4, 1e4, 1,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.cosine(in, out, n, false); },
+          [](Calculator& c, double x) { return c.cosine(x, false); } },
+        { "tan (radians)", -1e4, 1e4, 2,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.tangent(in, out, n, false); },
+          [](Calculator& c, double x) {
+              try { return c.tangent(x, false); } catch (const std::exception&) { return std::nan(""); }
+          } },
+        { "sin (degrees)", -720.0, 720.0, 1,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.sine(in, out, n); },
+          [](Calculator& c, double x) { return c.sine(x); } },
+        { "sinh", -20.0, 20.0, 2,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.sineH(in, out, n); },
+          [](Calculator& c, double x) { return c.sineH(x); } },
+        { "sinh (small)", -0.6, 0.6, 2,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.sineH(in, out, n); },
+          [](Calculator& c, double x) { return c.sineH(x); } },
+        { "cosh", -20.0, 20.0, 1,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.cosineH(in, out, n); },
+          [](Calculator& c, double x) { return c.cosineH(x); } },
+        { "tanh", -5.0, 5.0, 3,
+          [](Calculator& c, const double* in, double* out, size_t n) { c.tangentH(in, out, n); },
+          [](Calculator& c, double x) { return c.tangentH(x); } },
+    };
+
+    const size_t count = 4096;
+    Calculator calculator;
+    std::mt19937_64 random(42);
+    std::vector<double> input(count);
+    std::vector<double> output(count);
+    SimdLevel best = GetSimdLevel();
+    bool ok = true;
+
+    std::printf("== Batch math kernels (%s, %zu elements) ==\n", GetSimdLevelName(best), count);
+    std::printf("%-16s %8s %12s %12s %12s %9s\n",
+                "function", "max ULP", "scalar ns", "fallback ns", "batch ns", "speedup");
+
+    for (const VectorCase& test : cases) {
+        bool logScale = test.low > 0;
+        std::uniform_real_distribution<double> distribution(
+            logScale ? std::log(test.low) : test.low, logScale ? std::log(test.high) : test.high);
+
+        double maxUlp = 0;
+        for (int round = 0; round < 16; round++) {
+            for (double& x : input) {
+                x = logScale ? std::exp(distribution(random)) : distribution(random);
+            }
+            test.batch(calculator, input.data(), output.data(), count);
+            for (size_t i = 0; i < count; i++) {
+                double ulp = UlpDistance(output[i], test.scalar(calculator, input[i]));
+                if (ulp > maxUlp) {
+                    maxUlp = ulp;
+                }
+            }
+        }
+
+        double scalar = MeasureNanoseconds([&]() {
+            for (size_t i = 0; i < count; i++) {
+                output[i] = test.scalar(calculator, input[i]);
+            }
+        }, 50.0);
+        SetSimdLevel(SimdLevel::Scalar);
+        double fallback = MeasureNanoseconds([&]() {
+            test.batch(calculator, input.data(), output.data(), count);
+        }, 50.0);
+        SetSimdLevel(best);
+        double batch = MeasureNanoseconds([&]() {
+            test.batch(calculator, input.data(), output.data(), count);
+        }, 50.0);
+
+        std::printf("%-16s %8.0f %12.2f %12.2f %12.2f %8.1fx\n", test.name, maxUlp,
+                    scalar / count, fallback / count, batch / count, scalar / batch);
+        if (maxUlp > test.allowedUlp) {
+            std::printf("FAIL: %s is %.0f ULP from the scalar result, at most %.0f allowed\n", test.name,
+                        maxUlp, test.allowedUlp);
+            ok = false;
+        }
+    }
+    std::printf("\n");
+    return ok;
+}
+
+// Element-wise arithmetic over arrays with 1% invalid rows (zero divisors,
+// negative operands): a loop over the throwing scalar calculate() against
+// the array overload, which dispatches once and reports a status per row.
+// Every row must match the scalar call: the same value, and a failed
+// status exactly where the scalar call throws.
+bool BenchmarkBatchArithmetic() {
+    const size_t count = 1 << 16;
+    const char operations[] = { '+', '*', '/', '^', 's', 'l' };
+
+    Calculator calculator;
+    std::mt19937_64 random(7);
+    std::uniform_real_distribution<double> distribution(0.5, 4.0);
+    std::vector<double> a(count), b(count), result(count);
+    std::vector<CalcStatus> status(count);
+    for (size_t i = 0; i < count; i++) {
+        bool invalid = i % 100 == 0;
+        a[i] = invalid ? -distribution(random) : distribution(random);
+        b[i] = invalid ? 0.0 : distribution(random);
+    }
+
+    bool ok = true;
+
+    std::printf("== Array arithmetic (%zu elements, 1%% domain errors) ==\n", count);
+    std::printf("%-10s %14s %14s %9s %8s\n", "operation", "scalar ns", "array ns", "speedup", "errors");
+
+    for (char op : operations) {
+        double scalar = MeasureNanoseconds([&]() {
+            for (size_t i = 0; i < count; i++) {
+                try {
+                    result[i] = calculator.calculate(a[i], b[i], op);
+                } catch (const std::exception&) {
+                    result[i] = std::numeric_limits<double>::quiet_NaN();
+                }
+            }
+        }, 50.0);
+        double array = MeasureNanoseconds([&]() {
+            calculator.calculate(a.data(), b.data(), result.data(), count, op, status.data());
+        }, 50.0);
+
+        size_t errors = 0;
+        size_t mismatches = 0;
+        for (size_t i = 0; i < count; i++) {
+            errors += status[i] != CalcStatus::Ok;
+            bool threw = false;
+            double expected = 0.0;
+            try {
+                expected = calculator.calculate(a[i], b[i], op);
+            } catch (const std::exception&) {
+                threw = true;
+            }
+            bool sameValue = std::memcmp(&expected, &result[i], sizeof(double)) == 0;
+            if (threw != (status[i] != CalcStatus::Ok) || (!threw && !sameValue)) {
+                mismatches++;
+            }
+        }
+        std::printf("'%c' %21.2f %14.2f %8.1fx %8zu\n", op, scalar / count, array / count, scalar / array, errors);
+        if (mismatches != 0) {
+            std::printf("FAIL: %zu rows of '%c' differ from the scalar calculate()\n", mismatches, op);
+            ok = false;
+        }
+    }
+    std::printf("\n");
+    return ok;
+}
+
+std::string NestedCalls(size_t depth) {
+    std::string expression;
+    for (size_t i = 0; i < depth; i++) {
+        expression += "abs(";
+    }
+    expression += "1";
+    expression.append(depth, ')');
+    return expression;
+}
+
+std::string LongSum(size_t terms) {
+    std::string expression = "1";
+    for (size_t i = 1; i < terms; i++) {
+        expression += (i % 3 == 0) ? "*sin(2.5)" : "+3-1";
+    }
+    return expression;
+}
+
+void BenchmarkParserScaling() {
+    std::printf("== Parser scaling (compile only) ==\n");
+    std::printf("%-24s %12s %14s %12s\n", "input", "chars", "compile us", "ns/char");
+
+    const size_t depths[] = { 10, 100, 1000 };
+    for (size_t depth : depths) {
+        std::string expression = NestedCalls(depth);
+        double ns = MeasureNanoseconds([&]() {
+            CompiledExpression compiled(expression);
+            sink = compiled.empty() ? 0.0 : 1.0;
+        });
+        std::printf("nested abs() x%-11zu %12zu %14.2f %12.2f\n", depth, expression.length(),
+                    ns / 1000.0, ns / expression.length());
+    }
+
+    const size_t lengths[] = { 100, 10000, 1000000 };
+    for (size_t terms : lengths) {
+        std::string expression = LongSum(terms);
+        double ns = MeasureNanoseconds([&]() {
+            CompiledExpression compiled(expression);
+            sink = compiled.empty() ? 0.0 : 1.0;
+        });
+        std::printf("long sum x%-14zu %12zu %14.2f %12.2f\n", terms, expression.length(),
+                    ns / 1000.0, ns / expression.length());
+    }
+    std::printf("\n");
+}
+
+// Literals in the shapes real data files contain: integers, fixed-point
+// values of varying precision and exponent notation.
+std::string RandomLiteral(std::mt19937_64& random) {
+    std::uniform_real_distribution<double> mantissa(0.0, 1000.0);
+    std::uniform_int_distribution<int> exponent(-12, 12);
+    char text[32];
+    switch (random() % 4) {
+        case 0: std::snprintf(text, sizeof(text), "%d", static_cast<int>(mantissa(random))); break;
+        case 1: std::snprintf(text, sizeof(text), "%.3f", mantissa(random)); break;
+        case 2: std::snprintf(text, sizeof(text), "%.12f", mantissa(random) / 1000.0); break;
+        default: std::snprintf(text, sizeof(text), "%.6ge%d", mantissa(random), exponent(random)); break;
+    }
+    return text;
+}
+
+void BenchmarkNumberParsing() {
+    std::mt19937_64 random(11);
+    std::vector<std::string> literals;
+    for (size_t i = 0; i < 4096; i++) {
+        literals.push_back(RandomLiteral(random));
+    }
+
+    // The lexer's previous approach: a terminated copy for strtod.
+    double strtodNs = MeasureNanoseconds([&]() {
+        for (const std::string& literal : literals) {
+            char buffer[64];
+            std::memcpy(buffer, literal.data(), literal.size());
+            buffer[literal.size()] = '\0';
+            sink = std::strtod(buffer, NULL);
+        }
+    }) / literals.size();
+    double fromCharsNs = MeasureNanoseconds([&]() {
+        for (const std::string& literal : literals) {
+            double value;
+            std::from_chars(literal.data(), literal.data() + literal.size(), value);
+            sink = value;
+        }
+    }) / literals.size();
+
+    // A number-heavy input file: eight literals per line.
+    const char operators[] = "+-*+";
+    std::string input;
+    const size_t lineCount = 50000;
+    for (size_t i = 0; i < lineCount; i++) {
+        for (size_t j = 0; j < 8; j++) {
+            if (j != 0) {
+                input += operators[(i + j) % 4];
+            }
+            input += literals[(i * 8 + j) % literals.size()];
+        }
+        input += '\n';
+    }
+
+    EvaluationContext context;
+    std::string output;
+    double batchNs = MeasureNanoseconds([&]() {
+        output.clear();
+        EvaluateLines(input.data(), input.data() + input.size(), context, output);
+    }, 500.0);
+
+    std::printf("== Number parsing (%zu literals) ==\n", literals.size());
+    std::printf("%-40s %14.1f\n", "strtod on a copy (ns/literal)", strtodNs);
+    std::printf("%-40s %14.1f\n", "from_chars in place (ns/literal)", fromCharsNs);
+    std::printf("%-40s %14.1f\n", "number-heavy file (MB/s)", input.size() / (batchNs * 1e-3));
+    std::printf("%-40s %14.0f\n", "number-heavy file (lines/s)", lineCount / (batchNs * 1e-9));
+    std::printf("\n");
+}
+
+// Times the old result formatting (std::to_string and trimming zeros,
+// snprintf "%.15g" in batch output) against FormatNumber, and checks that
+// FormatNumber matches "%.15g" exactly and that shortest output reads
+// back as the same double.
+bool BenchmarkFormatting() {
+    std::mt19937_64 random(5);
+    std::uniform_real_distribution<double> mantissa(-1000.0, 1000.0);
+    std::uniform_int_distribution<int> exponent(-40, 40);
+    std::vector<double> values;
+    for (size_t i = 0; i < 4096; i++) {
+        double value = mantissa(random);
+        values.push_back(i % 2 == 0 ? value : value * std::pow(10.0, exponent(random)));
+    }
+    const double specials[] = { 0.0, -0.0, 1e-9, 0.1, 1.0 / 3.0, 1e300, 5e-324, 123456789012345678.0,
+                                 HUGE_VAL, -HUGE_VAL, 42.0, -7.0, 999999999999999.0, 1e15, -1e15, -2.36377048002661e-310 };
+    values.insert(values.end(), specials, specials + sizeof(specials) / sizeof(specials[0]));
+
+    size_t mismatches = 0;
+    for (double value : values) {
+        char expected[numberBufferSize];
+        char actual[numberBufferSize];
+        std::snprintf(expected, sizeof(expected), "%.15g", value);
+        FormatNumber(value, actual, displayDigits);
+
+        char shortest[numberBufferSize];
+        size_t length = FormatNumber(value, shortest);
+        double parsed = 0.0;
+        std::from_chars(shortest, shortest + length, parsed);
+        if (std::strcmp(expected, actual) != 0 || (!std::isinf(value) && parsed != value)) {
+            std::printf("mismatch: %s vs %s, shortest %s\n", expected, actual, shortest);
+            mismatches++;
+        }
+    }
+
+    std::string output;
+    double toStringNs = MeasureNanoseconds([&]() {
+        output.clear();
+        for (double value : values) {
+            std::string text = std::to_string(value);
+            text.erase(text.find_last_not_of('0') + 1, std::string::npos);
+            if (text.back() == '.') {
+                text.pop_back();
+            }
+            output += text;
+        }
+    }) / values.size();
+    double snprintfNs = MeasureNanoseconds([&]() {
+        output.clear();
+        for (double value : values) {
+            char text[32];
+            int length = std::snprintf(text, sizeof(text), "%.15g", value);
+            output.append(text, static_cast<size_t>(length));
+        }
+    }) / values.size();
+    double displayNs = MeasureNanoseconds([&]() {
+        output.clear();
+        for (double value : values) {
+            AppendNumber(output, value, displayDigits);
+        }
+    }) / values.size();
+    double shortestNs = MeasureNanoseconds([&]() {
+        output.clear();
+        for (double value : values) {
+            AppendNumber(output, value);
+        }
+    }) / values.size();
+
+    std::printf("== Result formatting (%zu values, ns/value) ==\n", values.size());
+    std::printf("%-40s %14.1f\n", "std::to_string + trim", toStringNs);
+    std::printf("%-40s %14.1f\n", "snprintf %.15g", snprintfNs);
+    std::printf("%-40s %14.1f\n", "FormatNumber, 15 digits", displayNs);
+    std::printf("%-40s %14.1f\n", "FormatNumber, shortest round-trip", shortestNs);
+    std::printf("%s\n\n", mismatches == 0 ? "OK" : "FAILED");
+    return mismatches == 0;
+}
+
+// Batch input with many duplicate rows: 200000 lines drawn from 2000
+// distinct expressions, a few of which are far more common than the rest.
+// Measures batch throughput at several cache sizes and checks that every
+// size gives exactly the uncached output.
+bool BenchmarkResultCache() {
+    std::mt19937_64 random(3);
+    std::vector<std::string> distinct;
+    for (size_t i = 0; i < 2000; i++) {
+        distinct.push_back("sin(" + std::to_string(i % 360) + ")*" + std::to_string(i) + "+sqrt(" +
+                           std::to_string(i * 7) + ")/ln(" + std::to_string(i + 2) + ")");
+    }
+
+    std::string input;
+    const size_t lineCount = 200000;
+    for (size_t i = 0; i < lineCount; i++) {
+        // Squaring a uniform draw skews the picks toward low indices.
+        double pick = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+        input += distinct[static_cast<size_t>(pick * pick * distinct.size())];
+        input += '\n';
+    }
+
+    size_t maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+
+    std::printf("== Result cache (%zu lines, %zu distinct) ==\n", lineCount, distinct.size());
+    std::printf("%8s %10s %16s %10s\n", "threads", "entries", "lines/s", "hit rate");
+
+    std::vector<std::string> expected = BatchEvaluator(1).evaluate(input.data(), input.size());
+    bool ok = true;
+
+    const size_t capacities[] = { 0, 100, 1000, 4000 };
+    for (size_t threads = 1; ; threads = maxThreads) {
+        for (size_t capacity : capacities) {
+            BatchEvaluator evaluator(threads);
+            std::unique_ptr<ResultCache> cache(capacity != 0 ? new ResultCache(capacity) : NULL);
+            evaluator.setResultCache(cache.get());
+
+            double ns = MeasureNanoseconds([&]() {
+                sink = static_cast<double>(evaluator.evaluate(input.data(), input.size()).size());
+            }, 500.0);
+
+            double hitRate = 0.0;
+            if (cache) {
+                ResultCache::Stats stats = cache->getStats();
+                hitRate = 100.0 * stats.hits / (stats.hits + stats.misses);
+            }
+            std::printf("%8zu %10zu %16.0f %9.1f%%\n", threads, capacity, lineCount / (ns * 1e-9), hitRate);
+
+            std::string output;
+            std::string reference;
+            for (const std::string& chunk : evaluator.evaluate(input.data(), input.size())) {
+                output += chunk;
+            }
+            for (const std::string& chunk : expected) {
+                reference += chunk;
+            }
+            if (output != reference) {
+                std::printf("FAIL: %zu threads with %zu entries differ from the uncached output\n", threads,
+                            capacity);
+                ok = false;
+            }
+        }
+        if (threads == maxThreads) {
+            break;
+        }
+    }
+    std::printf("\n");
+    return ok;
+}
+
+// Runs the same input cold, then against the cache reopened as a later run
+// would, and checks that both produce the uncached output. Also checks
+// that compaction keeps exactly the records the last run used.
+bool BenchmarkDiskCache() {
+    const char* path = "calc-bench.cache";
+    const std::string indexPath = std::string(path) + ".idx";
+    std::remove(path);
+    std::remove(indexPath.c_str());
+
+    std::string input;
+    const size_t lineCount = 100000;
+    for (size_t i = 0; i < lineCount; i++) {
+        input += "sin(" + std::to_string(i % 360) + ")*" + std::to_string(i % 5000) + "+sqrt(" +
+                 std::to_string(i % 997) + ")\n";
+    }
+
+    std::printf("== Disk cache (%zu lines) ==\n", lineCount);
+    std::printf("%-10s %16s %10s\n", "run", "lines/s", "hit rate");
+
+    BatchEvaluator evaluator(1);
+    std::vector<std::string> expected = evaluator.evaluate(input.data(), input.size());
+    bool ok = true;
+
+    const char* runs[] = { "uncached", "cold", "warm" };
+    for (int run = 0; run < 3; run++) {
+        DiskCache cache;
+        if (run != 0) {
+            if (!cache.open(path)) {
+                std::printf("FAIL: %s\n\n", cache.getError().c_str());
+                return false;
+            }
+            evaluator.setDiskCache(&cache);
+        }
+
+        std::vector<std::string> output;
+        auto start = std::chrono::steady_clock::now();
+        output = evaluator.evaluate(input.data(), input.size());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        evaluator.setDiskCache(NULL);
+
+        DiskCache::Stats stats = cache.getStats();
+        double hitRate = stats.hits + stats.misses != 0 ? 100.0 * stats.hits / (stats.hits + stats.misses) : 0.0;
+        std::printf("%-10s %16.0f %9.1f%%\n", runs[run], lineCount / seconds, hitRate);
+        if (output != expected) {
+            std::printf("FAIL: %s run output differs from uncached\n", runs[run]);
+            ok = false;
+        }
+    }
+
+    // A run over half the distinct lines, then compaction to that run.
+    DiskCache cache;
+    cache.open(path);
+    evaluator.setDiskCache(&cache);
+    std::string half = input.substr(0, input.size() / 2);
+    evaluator.evaluate(half.data(), half.size());
+    evaluator.setDiskCache(NULL);
+    size_t before = cache.getStats().records;
+    cache.compact();
+    size_t after = cache.getStats().records;
+    cache.close();
+
+    cache.open(path);
+    evaluator.setDiskCache(&cache);
+    std::vector<std::string> output = evaluator.evaluate(input.data(), input.size());
+    evaluator.setDiskCache(NULL);
+    DiskCache::Stats stats = cache.getStats();
+    std::printf("compact: %zu -> %zu records, then %zu hits, %zu misses\n", before, after, stats.hits, stats.misses);
+    if (output != expected || stats.insertions != before - after) {
+        std::printf("FAIL: compacted cache lost or kept the wrong records\n");
+        ok = false;
+    }
+    cache.close();
+
+    std::remove(path);
+    std::remove(indexPath.c_str());
+    std::printf("\n");
+    return ok;
+}
+
+// Reads the same expression file through LineReader and MappedFile and
+// compares throughput; both must see the same lines. Counting lines is
+// all the work done, so the difference is the cost of copying the input.
+bool BenchmarkInputPaths() {
+    const char* path = "calc-bench.input";
+    const size_t lineCount = 2000000;
+    FILE* file = std::fopen(path, "wb");
+    if (file == NULL) {
+        std::printf("== Input paths ==\ncannot create %s\n\n", path);
+        return true;
+    }
+    {
+        OutputBuffer output(file);
+        for (size_t i = 0; i < lineCount; i++) {
+            static const char* const lines[] = { "sin(30)+1\n", "2^10*(3+4)\n", "log(sqrt(16))+abs(-3.5)\n" };
+            output.write(lines[i % 3], std::strlen(lines[i % 3]));
+        }
+    }
+    std::fclose(file);
+
+    typedef std::chrono::steady_clock Clock;
+    size_t bufferedLines = 0;
+    size_t bytes = 0;
+    Clock::time_point start = Clock::now();
+    file = std::fopen(path, "rb");
+    {
+        LineReader reader(file, 8 << 20);
+        const char* data;
+        size_t length;
+        while (reader.nextBlock(data, length)) {
+            bufferedLines += std::count(data, data + length, '\n');
+            bytes += length;
+        }
+    }
+    std::fclose(file);
+    double buffered = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t mappedLines = 0;
+    start = Clock::now();
+    MappedFile mapped;
+    bool available = mapped.open(path);
+    if (available) {
+        const char* data;
+        size_t length;
+        while (mapped.nextBlock(data, length)) {
+            mappedLines += std::count(data, data + length, '\n');
+        }
+    }
+    double mappedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::remove(path);
+
+    std::printf("== Input paths (%zu lines, %zu MB) ==\n", lineCount, bytes >> 20);
+    std::printf("%-12s %10.0f MB/s\n", "LineReader", bytes / buffered / 1e6);
+    if (!available) {
+        std::printf("MappedFile   not available on this platform\n\n");
+        return bufferedLines == lineCount;
+    }
+    std::printf("%-12s %10.0f MB/s\n\n", "MappedFile", bytes / mappedSeconds / 1e6);
+    if (bufferedLines != lineCount || mappedLines != lineCount) {
+        std::printf("FAIL: read %zu and %zu lines, expected %zu\n", bufferedLines, mappedLines, lineCount);
+        return false;
+    }
+    return true;
+}
+
+// Runs the expressions over the CSV text input, returning run()'s result
+// with the output text, or the error when it fails.
+bool EvaluateCsvText(const char* input, const std::vector<std::string>& expressions, std::string& result) {
+    FILE* inputFile = std::tmpfile();
+    FILE* outputFile = std::tmpfile();
+    bool ok = false;
+    if (inputFile != NULL && outputFile != NULL) {
+        std::fputs(input, inputFile);
+        std::rewind(inputFile);
+        CsvEvaluator evaluator;
+        for (const std::string& expression : expressions) {
+            evaluator.addExpression(expression);
+        }
+        {
+            OutputBuffer output(outputFile);
+            ok = evaluator.run(inputFile, output);
+        }
+        std::rewind(outputFile);
+        char text[256];
+        result.assign(text, std::fread(text, 1, sizeof(text), outputFile));
+        if (!ok) {
+            result = evaluator.getError();
+        }
+    }
+    if (inputFile != NULL) {
+        std::fclose(inputFile);
+    }
+    if (outputFile != NULL) {
+        std::fclose(outputFile);
+    }
+    return ok;
+}
+
+// Streams a generated CSV file through CsvEvaluator and compares its speed
+// with just reading the file, checking every output line against the
+// compiled expression evaluated row by row.
+bool BenchmarkCsv() {
+    const char* path = "calc-bench.csv";
+    const char* outputPath = "calc-bench.csv.out";
+    const char* expression = "qty*price*(1-disc/100)";
+    const size_t rowCount = 2000000;
+    const size_t badRowInterval = 1000;
+    FILE* file = std::fopen(path, "wb");
+    if (file == NULL) {
+        std::printf("== CSV evaluation ==\ncannot create %s\n\n", path);
+        return true;
+    }
+    std::mt19937 random(7);
+    std::vector<double> qty(rowCount), price(rowCount), disc(rowCount);
+    {
+        OutputBuffer output(file);
+        const char* header = "id,qty,price,disc,note\n";
+        output.write(header, std::strlen(header));
+        std::string line;
+        for (size_t i = 0; i < rowCount; i++) {
+            qty[i] = static_cast<double>(random() % 50 + 1);
+            price[i] = static_cast<double>(random() % 100000) / 100;
+            disc[i] = static_cast<double>(random() % 40);
+            line = std::to_string(i) + ',';
+            AppendNumber(line, qty[i]);
+            line += ',';
+            if (i % badRowInterval == 0) {
+                line += "n/a";
+            } else {
+                AppendNumber(line, price[i]);
+            }
+            line += ',';
+            AppendNumber(line, disc[i]);
+            line += ",\"item\"\n";
+            output.write(line.data(), line.size());
+        }
+    }
+    std::fclose(file);
+
+    typedef std::chrono::steady_clock Clock;
+    size_t bytes = 0;
+    size_t lines = 0;
+    Clock::time_point start = Clock::now();
+    MappedFile mapped;
+    if (!mapped.open(path)) {
+        std::printf("== CSV evaluation ==\nMappedFile not available on this platform\n\n");
+        std::remove(path);
+        return true;
+    }
+    const char* data;
+    size_t length;
+    while (mapped.nextBlock(data, length)) {
+        lines += std::count(data, data + length, '\n');
+        bytes += length;
+    }
+    double readSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    sink = static_cast<double>(lines);
+
+    size_t maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+    std::printf("== CSV evaluation (%zu rows, %zu MB, %s) ==\n", rowCount, bytes >> 20, expression);
+    std::printf("%-20s %10.0f MB/s\n", "read only", bytes / readSeconds / 1e6);
+
+    std::vector<size_t> threadCounts(1, 1);
+    if (maxThreads > 1) {
+        threadCounts.push_back(maxThreads);
+    }
+    // The target is evaluating in at most twice the time of only reading,
+    // with the best thread count. It depends on the machine, so it is
+    // reported rather than failed.
+    const double maxReadRatio = 2.0;
+    double bestReadRatio = 0.0;
+    bool ok = true;
+    for (size_t threads : threadCounts) {
+        FILE* outputFile = std::fopen(outputPath, "wb");
+        if (outputFile == NULL) {
+            break;
+        }
+        start = Clock::now();
+        {
+            MappedFile input;
+            input.open(path);
+            CsvEvaluator evaluator(threads);
+            evaluator.addExpression(expression);
+            OutputBuffer output(outputFile);
+            ok = evaluator.run(input, output);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::fclose(outputFile);
+        char label[32];
+        std::snprintf(label, sizeof(label), "evaluate, %zu thread%s", threads, threads == 1 ? "" : "s");
+        std::printf("%-20s %10.0f MB/s  %5.2fx read time\n", label, bytes / seconds / 1e6, seconds / readSeconds);
+        if (bestReadRatio == 0.0 || seconds / readSeconds < bestReadRatio) {
+            bestReadRatio = seconds / readSeconds;
+        }
+    }
+    std::printf("target %.0fx read time: %s (best %.2fx)\n", maxReadRatio,
+                bestReadRatio <= maxReadRatio ? "met" : "not met", bestReadRatio);
+
+    VariableTable table;
+    table.define("qty");
+    table.define("price");
+    table.define("disc");
+    CompiledExpression compiled(expression, &table);
+    EvaluationContext context;
+    context.setVariables(&table);
+    size_t mismatches = 0;
+    size_t checked = 0;
+    file = std::fopen(outputPath, "rb");
+    if (file != NULL) {
+        LineReader reader(file);
+        const char* line;
+        size_t lineLength;
+        bool first = true;
+        while (reader.next(line, lineLength)) {
+            if (first) {
+                first = false;
+                mismatches += std::string(line, lineLength) != expression;
+                continue;
+            }
+            std::string expected;
+            if (checked % badRowInterval == 0) {
+                expected = "Error: Invalid number in field price: 'n/a'";
+            } else {
+                table.set(0, qty[checked]);
+                table.set(1, price[checked]);
+                table.set(2, disc[checked]);
+                AppendNumber(expected, compiled.evaluate(context), displayDigits);
+            }
+            mismatches += std::string(line, lineLength) != expected;
+            checked++;
+        }
+        std::fclose(file);
+    }
+    std::remove(path);
+    std::remove(outputPath);
+
+    std::printf("%zu of %zu rows match row-by-row evaluation\n\n", checked - mismatches, rowCount);
+    if (!ok || checked != rowCount || mismatches != 0) {
+        std::printf("FAIL: CSV output differs from row-by-row evaluation\n");
+        return false;
+    }
+
+    // A missing or bad field fails only the expressions that use it, and
+    // non-finite fields are not numbers.
+    const char* smallInput = "qty,price,disc\n4,2\n1,nan,3\n2,4,-inf\n";
+    const char* smallExpected =
+        "qty/price,disc+1\n"
+        "2,Error: Missing field disc\n"
+        "Error: Invalid number in field price: 'nan',4\n"
+        "0.5,Error: Invalid number in field disc: '-inf'\n";
+    std::string result;
+    if (!EvaluateCsvText(smallInput, {"qty/price", "disc+1"}, result) || result != smallExpected) {
+        std::printf("FAIL: CSV field errors reach expressions that do not use the field\n");
+        ok = false;
+    }
+
+    // Columns may hold '_', and one an expression cannot read as a variable
+    // (here the constant e) is an error naming it, not silently skipped.
+    if (!EvaluateCsvText("unit_price,qty\n2,3\n", {"unit_price*qty"}, result) ||
+        result != "unit_price*qty\n6\n") {
+        std::printf("FAIL: CSV column with '_' is not a variable\n");
+        ok = false;
+    }
+    if (EvaluateCsvText("e,qty\n2,3\n", {"e*qty"}, result) || result.find("Column 'e'") == std::string::npos) {
+        std::printf("FAIL: CSV column shadowed by a constant is not reported\n");
+        ok = false;
+    }
+    return ok;
+}
+
+void BenchmarkBatchScaling() {
+    const char* templates[] = {
+        "sin(30)*cos(60)+tan(15)",
+        "5^2 + sqrt(16) - ln(10)",
+        "(1+2)*(3+4)/5-6^2",
+        "log(sqrt(16))+abs(-3.5)*fact(5)",
+    };
+
+    std::string input;
+    const size_t lineCount = 200000;
+    for (size_t i = 0; i < lineCount; i++) {
+        input += templates[i % 4];
+        input += '\n';
+    }
+
+    size_t maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+        maxThreads = 1;
+    }
+
+    std::printf("== Batch evaluation scaling (%zu lines, %zu hardware threads) ==\n", lineCount, maxThreads);
+    std::printf("%8s %16s %10s\n", "threads", "lines/s", "scaling");
+
+    double baseline = 0.0;
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        BatchEvaluator evaluator(threads);
+        double ns = MeasureNanoseconds([&]() {
+            sink = static_cast<double>(evaluator.evaluate(input.data(), input.size()).size());
+        }, 500.0);
+
+        double linesPerSecond = lineCount / (ns * 1e-9);
+        if (threads == 1) {
+            baseline = linesPerSecond;
+        }
+        std::printf("%8zu %16.0f %9.2fx\n", threads, linesPerSecond, linesPerSecond / baseline);
+
+        if (threads < maxThreads && threads * 2 > maxThreads) {
+            threads = maxThreads / 2;
+        }
+    }
+    std::printf("\n");
+}
+
+std::string Describe(const std::string& expression, EvaluationContext& context) {
+    char text[64];
+    try {
+        std::snprintf(text, sizeof(text), "%.17g", EvaluateExpression(expression, context));
+        return text;
+    } catch (const std::exception& e) {
+        return std::string("Error: ") + e.what();
+    }
+}
+
+// Evaluates the same expressions from many threads at once, each with its
+// own context, and checks every result against a single-threaded run.
+bool StressConcurrentContexts() {
+    const std::vector<std::string> expressions = {
+        "sin(30)*cos(60)+tan(15)",
+        "asin(0.5)+acos(0.5)+atan(1)",
+        "5^2 + sqrt(16) - ln(10)",
+        "log(sqrt(16))+abs(-3.5)*fact(5)",
+        "sinh(1)-cosh(1)+tanh(0.5)",
+        "2^-3^2*8/-2/2",
+        "1/0",
+        "asin(2)",
+        "tan(90)",
+        "foo+1",
+        "sin(2",
+    };
+    const AngleMode modes[] = { AngleMode::Degrees, AngleMode::Radians };
+
+    std::vector<std::string> expected[2];
+    for (int mode = 0; mode < 2; mode++) {
+        EvaluationContext context(modes[mode]);
+        for (const std::string& expression : expressions) {
+            expected[mode].push_back(Describe(expression, context));
+        }
+    }
+
+    size_t threadCount = std::thread::hardware_concurrency();
+    if (threadCount < 8) {
+        threadCount = 8;
+    }
+    const size_t rounds = 2000;
+    std::atomic<size_t> mismatches(0);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.push_back(std::thread([&, t]() {
+            int mode = static_cast<int>(t % 2);
+            EvaluationContext context(modes[mode]);
+            for (size_t round = 0; round < rounds; round++) {
+                size_t i = (round + t) % expressions.size();
+                if (Describe(expressions[i], context) != expected[mode][i]) {
+                    mismatches++;
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::printf("== Concurrent context stress (%zu threads x %zu evaluations) ==\n", threadCount, rounds);
+    std::printf("%s: %zu mismatches\n\n", mismatches == 0 ? "OK" : "FAILED", mismatches.load());
+    return mismatches == 0;
+}
+
+// Mirrors the GUI's previous logger: one formatted write and a flush per
+// message.
+class FlushingFileSink : public LogSink {
+public:
+    explicit FlushingFileSink(FILE* file) : file(file) {}
+
+    void write(const std::string& message, const std::string& category) {
+        std::fprintf(file, "[%s] %s\n", category.c_str(), message.c_str());
+        std::fflush(file);
+    }
+
+private:
+    FILE* file;
+};
+
+void BenchmarkLogging() {
+    const std::string expression = "sin(30)*cos(60)+tan(15)";
+    const char* logPath = "calc-bench.log";
+
+    EvaluationContext context;
+    DebugLogSink logSink;
+
+    std::printf("== Evaluation cost with CALC tracing ==\n");
+    std::printf("%-40s %14s\n", "configuration", "ns/eval");
+
+    double baseline = MeasureNanoseconds([&]() {
+        sink = EvaluateExpression(expression, context);
+    });
+    std::printf("%-40s %14.1f\n", "no sink", baseline);
+
+    context.setLogSink(&logSink);
+    double closed = MeasureNanoseconds([&]() {
+        sink = EvaluateExpression(expression, context);
+    });
+    std::printf("%-40s %14.1f\n", "sink attached, log closed", closed);
+
+    if (DebugLog::open(logPath, LogLevel::Info)) {
+        double filtered = MeasureNanoseconds([&]() {
+            sink = EvaluateExpression(expression, context);
+        });
+        std::printf("%-40s %14.1f\n", "log open, level above debug", filtered);
+
+        DebugLog::setLevel(LogLevel::Debug);
+        double async = MeasureNanoseconds([&]() {
+            sink = EvaluateExpression(expression, context);
+        }, 50.0);
+        std::printf("%-40s %14.1f\n", "log open, async writer", async);
+        DebugLog::close();
+    }
+
+    FILE* file = std::fopen(logPath, "w");
+    if (file != NULL) {
+        FlushingFileSink flushingSink(file);
+        context.setLogSink(&flushingSink);
+        double flushing = MeasureNanoseconds([&]() {
+            sink = EvaluateExpression(expression, context);
+        }, 50.0);
+        std::printf("%-40s %14.1f\n", "flush per message (previous logger)", flushing);
+        std::fclose(file);
+    }
+
+    std::remove(logPath);
+    std::printf("\n");
+}
+
+// Runs body once to warm up the scratch buffers, then counts the heap
+// allocations made by further calls.
+template <typename Body>
+size_t CountAllocations(Body body) {
+    body();
+    size_t before = allocationCount.load();
+    for (int i = 0; i < 1000; i++) {
+        body();
+    }
+    return allocationCount.load() - before;
+}
+
+// The evaluation paths must not allocate once a context has warmed up.
+// One of each error class: lexer, parser, operator and function domain.
+const std::string malformedExpressions[] = {
+    "2+$3",
+    "(1+2))*3",
+    "sin(30)*(4-2^)",
+    "10/(5-5)",
+    "sqrt(4-8)",
+};
+
+// Throwing and non-throwing evaluation of the same mix, with one line in
+// errorEvery malformed.
+void BenchmarkErrorHandling() {
+    std::printf("== Error-heavy workloads (ns per expression) ==\n");
+    std::printf("%-12s %16s %16s %10s\n", "malformed", "throwing", "non-throwing", "speedup");
+
+    const std::string valid[] = {
+        "((1+2)*3-4)/5+6", "sin(30)*cos(60)+tan(15)", "5^2 + sqrt(16) - ln(10)",
+        "2*pi*3.5", "fact(5)/abs(-4)", "log(1000)+8%3",
+    };
+    const size_t validCount = sizeof(valid) / sizeof(valid[0]);
+    const size_t malformedCount = sizeof(malformedExpressions) / sizeof(malformedExpressions[0]);
+    const size_t errorEveries[] = { 20, 10, 2, 1 };
+
+    EvaluationContext context;
+    for (size_t errorEvery : errorEveries) {
+        std::vector<const std::string*> workload;
+        for (size_t i = 0; i < 200; i++) {
+            workload.push_back(i % errorEvery == errorEvery - 1 ? &malformedExpressions[i % malformedCount]
+                                                                : &valid[i % validCount]);
+        }
+
+        double throwing = MeasureNanoseconds([&]() {
+            for (const std::string* expression : workload) {
+                try {
+                    sink = EvaluateExpression(*expression, context);
+                } catch (const std::exception&) {
+                    sink = 0.0;
+                }
+            }
+        }) / workload.size();
+        double nonThrowing = MeasureNanoseconds([&]() {
+            for (const std::string* expression : workload) {
+                EvalResult result = TryEvaluateExpression(*expression, context);
+                sink = result.ok() ? result.value : 0.0;
+            }
+        }) / workload.size();
+
+        char label[16];
+        std::snprintf(label, sizeof(label), "%.0f%%", 100.0 / errorEvery);
+        std::printf("%-12s %16.1f %16.1f %9.2fx\n", label, throwing, nonThrowing, throwing / nonThrowing);
+    }
+    std::printf("\n");
+}
+
+bool CheckSteadyStateAllocations() {
+    const std::string expressions[] = {
+        "((((1+2)*3-4)/5+6)*7-8)/9+10*11-12^2",
+        "sin(30)*cos(60)+tan(15)",
+        "5^2 + sqrt(16) - ln(10)",
+        "sinpi+cos30-8/-2/2",
+    };
+    std::string lines;
+    for (const std::string& expression : expressions) {
+        lines += expression;
+        lines += '\n';
+    }
+    for (const std::string& expression : malformedExpressions) {
+        lines += expression;
+        lines += '\n';
+    }
+
+    EvaluationContext context;
+    CompiledExpression compiled(expressions[0]);
+    std::string output;
+
+    size_t precompiled = CountAllocations([&]() {
+        sink = compiled.evaluate(context);
+    });
+    size_t oneStep = CountAllocations([&]() {
+        for (const std::string& expression : expressions) {
+            sink = EvaluateExpression(expression, context);
+        }
+    });
+    size_t batch = CountAllocations([&]() {
+        output.clear();
+        EvaluateLines(lines.data(), lines.data() + lines.size(), context, output);
+    });
+    ResultCache cache(64);
+    EvaluationContext cachedContext;
+    cachedContext.setResultCache(&cache);
+    sink = EvaluateExpression(expressions[1], cachedContext);
+    size_t cached = CountAllocations([&]() {
+        sink = EvaluateExpression(expressions[1], cachedContext);
+    });
+    size_t failing = CountAllocations([&]() {
+        for (const std::string& expression : malformedExpressions) {
+            sink = TryEvaluateExpression(expression, context).value;
+        }
+    });
+
+    bool ok = precompiled == 0 && oneStep == 0 && batch == 0 && failing == 0 && cached == 0;
+    std::printf("== Steady-state allocations (1000 iterations) ==\n");
+    std::printf("%-40s %zu\n", "CompiledExpression::evaluate", precompiled);
+    std::printf("%-40s %zu\n", "EvaluateExpression", oneStep);
+    std::printf("%-40s %zu\n", "EvaluateLines", batch);
+    std::printf("%-40s %zu\n", "TryEvaluateExpression (errors)", failing);
+    std::printf("%-40s %zu\n", "EvaluateExpression (cache hit)", cached);
+    std::printf("%s\n\n", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+}
+
+int main() {
+    bool ok = CheckSteadyStateAllocations();
+    BenchmarkBytecode();
+    ok = BenchmarkOptimizer() && ok;
+    ok = BenchmarkJit() && ok;
+    ok = BenchmarkVariables() && ok;
+    ok = BenchmarkColumnar() && ok;
+    ok = BenchmarkFusedColumns() && ok;
+    BenchmarkFunctionDispatch();
+    BenchmarkErrorHandling();
+    ok = BenchmarkVectorMath() && ok;
+    ok = BenchmarkBatchArithmetic() && ok;
+    BenchmarkParserScaling();
+    BenchmarkNumberParsing();
+    ok = BenchmarkFormatting() && ok;
+    ok = BenchmarkInputPaths() && ok;
+    ok = BenchmarkCsv() && ok;
+    BenchmarkBatchScaling();
+    ok = BenchmarkResultCache() && ok;
+    ok = BenchmarkDiskCache() && ok;
+    BenchmarkLogging();
+    ok = StressConcurrentContexts() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,295 @@
+#include "bytecode.h"
+#include <stdexcept>
+#include <string>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+bool OperatorFailed(EvalError& error, EvalErrorKind kind, size_t position, char op, double a, double b) {
+    error.kind = kind;
+    error.position = position;
+    error.length = 1;
+    error.op = op;
+    error.left = a;
+    error.right = b;
+    return false;
+}
+
+}
+
+double ApplyOperator(Calculator& calculator, double a, double b, char op) {
+    switch (op) {
+        case '+': return a + b;
+        case '-': return a - b;
+        case '*': return a * b;
+        case '/':
+            if (b == 0) throw std::runtime_error("Division by zero");
+            return a / b;
+        case '%':
+            if (b == 0) throw std::runtime_error("Modulo by zero");
+            return std::fmod(a, b);
+        case '^':
+        {
+            CalcStatus status;
+            double result = calculator.power(a, b, status);
+            if (status != CalcStatus::Ok) {
+                throw std::runtime_error(std::string("Power error: ") + GetStatusMessage(status));
+            }
+            return result;
+        }
+        default: throw std::runtime_error("Unknown operator: " + std::string(1, op));
+    }
+}
+
+Bytecode::Bytecode() : depth(0), maxDepth(0), temporaryCount(0), variableCount(0), highestVariablePosition(0),
+                       highestVariableLength(0) {
+}
+
+void Bytecode::push() {
+    depth++;
+    if (depth > maxDepth) {
+        maxDepth = depth;
+    }
+}
+
+void Bytecode::emit(OpCode op, MathFunction function, unsigned int operand, size_t position) {
+    Instruction instruction = { op, function, operand };
+    instructions.push_back(instruction);
+    positions.push_back(static_cast<unsigned int>(position));
+}
+
+void Bytecode::emitConstant(double value, size_t position) {
+    emit(OpCode::PushConst, MathFunction::Sin, static_cast<unsigned int>(constants.size()), position);
+    constants.push_back(value);
+    push();
+}
+
+void Bytecode::emitModeConstant(double degrees, double radians, size_t position) {
+    emit(OpCode::PushModeConst, MathFunction::Sin, static_cast<unsigned int>(constants.size()), position);
+    constants.push_back(degrees);
+    constants.push_back(radians);
+    push();
+}
+
+void Bytecode::emitStore(unsigned int temporary, size_t position) {
+    if (depth < 1) {
+        throw std::runtime_error("Invalid expression: nothing to store");
+    }
+
+    emit(OpCode::Store, MathFunction::Sin, temporary, position);
+    if (temporary >= temporaryCount) {
+        temporaryCount = temporary + 1;
+    }
+}
+
+void Bytecode::emitLoad(unsigned int temporary, size_t position) {
+    emit(OpCode::Load, MathFunction::Sin, temporary, position);
+    if (temporary >= temporaryCount) {
+        temporaryCount = temporary + 1;
+    }
+    push();
+}
+
+void Bytecode::emitResult(unsigned int temporary, size_t position) {
+    emitStore(temporary, position);
+    instructions.back().op = OpCode::Result;
+    depth--;
+}
+
+void Bytecode::emitVariable(unsigned int slot, size_t position, size_t length) {
+    emit(OpCode::LoadVar, MathFunction::Sin, slot, position);
+    if (slot >= variableCount) {
+        variableCount = slot + 1;
+        highestVariablePosition = position;
+        highestVariableLength = length;
+    }
+    push();
+}
+
+void Bytecode::emitOperator(char op, size_t position) {
+    OpCode code;
+    switch (op) {
+        case '+': code = OpCode::Add; break;
+        case '-': code = OpCode::Subtract; break;
+        case '*': code = OpCode::Multiply; break;
+        case '/': code = OpCode::Divide; break;
+        case '%': code = OpCode::Modulo; break;
+        case '^': code = OpCode::Power; break;
+        default: throw std::runtime_error("Unknown operator: " + std::string(1, op));
+    }
+
+    if (depth < 2) {
+        throw std::runtime_error("Invalid expression: not enough operands for operator '" + std::string(1, op) + "'");
+    }
+
+    emit(code, MathFunction::Sin, 0, position);
+    depth--;
+}
+
+void Bytecode::emitCall(MathFunction function, size_t position) {
+    if (depth < 1) {
+        throw std::runtime_error("Invalid expression: function call without an argument");
+    }
+
+    emit(OpCode::Call, function, 0, position);
+}
+
+void Bytecode::clear() {
+    instructions.clear();
+    constants.clear();
+    positions.clear();
+    depth = 0;
+    maxDepth = 0;
+    temporaryCount = 0;
+    variableCount = 0;
+    highestVariablePosition = 0;
+    highestVariableLength = 0;
+}
+
+void Bytecode::reserve(size_t instructionCount) {
+    instructions.reserve(instructionCount);
+    constants.reserve(instructionCount);
+    positions.reserve(instructionCount);
+}
+
+bool Bytecode::tryExecute(EvaluationContext& context, double* stack, double& result, EvalError& error) const {
+    if (instructions.empty()) {
+        result = 0.0;
+        return true;
+    }
+
+    Calculator& calculator = context.getCalculator();
+    bool inDegrees = context.inDegrees();
+
+    const Instruction* begin = instructions.data();
+    const Instruction* ip = begin;
+    const Instruction* end = ip + instructions.size();
+    const double* constantPool = constants.data();
+    const double* variables = context.getVariableValues();
+    unsigned int modeOffset = inDegrees ? 0 : 1;
+    size_t sp = temporaryCount;
+
+    for (; ip != end; ++ip) {
+        switch (ip->op) {
+            case OpCode::PushConst:
+                stack[sp++] = constantPool[ip->operand];
+                break;
+            case OpCode::PushModeConst:
+                stack[sp++] = constantPool[ip->operand + modeOffset];
+                break;
+            case OpCode::Store:
+                stack[ip->operand] = stack[sp - 1];
+                break;
+            case OpCode::Load:
+                stack[sp++] = stack[ip->operand];
+                break;
+            case OpCode::LoadVar:
+                stack[sp++] = variables[ip->operand];
+                break;
+            case OpCode::Result:
+                stack[ip->operand] = stack[--sp];
+                break;
+            case OpCode::Add:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] + stack[sp];
+                break;
+            case OpCode::Subtract:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] - stack[sp];
+                break;
+            case OpCode::Multiply:
+                sp--;
+                stack[sp - 1] = stack[sp - 1] * stack[sp];
+                break;
+            case OpCode::Divide:
+                sp--;
+                if (stack[sp] == 0) {
+                    return OperatorFailed(error, EvalErrorKind::DivisionByZero, positions[ip - begin], '/',
+                                          stack[sp - 1], stack[sp]);
+                }
+                stack[sp - 1] = stack[sp - 1] / stack[sp];
+                break;
+            case OpCode::Modulo:
+                sp--;
+                if (stack[sp] == 0) {
+                    return OperatorFailed(error, EvalErrorKind::ModuloByZero, positions[ip - begin], '%',
+                                          stack[sp - 1], stack[sp]);
+                }
+                stack[sp - 1] = std::fmod(stack[sp - 1], stack[sp]);
+                break;
+            case OpCode::Power: {
+                sp--;
+                CalcStatus status;
+                double value = calculator.power(stack[sp - 1], stack[sp], status);
+                if (status != CalcStatus::Ok) {
+                    error.powerStatus = status;
+                    return OperatorFailed(error, EvalErrorKind::InvalidPower, positions[ip - begin], '^',
+                                          stack[sp - 1], stack[sp]);
+                }
+                stack[sp - 1] = value;
+                break;
+            }
+            case OpCode::Call: {
+                FunctionError status = FunctionError::None;
+                double value = TryApplyFunction(calculator, ip->function, stack[sp - 1], inDegrees, status);
+                if (status != FunctionError::None) {
+                    error.kind = EvalErrorKind::FunctionDomain;
+                    error.position = positions[ip - begin];
+                    error.length = std::strlen(GetFunctionName(ip->function));
+                    error.function = ip->function;
+                    error.functionError = status;
+                    error.left = stack[sp - 1];
+                    return false;
+                }
+                stack[sp - 1] = value;
+                break;
+            }
+        }
+    }
+
+    result = stack[sp - 1];
+    return true;
+}
+
+double Bytecode::execute(EvaluationContext& context, double* stack) const {
+    double result;
+    EvalError error = EvalError();
+    if (!tryExecute(context, stack, result, error)) {
+        // Runtime messages are built from the operands alone.
+        throw std::runtime_error(DescribeError(error, NULL));
+    }
+    return result;
+}
+
+const std::vector<Instruction>& Bytecode::getInstructions() const {
+    return instructions;
+}
+
+const std::vector<double>& Bytecode::getConstants() const {
+    return constants;
+}
+
+size_t Bytecode::getStackDepth() const {
+    return temporaryCount + maxDepth;
+}
+
+size_t Bytecode::getTemporaryCount() const {
+    return temporaryCount;
+}
+
+size_t Bytecode::getVariableCount() const {
+    return variableCount;
+}
+
+size_t Bytecode::getHighestVariablePosition() const {
+    return highestVariablePosition;
+}
+
+size_t Bytecode::getHighestVariableLength() const {
+    return highestVariableLength;
+}
+
+bool Bytecode::empty() const {
+    return instructions.empty();
+}
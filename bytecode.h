@@ -0,0 +1,102 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <vector>
+#include <cstddef>
+#include "calculator.h"
+#include "context.h"
+#include "evalerror.h"
+#include "functions.h"
+
+enum class OpCode : unsigned char {
+    PushConst,
+    PushModeConst,
+    Store,
+    Load,
+    LoadVar,
+    Add,
+    Subtract,
+    Multiply,
+    Divide,
+    Modulo,
+    Power,
+    Call,
+    Result
+};
+
+struct Instruction {
+    OpCode op;
+    MathFunction function;
+    unsigned int operand;
+};
+
+// A compiled expression lowered to a flat stack-machine program. Execution
+// needs a caller-supplied value stack of at least getStackDepth() slots.
+// Each instruction remembers the source position it came from, kept
+// beside the program so that runtime errors can point into the text.
+//
+// Optimized programs also use the bottom of the stack as temporaries:
+// Store copies the top of the stack into a temporary and Load pushes it
+// back, so a shared subexpression is computed once. PushModeConst pushes
+// one of two adjacent constants, the first in degrees mode and the second
+// in radians, for folded values that depend on the angle mode.
+//
+// LoadVar pushes the value of a variable slot, read from the context's
+// variable values; the caller checks that the context has
+// getVariableCount() of them. Result pops the top of the stack into a
+// temporary; programs computing several expressions at once (see
+// OptimizeExpressions) leave each result there instead of on the stack.
+class Bytecode {
+public:
+    static const size_t inlineStackSize = 32;
+
+    Bytecode();
+
+    void emitConstant(double value, size_t position);
+    void emitModeConstant(double degrees, double radians, size_t position);
+    void emitStore(unsigned int temporary, size_t position);
+    void emitLoad(unsigned int temporary, size_t position);
+    void emitVariable(unsigned int slot, size_t position, size_t length);
+    void emitResult(unsigned int temporary, size_t position);
+    void emitOperator(char op, size_t position);
+    void emitCall(MathFunction function, size_t position);
+    void clear();
+    void reserve(size_t instructionCount);
+
+    // Runs the program without throwing. On failure returns false and
+    // describes the failing instruction in error.
+    bool tryExecute(EvaluationContext& context, double* stack, double& result, EvalError& error) const;
+    double execute(EvaluationContext& context, double* stack) const;
+
+    const std::vector<Instruction>& getInstructions() const;
+    const std::vector<double>& getConstants() const;
+    size_t getStackDepth() const;
+    size_t getTemporaryCount() const;
+
+    // One more than the highest variable slot used, or 0 when none is;
+    // the position and length are those of the first name with that slot,
+    // the one a context too small for the program is sure to lack, kept so
+    // that errors can name it without the source.
+    size_t getVariableCount() const;
+    size_t getHighestVariablePosition() const;
+    size_t getHighestVariableLength() const;
+    bool empty() const;
+
+private:
+    std::vector<Instruction> instructions;
+    std::vector<double> constants;
+    std::vector<unsigned int> positions;
+    size_t depth;
+    size_t maxDepth;
+    size_t temporaryCount;
+    size_t variableCount;
+    size_t highestVariablePosition;
+    size_t highestVariableLength;
+
+    void push();
+    void emit(OpCode op, MathFunction function, unsigned int operand, size_t position);
+};
+
+double ApplyOperator(Calculator& calculator, double a, double b, char op);
+
+#endif
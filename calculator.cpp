@@ -1,7 +1,10 @@
 #include "calculator.h"
+#include "functions.h"
+#include "vectormath.h"
 #include <stdexcept>
 #include <cmath>
 #include <algorithm>
+#include <limits>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -11,25 +14,51 @@
 #define M_E 2.71828182845904523536
 #endif
 
+namespace {
+
+const double notANumber = std::numeric_limits<double>::quiet_NaN();
+
+double PowerWithStatus(double base, double exponent, CalcStatus& status) {
+    status = CalcStatus::Ok;
+
+    if (base < 0 && std::floor(exponent) == exponent) {
+        if (std::fmod(exponent, 2.0) == 0.0) {
+            return std::pow(-base, exponent);
+        } else {
+            return -std::pow(-base, exponent);
+        }
+    }
+    
+    if (base < 0 && std::floor(exponent) != exponent) {
+        status = CalcStatus::NegativeBaseFractionalPower;
+        return notANumber;
+    }
+    
+    if (base == 0 && exponent < 0) {
+        status = CalcStatus::ZeroNegativePower;
+        return notANumber;
+    }
+    
+    return std::pow(base, exponent);
+}
+
+}
+
+const char* GetStatusMessage(CalcStatus status) {
+    switch (status) {
+        case CalcStatus::Ok: return "OK";
+        case CalcStatus::DivisionByZero: return "Division by zero is not allowed";
+        case CalcStatus::NegativeSquareRoot: return "Cannot calculate square root of a negative number";
+        case CalcStatus::NegativeBaseFractionalPower: return "Cannot raise negative number to non-integer power";
+        case CalcStatus::ZeroNegativePower: return "Cannot raise zero to negative power";
+        case CalcStatus::InvalidLogarithm: return "Invalid arguments for logarithm";
+        case CalcStatus::NonPositiveLogarithm: return "Cannot calculate logarithm of a non-positive number";
+        case CalcStatus::UndefinedTangent: return "Tangent is undefined at this angle";
+    }
+    return "Unknown error";
+}
+
 Calculator::Calculator() {
-    initializeFunctions();
-}
-
-void Calculator::initializeFunctions() {
-    functions["sin"] = [this](double a) { return this->sine(a); };
-    functions["cos"] = [this](double a) { return this->cosine(a); };
-    functions["tan"] = [this](double a) { return this->tangent(a); };
-    functions["asin"] = [this](double a) { return this->arcsine(a); };
-    functions["acos"] = [this](double a) { return this->arccosine(a); };
-    functions["atan"] = [this](double a) { return this->arctangent(a); };
-    functions["sinh"] = [this](double a) { return this->sineH(a); };
-    functions["cosh"] = [this](double a) { return this->cosineH(a); };
-    functions["tanh"] = [this](double a) { return this->tangentH(a); };
-    functions["sqrt"] = [this](double a) { return this->squareRoot(a); };
-    functions["ln"] = [this](double a) { return this->naturalLogarithm(a); };
-    functions["log"] = [this](double a) { return this->logarithm(a, 10.0); };
-    functions["abs"] = [this](double a) { return this->absolute(a); };
-    functions["fact"] = [this](double a) { return this->factorial(a); };
 }
 
 double Calculator::add(double a, double b) {
@@ -46,48 +75,41 @@ double Calculator::multiply(double a, double b) {
 
 double Calculator::divide(double a, double b) {
     if (b == 0) {
-        throw std::invalid_argument("Division by zero is not allowed");
+        throw std::invalid_argument(GetStatusMessage(CalcStatus::DivisionByZero));
     }
     return a / b;
 }
 
 double Calculator::squareRoot(double a) {
     if (a < 0) {
-        throw std::invalid_argument("Cannot calculate square root of a negative number");
+        throw std::invalid_argument(GetStatusMessage(CalcStatus::NegativeSquareRoot));
     }
     return std::sqrt(a);
 }
 
 double Calculator::power(double base, double exponent) {
-    if (base < 0 && std::floor(exponent) == exponent) {
-        if (std::fmod(exponent, 2.0) == 0.0) {
-            return std::pow(-base, exponent);
-        } else {
-            return -std::pow(-base, exponent);
-        }
-    }
-    
-    if (base < 0 && std::floor(exponent) != exponent) {
-        throw std::invalid_argument("Cannot raise negative number to non-integer power");
+    CalcStatus status;
+    double result = PowerWithStatus(base, exponent, status);
+    if (status != CalcStatus::Ok) {
+        throw std::invalid_argument(GetStatusMessage(status));
     }
-    
-    if (base == 0 && exponent < 0) {
-        throw std::invalid_argument("Cannot raise zero to negative power");
-    }
-    
-    return std::pow(base, exponent);
+    return result;
+}
+
+double Calculator::power(double base, double exponent, CalcStatus& status) {
+    return PowerWithStatus(base, exponent, status);
 }
 
 double Calculator::logarithm(double a, double base) {
     if (a <= 0 || base <= 0 || base == 1) {
-        throw std::invalid_argument("Invalid arguments for logarithm");
+        throw std::invalid_argument(GetStatusMessage(CalcStatus::InvalidLogarithm));
     }
     return std::log(a) / std::log(base);
 }
 
 double Calculator::naturalLogarithm(double a) {
     if (a <= 0) {
-        throw std::invalid_argument("Cannot calculate logarithm of a non-positive number");
+        throw std::invalid_argument(GetStatusMessage(CalcStatus::NonPositiveLogarithm));
     }
     return std::log(a);
 }
@@ -119,7 +141,7 @@ double Calculator::tangent(double a, bool inDegrees) {
         a = degreesToRadians(a);
     }
     if (std::abs(std::cos(a)) < 1e-10) {
-        throw std::invalid_argument("Tangent is undefined at this angle");
+        throw std::invalid_argument(GetStatusMessage(CalcStatus::UndefinedTangent));
     }
     return std::tan(a);
 }
@@ -226,14 +248,182 @@ double Calculator::calculate(double a, double b, char operation) {
 }
 
 double Calculator::calculateFunction(const std::string& funcName, double a) {
-    auto it = functions.find(funcName);
-    if (it != functions.end()) {
-        try {
-            return it->second(a);
-        } catch (const std::exception& e) {
-            throw std::runtime_error("Error calculating " + funcName + "(" + std::to_string(a) + "): " + e.what());
-        }
-    } else {
+    MathFunction function;
+    if (!LookupFunction(funcName.data(), funcName.length(), function)) {
         throw std::invalid_argument("Unknown function: " + funcName);
     }
-}
\ No newline at end of file
+
+    FunctionError error = FunctionError::None;
+    double result = TryApplyFunction(*this, function, a, true, error);
+    if (error != FunctionError::None) {
+        throw std::runtime_error("Error calculating " + funcName + "(" + std::to_string(a) + "): " +
+                                 GetFunctionErrorMessage(function, error));
+    }
+    return result;
+}
+
+const double* Calculator::toRadians(const double* input, double* output, size_t count, bool inDegrees) {
+    if (!inDegrees) {
+        return input;
+    }
+    for (size_t i = 0; i < count; i++) {
+        output[i] = input[i] * M_PI / 180.0;
+    }
+    return output;
+}
+
+void Calculator::add(const double* a, const double* b, double* result, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        result[i] = a[i] + b[i];
+    }
+}
+
+void Calculator::subtract(const double* a, const double* b, double* result, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        result[i] = a[i] - b[i];
+    }
+}
+
+void Calculator::multiply(const double* a, const double* b, double* result, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        result[i] = a[i] * b[i];
+    }
+}
+
+void Calculator::divide(const double* a, const double* b, double* result, size_t count, CalcStatus* status) {
+    // Branch-free so the loop vectorizes: a zero divisor turns the factor
+    // the quotient is scaled by into NaN. status is written first because
+    // result may alias b.
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            status[i] = b[i] == 0 ? CalcStatus::DivisionByZero : CalcStatus::Ok;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        double scale = b[i] == 0 ? notANumber : 1.0;
+        result[i] = a[i] / b[i] * scale;
+    }
+}
+
+void Calculator::power(const double* base, const double* exponent, double* result, size_t count,
+                       CalcStatus* status) {
+    CalcStatus elementStatus;
+    for (size_t i = 0; i < count; i++) {
+        result[i] = PowerWithStatus(base[i], exponent[i], elementStatus);
+        if (status != NULL) {
+            status[i] = elementStatus;
+        }
+    }
+}
+
+void Calculator::calculate(const double* a, const double* b, double* result, size_t count, char operation,
+                           CalcStatus* status) {
+    switch (operation) {
+        case '+': add(a, b, result, count); break;
+        case '-': subtract(a, b, result, count); break;
+        case '*': multiply(a, b, result, count); break;
+        case '/': divide(a, b, result, count, status); return;
+        case '^': power(a, b, result, count, status); return;
+        case 's': squareRoot(a, result, count, status); return;
+        case 'n': naturalLogarithm(a, result, count, status); return;
+        case 'l':
+            for (size_t i = 0; i < count; i++) {
+                bool invalid = a[i] <= 0 || b[i] <= 0 || b[i] == 1;
+                if (status != NULL) {
+                    status[i] = invalid ? CalcStatus::InvalidLogarithm : CalcStatus::Ok;
+                }
+                result[i] = invalid ? notANumber : std::log(a[i]) / std::log(b[i]);
+            }
+            return;
+        case '%':
+            for (size_t i = 0; i < count; i++) {
+                result[i] = a[i] / 100.0;
+            }
+            break;
+        default: throw std::invalid_argument("Invalid operation");
+    }
+
+    if (status != NULL) {
+        std::fill(status, status + count, CalcStatus::Ok);
+    }
+}
+
+void Calculator::squareRoot(const double* input, double* output, size_t count, CalcStatus* status) {
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            status[i] = input[i] < 0 ? CalcStatus::NegativeSquareRoot : CalcStatus::Ok;
+        }
+    }
+    VectorSqrt(input, output, count);
+}
+
+void Calculator::logarithm(const double* input, double* output, size_t count, double base, CalcStatus* status) {
+    if (base <= 0 || base == 1) {
+        std::fill(output, output + count, notANumber);
+        if (status != NULL) {
+            std::fill(status, status + count, CalcStatus::InvalidLogarithm);
+        }
+        return;
+    }
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            status[i] = input[i] <= 0 ? CalcStatus::InvalidLogarithm : CalcStatus::Ok;
+        }
+    }
+    VectorLn(input, output, count);
+    double logBase = std::log(base);
+    for (size_t i = 0; i < count; i++) {
+        output[i] /= logBase;
+    }
+}
+
+void Calculator::naturalLogarithm(const double* input, double* output, size_t count, CalcStatus* status) {
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            status[i] = input[i] <= 0 ? CalcStatus::NonPositiveLogarithm : CalcStatus::Ok;
+        }
+    }
+    VectorLn(input, output, count);
+}
+
+void Calculator::sine(const double* input, double* output, size_t count, bool inDegrees) {
+    VectorSin(toRadians(input, output, count, inDegrees), output, count);
+}
+
+void Calculator::cosine(const double* input, double* output, size_t count, bool inDegrees) {
+    VectorCos(toRadians(input, output, count, inDegrees), output, count);
+}
+
+void Calculator::tangent(const double* input, double* output, size_t count, bool inDegrees,
+                         CalcStatus* status) {
+    const double* radians = toRadians(input, output, count, inDegrees);
+
+    // The kernel returns NaN for undefined angles, and NaN or infinite
+    // arguments give NaN without being an error, so only finite arguments
+    // that come back NaN are flagged.
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            status[i] = std::isfinite(radians[i]) ? CalcStatus::UndefinedTangent : CalcStatus::Ok;
+        }
+    }
+    VectorTan(radians, output, count);
+    if (status != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            if (status[i] == CalcStatus::UndefinedTangent && !std::isnan(output[i])) {
+                status[i] = CalcStatus::Ok;
+            }
+        }
+    }
+}
+
+void Calculator::sineH(const double* input, double* output, size_t count) {
+    VectorSinh(input, output, count);
+}
+
+void Calculator::cosineH(const double* input, double* output, size_t count) {
+    VectorCosh(input, output, count);
+}
+
+void Calculator::tangentH(const double* input, double* output, size_t count) {
+    VectorTanh(input, output, count);
+}
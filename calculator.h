@@ -2,8 +2,23 @@
 #define CALCULATOR_H
 
 #include <string>
-#include <map>
-#include <functional>
+#include <cstddef>
+
+// Per-element outcome of the array operations. Elements whose status is
+// not Ok hold NaN; GetStatusMessage returns the message the scalar method
+// throws for the same input.
+enum class CalcStatus : unsigned char {
+    Ok,
+    DivisionByZero,
+    NegativeSquareRoot,
+    NegativeBaseFractionalPower,
+    ZeroNegativePower,
+    InvalidLogarithm,
+    NonPositiveLogarithm,
+    UndefinedTangent
+};
+
+const char* GetStatusMessage(CalcStatus status);
 
 class Calculator {
 public:
@@ -16,6 +31,9 @@ public:
 
     double squareRoot(double a);
     double power(double base, double exponent);
+    // Reports a rejected base/exponent pair in status (returning NaN)
+    // instead of throwing.
+    double power(double base, double exponent, CalcStatus& status);
     double logarithm(double a, double base);
     double naturalLogarithm(double a);
     
@@ -44,10 +62,41 @@ public:
     
     double degreesToRadians(double degrees);
     double radiansToDegrees(double radians);
-    
+
+    // Array versions for bulk evaluation: count values are read from the
+    // inputs and the results written to output, which may be one of the
+    // input arrays. Domain errors never throw: the element is set to NaN
+    // and, when a status array is given, its status records the error.
+    // See vectormath.h for the SIMD kernels and their accuracy against the
+    // scalar versions.
+    void add(const double* a, const double* b, double* result, size_t count);
+    void subtract(const double* a, const double* b, double* result, size_t count);
+    void multiply(const double* a, const double* b, double* result, size_t count);
+    void divide(const double* a, const double* b, double* result, size_t count, CalcStatus* status = NULL);
+    void power(const double* base, const double* exponent, double* result, size_t count,
+               CalcStatus* status = NULL);
+
+    // Dispatches on operation once for the whole array; b is ignored (and
+    // may be NULL) for the unary 's', 'n' and '%'. An invalid operation
+    // still throws, as it is not a property of the data.
+    void calculate(const double* a, const double* b, double* result, size_t count, char operation,
+                   CalcStatus* status = NULL);
+
+    void squareRoot(const double* input, double* output, size_t count, CalcStatus* status = NULL);
+    void logarithm(const double* input, double* output, size_t count, double base, CalcStatus* status = NULL);
+    void naturalLogarithm(const double* input, double* output, size_t count, CalcStatus* status = NULL);
+
+    void sine(const double* input, double* output, size_t count, bool inDegrees = true);
+    void cosine(const double* input, double* output, size_t count, bool inDegrees = true);
+    void tangent(const double* input, double* output, size_t count, bool inDegrees = true,
+                 CalcStatus* status = NULL);
+
+    void sineH(const double* input, double* output, size_t count);
+    void cosineH(const double* input, double* output, size_t count);
+    void tangentH(const double* input, double* output, size_t count);
+
 private:
-    std::map<std::string, std::function<double(double)>> functions;
-    void initializeFunctions();
+    const double* toRadians(const double* input, double* output, size_t count, bool inDegrees);
 };
 
 #endif
\ No newline at end of file
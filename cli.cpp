@@ -0,0 +1,490 @@
+#include "batch.h"
+#include "columnar.h"
+#include "csv.h"
+#include "debuglog.h"
+#include "diskcache.h"
+#include "resultcache.h"
+#include "variables.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void PrintUsage(const char* program) {
+    std::fprintf(stderr,
+        "Usage: %s [--threads N] [--radians] [--precision N] [--cache N]\n"
+        "          [--disk-cache FILE [--disk-cache-max MB] [--compact-cache]]\n"
+        "          [--log FILE [--log-level LEVEL]] [--output FILE] [INPUT]\n"
+        "       %s --expr EXPRESSION... [--column NAME=FILE]... [--threads N]\n"
+        "          [--radians] [--output FILE]\n"
+        "       %s --csv FILE --expr EXPRESSION... [--delimiter C] [--threads N]\n"
+        "          [--radians] [--precision N] [--out FILE]\n"
+        "\n"
+        "Evaluates one expression per line from INPUT (or stdin when INPUT is\n"
+        "omitted or '-') and writes one result per line. Lines that fail to\n"
+        "evaluate produce 'Error: <message>'; blank lines are passed through.\n"
+        "Failed lines leave the exit status 0; a file that cannot be read or\n"
+        "written makes it 1.\n"
+        "\n"
+        "With --expr, evaluates EXPRESSION once per row of its variables\n"
+        "instead. Each --column FILE holds the values of variable NAME as raw\n"
+        "native doubles, one per row; the results are written the same way.\n"
+        "--expr may be repeated to compute several results in one pass; each\n"
+        "row then holds one double per expression. Results that fail are NaN\n"
+        "and are listed on stderr.\n"
+        "\n"
+        "With --csv, FILE (or stdin for '-') is delimited text whose first line\n"
+        "names its columns; each name becomes a variable. The output is CSV: a\n"
+        "header of the expressions, then one line per input row with each\n"
+        "result, or 'Error: <message>' for results that fail or that use a\n"
+        "field the row is missing or that is not a finite number. The file is\n"
+        "streamed, never held in memory whole.\n"
+        "\n"
+        "The cache and log options apply to line input only and cannot be\n"
+        "combined with --expr or --csv. --precision and --delimiter format\n"
+        "text, so they cannot be combined with --column output.\n"
+        "\n"
+        "  --threads N  evaluate on N threads (0 = one per hardware thread);\n"
+        "               output order always matches input order\n"
+        "  --radians    trigonometric functions use radians instead of degrees\n"
+        "  --delimiter C\n"
+        "               field separator for --csv (default ','; '\\t' for tab)\n"
+        "  --out FILE   same as --output\n"
+        "  --precision N\n"
+        "               significant digits per result (default 15); 0 prints\n"
+        "               the shortest text that reads back as the exact value\n"
+        "  --cache N    remember the results of up to N distinct expressions\n"
+        "               and print hit/miss counts to stderr at the end\n"
+        "  --disk-cache FILE\n"
+        "               keep results in FILE (and FILE.idx) across runs\n"
+        "  --disk-cache-max MB\n"
+        "               cap FILE at MB megabytes, dropping the least recently\n"
+        "               used results when it fills\n"
+        "  --compact-cache\n"
+        "               after the run, drop results this run did not use\n"
+        "  --log FILE   trace every evaluation to FILE\n"
+        "  --log-level LEVEL\n"
+        "               trace, debug (default), info, warning, error or off\n",
+        program, program, program);
+}
+
+const size_t reportedRowErrors = 10;
+
+// fread and fwrite report failures only through the stream's error flag,
+// and buffered writes may fail as late as fclose, so each run checks its
+// files once at the end. Both close the file unless it is stdin or stdout.
+bool FinishInput(FILE* input, const char* path) {
+    bool ok = !std::ferror(input);
+    if (!ok && input == stdin) {
+        std::fprintf(stderr, "Cannot read input\n");
+    } else if (!ok) {
+        std::fprintf(stderr, "Cannot read input file: %s\n", path);
+    }
+    if (input != stdin) {
+        std::fclose(input);
+    }
+    return ok;
+}
+
+bool FinishOutput(FILE* output, const char* path) {
+    bool ok = std::fflush(output) == 0 && !std::ferror(output);
+    if (output != stdout && std::fclose(output) != 0) {
+        ok = false;
+    }
+    if (!ok && output == stdout) {
+        std::fprintf(stderr, "Cannot write output\n");
+    } else if (!ok) {
+        std::fprintf(stderr, "Cannot write output file: %s\n", path);
+    }
+    return ok;
+}
+
+bool ReadColumn(const char* path, std::vector<double>& values) {
+    FILE* file = std::fopen(path, "rb");
+    if (file == NULL) {
+        std::fprintf(stderr, "Cannot open column file: %s\n", path);
+        return false;
+    }
+    std::vector<char> bytes;
+    char buffer[1 << 16];
+    size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) != 0) {
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    }
+    if (!FinishInput(file, path)) {
+        return false;
+    }
+
+    if (bytes.size() % sizeof(double) != 0) {
+        std::fprintf(stderr, "Column file is not a whole number of doubles: %s\n", path);
+        return false;
+    }
+    values.resize(bytes.size() / sizeof(double));
+    if (!bytes.empty()) {
+        std::memcpy(values.data(), bytes.data(), bytes.size());
+    }
+    return true;
+}
+
+// The --expr mode: binds each column to its variable and evaluates every
+// expression over every row in one fused pass with a ColumnEvaluator.
+// Results are written row by row, one double per expression.
+int RunColumns(const std::vector<const char*>& expressionTexts, const std::vector<std::string>& columnArguments,
+               size_t threadCount, AngleMode angleMode, FILE* outputFile) {
+    VariableTable table;
+    std::vector<std::vector<double>> columns;
+    for (const std::string& argument : columnArguments) {
+        size_t equals = argument.find('=');
+        std::string name = argument.substr(0, equals);
+        if (equals == std::string::npos || table.find(name.data(), name.size()) != VariableTable::notFound) {
+            std::fprintf(stderr, "Expected a new NAME=FILE column: %s\n", argument.c_str());
+            return 1;
+        }
+        if (table.define(name) == VariableTable::notFound) {
+            std::fprintf(stderr, "Invalid variable name: %s\n", name.c_str());
+            return 1;
+        }
+        columns.push_back(std::vector<double>());
+        if (!ReadColumn(argument.c_str() + equals + 1, columns.back())) {
+            return 1;
+        }
+        if (columns.back().size() != columns.front().size()) {
+            std::fprintf(stderr, "Column %s has %zu rows, expected %zu\n", name.c_str(), columns.back().size(),
+                         columns.front().size());
+            return 1;
+        }
+    }
+
+    ExpressionSet expressions;
+    EvalError error = EvalError();
+    for (const char* text : expressionTexts) {
+        if (!expressions.tryAdd(text, std::strlen(text), error, &table)) {
+            std::fprintf(stderr, "Error: %s\n", DescribeError(error, text).c_str());
+            return 1;
+        }
+    }
+    expressions.optimize();
+
+    std::vector<const double*> pointers;
+    for (const std::vector<double>& column : columns) {
+        pointers.push_back(column.data());
+    }
+    size_t rowCount = columns.empty() ? 1 : columns.front().size();
+    size_t width = expressionTexts.size();
+    std::vector<std::vector<double>> results(width, std::vector<double>(rowCount));
+    std::vector<double*> outputs;
+    for (std::vector<double>& result : results) {
+        outputs.push_back(result.data());
+    }
+
+    ColumnEvaluator evaluator(threadCount, angleMode);
+    if (!evaluator.evaluate(expressions, pointers.data(), pointers.size(), rowCount, outputs.data(), error)) {
+        std::fprintf(stderr, "Error: an expression uses a variable without a column\n");
+        return 1;
+    }
+
+    const std::vector<ColumnError>& failures = evaluator.getErrors();
+    for (size_t i = 0; i < failures.size() && i < reportedRowErrors; i++) {
+        const char* text = expressionTexts[failures[i].expression];
+        if (width == 1) {
+            std::fprintf(stderr, "row %zu: Error: %s\n", failures[i].row, DescribeError(failures[i].error, text).c_str());
+        } else {
+            std::fprintf(stderr, "row %zu, %s: Error: %s\n", failures[i].row, text,
+                         DescribeError(failures[i].error, text).c_str());
+        }
+    }
+    if (failures.size() > reportedRowErrors) {
+        std::fprintf(stderr, "%zu results failed\n", failures.size());
+    }
+
+    std::vector<double> rows;
+    for (size_t first = 0; first < rowCount; first += ColumnEvaluator::chunkRows) {
+        size_t count = std::min(ColumnEvaluator::chunkRows, rowCount - first);
+        rows.resize(count * width);
+        for (size_t row = 0; row < count; row++) {
+            for (size_t column = 0; column < width; column++) {
+                rows[row * width + column] = results[column][first + row];
+            }
+        }
+        if (std::fwrite(rows.data(), sizeof(double), rows.size(), outputFile) != rows.size()) {
+            std::fprintf(stderr, "Cannot write output\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int RunCsv(const char* csvPath, const std::vector<const char*>& expressionTexts, char delimiter, int digits,
+           size_t threadCount, AngleMode angleMode, FILE* outputFile) {
+    CsvEvaluator evaluator(threadCount, angleMode);
+    evaluator.setDelimiter(delimiter);
+    evaluator.setDigits(digits);
+    for (const char* text : expressionTexts) {
+        evaluator.addExpression(text);
+    }
+
+    MappedFile mappedInput;
+    FILE* input = stdin;
+    if (std::strcmp(csvPath, "-") != 0 && !mappedInput.open(csvPath)) {
+        input = std::fopen(csvPath, "rb");
+        if (input == NULL) {
+            std::fprintf(stderr, "Cannot open input file: %s\n", csvPath);
+            return 1;
+        }
+    }
+
+    bool ok;
+    {
+        OutputBuffer output(outputFile);
+        ok = mappedInput.isOpen() ? evaluator.run(mappedInput, output) : evaluator.run(input, output);
+    }
+    if (!ok) {
+        std::fprintf(stderr, "Error: %s\n", evaluator.getError().c_str());
+    }
+    if (!FinishInput(input, csvPath)) {
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    const char* inputPath = NULL;
+    const char* outputPath = NULL;
+    size_t threadCount = 1;
+    AngleMode angleMode = AngleMode::Degrees;
+    const char* logPath = NULL;
+    LogLevel logLevel = LogLevel::Debug;
+    int digits = displayDigits;
+    size_t cacheSize = 0;
+    const char* diskCachePath = NULL;
+    uint64_t diskCacheMax = 0;
+    bool compactCache = false;
+    std::vector<const char*> expressionTexts;
+    std::vector<std::string> columnArguments;
+    const char* csvPath = NULL;
+    char delimiter = ',';
+    // Set by the cache and log options, which only apply to line mode, and
+    // by the text output options, which raw --column output has no use for.
+    bool lineOptions = false;
+    bool textOptions = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0) {
+            PrintUsage(argv[0]);
+            return 0;
+        } else if (std::strcmp(argv[i], "--output") == 0 || std::strcmp(argv[i], "--out") == 0 ||
+                   std::strcmp(argv[i], "-o") == 0) {
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            outputPath = argv[i];
+        } else if (std::strcmp(argv[i], "--threads") == 0 || std::strcmp(argv[i], "-j") == 0) {
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            threadCount = static_cast<size_t>(std::strtoul(argv[i], NULL, 10));
+            if (threadCount == 0) {
+                threadCount = std::thread::hardware_concurrency();
+            }
+        } else if (std::strcmp(argv[i], "--log") == 0) {
+            lineOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            logPath = argv[i];
+        } else if (std::strcmp(argv[i], "--log-level") == 0) {
+            lineOptions = true;
+            if (++i >= argc || !ParseLogLevel(argv[i], logLevel)) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--precision") == 0) {
+            textOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            digits = std::atoi(argv[i]);
+            if (digits < 0 || digits > 17) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--cache") == 0) {
+            lineOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            cacheSize = static_cast<size_t>(std::strtoul(argv[i], NULL, 10));
+        } else if (std::strcmp(argv[i], "--disk-cache") == 0) {
+            lineOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            diskCachePath = argv[i];
+        } else if (std::strcmp(argv[i], "--disk-cache-max") == 0) {
+            lineOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            diskCacheMax = static_cast<uint64_t>(std::strtoull(argv[i], NULL, 10)) << 20;
+        } else if (std::strcmp(argv[i], "--compact-cache") == 0) {
+            lineOptions = true;
+            compactCache = true;
+        } else if (std::strcmp(argv[i], "--expr") == 0) {
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            expressionTexts.push_back(argv[i]);
+        } else if (std::strcmp(argv[i], "--column") == 0) {
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            columnArguments.push_back(argv[i]);
+        } else if (std::strcmp(argv[i], "--csv") == 0) {
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            csvPath = argv[i];
+        } else if (std::strcmp(argv[i], "--delimiter") == 0) {
+            textOptions = true;
+            if (++i >= argc) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            if (std::strcmp(argv[i], "\\t") == 0) {
+                delimiter = '\t';
+            } else if (std::strlen(argv[i]) == 1 && argv[i][0] != '"' && argv[i][0] != '\n') {
+                delimiter = argv[i][0];
+            } else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--radians") == 0) {
+            angleMode = AngleMode::Radians;
+        } else if (inputPath == NULL) {
+            inputPath = argv[i];
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool columnMode = !expressionTexts.empty() && csvPath == NULL;
+    if (expressionTexts.empty() ? !columnArguments.empty() || csvPath != NULL
+                                : inputPath != NULL || lineOptions ||
+                                  (csvPath != NULL && !columnArguments.empty()) ||
+                                  (columnMode && textOptions)) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Input files are memory-mapped where possible; pipes, stdin and
+    // systems without mmap are read through a buffer instead.
+    MappedFile mappedInput;
+    FILE* input = stdin;
+    if (expressionTexts.empty() && inputPath != NULL && std::strcmp(inputPath, "-") != 0 &&
+        !mappedInput.open(inputPath)) {
+        input = std::fopen(inputPath, "rb");
+        if (input == NULL) {
+            std::fprintf(stderr, "Cannot open input file: %s\n", inputPath);
+            return 1;
+        }
+    }
+
+    FILE* outputFile = stdout;
+    if (outputPath != NULL) {
+        outputFile = std::fopen(outputPath, "wb");
+        if (outputFile == NULL) {
+            std::fprintf(stderr, "Cannot open output file: %s\n", outputPath);
+            return 1;
+        }
+    }
+
+    if (!expressionTexts.empty()) {
+        int status = csvPath != NULL
+            ? RunCsv(csvPath, expressionTexts, delimiter, digits, threadCount, angleMode, outputFile)
+            : RunColumns(expressionTexts, columnArguments, threadCount, angleMode, outputFile);
+        if (!FinishOutput(outputFile, outputPath)) {
+            status = 1;
+        }
+        return status;
+    }
+
+    if (logPath != NULL && !DebugLog::open(logPath, logLevel)) {
+        std::fprintf(stderr, "Cannot open log file: %s\n", logPath);
+        return 1;
+    }
+
+    int status = 0;
+    {
+        DebugLogSink logSink;
+        BatchEvaluator evaluator(threadCount, angleMode);
+        evaluator.setLogSink(&logSink);
+        evaluator.setDigits(digits);
+
+        std::unique_ptr<ResultCache> cache;
+        if (cacheSize != 0) {
+            cache.reset(new ResultCache(cacheSize));
+            evaluator.setResultCache(cache.get());
+        }
+
+        DiskCache diskCache;
+        if (diskCachePath != NULL) {
+            if (!diskCache.open(diskCachePath, diskCacheMax)) {
+                std::fprintf(stderr, "%s\n", diskCache.getError().c_str());
+                return 1;
+            }
+            evaluator.setDiskCache(&diskCache);
+        }
+
+        OutputBuffer output(outputFile);
+        if (mappedInput.isOpen()) {
+            evaluator.run(mappedInput, output);
+        } else {
+            evaluator.run(input, output);
+        }
+
+        if (cache) {
+            ResultCache::Stats stats = cache->getStats();
+            std::fprintf(stderr, "cache: %zu hits, %zu misses, %zu evictions, %zu of %zu entries used\n",
+                         stats.hits, stats.misses, stats.evictions, stats.size, cache->getCapacity());
+        }
+        if (diskCache.isOpen()) {
+            if (compactCache && !diskCache.compact()) {
+                std::fprintf(stderr, "Cannot compact disk cache: %s\n", diskCachePath);
+                status = 1;
+            }
+            DiskCache::Stats stats = diskCache.getStats();
+            std::fprintf(stderr, "disk cache: %zu hits, %zu misses, %zu added, %zu records, %llu bytes\n",
+                         stats.hits, stats.misses, stats.insertions, stats.records,
+                         static_cast<unsigned long long>(stats.fileBytes));
+        }
+    }
+
+    DebugLog::close();
+
+    if (!FinishInput(input, inputPath)) {
+        status = 1;
+    }
+    if (!FinishOutput(outputFile, outputPath)) {
+        status = 1;
+    }
+    return status;
+}
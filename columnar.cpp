@@ -0,0 +1,240 @@
+#include "columnar.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Runs program over count (at most blockRows) rows starting at first.
+// buffers holds one blockRows array per stack slot; operands[slot] points
+// at the values the slot currently holds, which for a variable is its
+// column itself. failed[row] is set for every row an instruction rejects.
+// Returns the values left on top of the stack, if any.
+const double* ExecuteBlock(const Bytecode& program, Calculator& calculator, bool inDegrees,
+                           const double* const* columns, size_t first, size_t count, double* buffers,
+                           const double** operands, unsigned char* failed) {
+    const size_t rows = ColumnEvaluator::blockRows;
+    const std::vector<double>& constants = program.getConstants();
+    unsigned int modeOffset = inDegrees ? 0 : 1;
+    size_t sp = program.getTemporaryCount();
+    std::memset(failed, 0, count);
+
+    for (const Instruction& instruction : program.getInstructions()) {
+        switch (instruction.op) {
+            case OpCode::PushConst:
+            case OpCode::PushModeConst: {
+                double value = constants[instruction.operand + (instruction.op == OpCode::PushModeConst ? modeOffset : 0)];
+                double* out = buffers + sp * rows;
+                std::fill(out, out + count, value);
+                operands[sp++] = out;
+                break;
+            }
+            case OpCode::Store: {
+                double* out = buffers + instruction.operand * rows;
+                std::memcpy(out, operands[sp - 1], count * sizeof(double));
+                operands[instruction.operand] = out;
+                break;
+            }
+            case OpCode::Result: {
+                double* out = buffers + instruction.operand * rows;
+                std::memcpy(out, operands[--sp], count * sizeof(double));
+                operands[instruction.operand] = out;
+                break;
+            }
+            case OpCode::Load:
+                operands[sp] = operands[instruction.operand];
+                sp++;
+                break;
+            case OpCode::LoadVar:
+                operands[sp++] = columns[instruction.operand] + first;
+                break;
+
+            default: {
+                const double* a = operands[sp - 2];
+                const double* b = operands[sp - 1];
+                double* out = buffers + (sp - 2) * rows;
+                if (instruction.op == OpCode::Call) {
+                    a = b;
+                    out = buffers + (sp - 1) * rows;
+                } else {
+                    sp--;
+                }
+
+                switch (instruction.op) {
+                    case OpCode::Add:
+                        for (size_t i = 0; i < count; i++) out[i] = a[i] + b[i];
+                        break;
+                    case OpCode::Subtract:
+                        for (size_t i = 0; i < count; i++) out[i] = a[i] - b[i];
+                        break;
+                    case OpCode::Multiply:
+                        for (size_t i = 0; i < count; i++) out[i] = a[i] * b[i];
+                        break;
+                    case OpCode::Divide:
+                        for (size_t i = 0; i < count; i++) {
+                            failed[i] |= b[i] == 0;
+                            out[i] = a[i] / b[i];
+                        }
+                        break;
+                    case OpCode::Modulo:
+                        for (size_t i = 0; i < count; i++) {
+                            failed[i] |= b[i] == 0;
+                            out[i] = std::fmod(a[i], b[i]);
+                        }
+                        break;
+                    case OpCode::Power:
+                        for (size_t i = 0; i < count; i++) {
+                            CalcStatus status;
+                            out[i] = calculator.power(a[i], b[i], status);
+                            failed[i] |= status != CalcStatus::Ok;
+                        }
+                        break;
+                    case OpCode::Call: {
+                        double (*apply)(Calculator&, double, bool, FunctionError&) =
+                            GetFunctionInfo(instruction.function).apply;
+                        for (size_t i = 0; i < count; i++) {
+                            FunctionError status = FunctionError::None;
+                            out[i] = apply(calculator, a[i], inDegrees, status);
+                            failed[i] |= status != FunctionError::None;
+                        }
+                        break;
+                    }
+                    default:
+                        break;
+                }
+                operands[sp - 1] = out;
+                break;
+            }
+        }
+    }
+
+    return sp > program.getTemporaryCount() ? operands[sp - 1] : NULL;
+}
+
+}
+
+struct ColumnEvaluator::Worker {
+    explicit Worker(AngleMode angleMode) : context(angleMode), failed(blockRows) {}
+
+    EvaluationContext context;
+    std::vector<double> buffers;
+    std::vector<const double*> operands;
+    std::vector<unsigned char> failed;
+    std::vector<double> rowValues;
+};
+
+ColumnEvaluator::ColumnEvaluator(size_t threadCount, AngleMode angleMode) : pool(threadCount) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker(angleMode)));
+    }
+}
+
+ColumnEvaluator::~ColumnEvaluator() {
+}
+
+size_t ColumnEvaluator::getThreadCount() const {
+    return pool.size();
+}
+
+bool ColumnEvaluator::evaluate(const CompiledExpression& expression, const double* const* columns,
+                               size_t columnCount, size_t rowCount, double* output, EvalError& error) {
+    const CompiledExpression* expressions[1] = { &expression };
+    Job job = { &expression.getBytecode(), expressions, NULL, 1, &output, columns, columnCount };
+    return run(job, rowCount, error);
+}
+
+bool ColumnEvaluator::evaluate(const ExpressionSet& set, const double* const* columns, size_t columnCount,
+                               size_t rowCount, double* const* outputs, EvalError& error) {
+    std::vector<const CompiledExpression*> expressions;
+    std::vector<unsigned int> resultSlots;
+    for (size_t i = 0; i < set.size(); i++) {
+        expressions.push_back(&set.getExpression(i));
+        resultSlots.push_back(set.getResultSlot(i));
+    }
+    Job job = { &set.getBytecode(), expressions.data(), resultSlots.data(), set.size(), outputs, columns,
+                columnCount };
+    return run(job, rowCount, error);
+}
+
+bool ColumnEvaluator::run(const Job& job, size_t rowCount, EvalError& error) {
+    errors.clear();
+
+    // tryEvaluate checks the bound variables before running anything, so
+    // with too few columns it reports the missing variable without
+    // reading a value.
+    for (size_t i = 0; i < job.expressionCount; i++) {
+        if (job.expressions[i]->getBytecode().getVariableCount() > job.columnCount) {
+            double ignored;
+            workers[0]->context.setVariableValues(NULL, job.columnCount);
+            return job.expressions[i]->tryEvaluate(workers[0]->context, ignored, error);
+        }
+    }
+
+    size_t chunkCount = (rowCount + chunkRows - 1) / chunkRows;
+    if (chunkErrors.size() < chunkCount) {
+        chunkErrors.resize(chunkCount);
+    }
+    pool.parallelFor(chunkCount, [&](size_t chunk, size_t worker) {
+        size_t first = chunk * chunkRows;
+        chunkErrors[chunk].clear();
+        evaluateChunk(job, first, std::min(chunkRows, rowCount - first), *workers[worker], chunkErrors[chunk]);
+    });
+
+    for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+        errors.insert(errors.end(), chunkErrors[chunk].begin(), chunkErrors[chunk].end());
+    }
+    return true;
+}
+
+void ColumnEvaluator::evaluateChunk(const Job& job, size_t first, size_t count, Worker& worker,
+                                    std::vector<ColumnError>& failures) {
+    const Bytecode& program = *job.program;
+    if (program.empty()) {
+        for (size_t i = 0; i < job.expressionCount; i++) {
+            std::fill(job.outputs[i] + first, job.outputs[i] + first + count, 0.0);
+        }
+        return;
+    }
+
+    size_t depth = program.getStackDepth();
+    if (worker.buffers.size() < depth * blockRows) {
+        worker.buffers.resize(depth * blockRows);
+        worker.operands.resize(depth);
+    }
+    worker.rowValues.resize(job.columnCount);
+    Calculator& calculator = worker.context.getCalculator();
+    bool inDegrees = worker.context.inDegrees();
+
+    for (size_t block = first; block < first + count; block += blockRows) {
+        size_t rows = std::min(blockRows, first + count - block);
+        const double* top = ExecuteBlock(program, calculator, inDegrees, job.columns, block, rows,
+                                         worker.buffers.data(), worker.operands.data(), worker.failed.data());
+        for (size_t i = 0; i < job.expressionCount; i++) {
+            const double* values = job.resultSlots != NULL ? worker.operands[job.resultSlots[i]] : top;
+            std::memcpy(job.outputs[i] + block, values, rows * sizeof(double));
+        }
+
+        for (size_t i = 0; i < rows; i++) {
+            if (!worker.failed[i]) {
+                continue;
+            }
+            for (size_t slot = 0; slot < job.columnCount; slot++) {
+                worker.rowValues[slot] = job.columns[slot][block + i];
+            }
+            worker.context.setVariableValues(worker.rowValues.data(), job.columnCount);
+            for (size_t expression = 0; expression < job.expressionCount; expression++) {
+                double& output = job.outputs[expression][block + i];
+                ColumnError failure = { block + i, expression, EvalError() };
+                if (!job.expressions[expression]->tryEvaluate(worker.context, output, failure.error)) {
+                    output = std::numeric_limits<double>::quiet_NaN();
+                    failures.push_back(failure);
+                }
+            }
+        }
+    }
+}
+
+const std::vector<ColumnError>& ColumnEvaluator::getErrors() const {
+    return errors;
+}
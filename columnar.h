@@ -0,0 +1,92 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "context.h"
+#include "evalerror.h"
+#include "expression.h"
+#include "threadpool.h"
+
+// A row that failed in ColumnEvaluator::evaluate; expression indexes the
+// ExpressionSet, and is 0 for a single expression.
+struct ColumnError {
+    size_t row;
+    size_t expression;
+    EvalError error;
+};
+
+// Evaluates one compiled expression over many rows of variable values
+// stored column by column: columns[slot][row] is the value of variable
+// slot in that row. Rows are taken in blocks of blockRows, and each
+// instruction runs over the whole block before the next one starts, so
+// dispatch is paid once per block and the arithmetic loops vectorize.
+// The block's value stack (getStackDepth() columns of blockRows values)
+// stays in cache.
+//
+// Results are bit-for-bit those of CompiledExpression::evaluate on each
+// row: operators are the same IEEE operations, and '^' and functions call
+// Calculator::power and FunctionInfo::apply value by value. A row that
+// fails is evaluated again on its own to describe the error.
+//
+// Chunks of chunkRows rows are spread over a work-stealing pool; every
+// worker has its own context and stack.
+class ColumnEvaluator {
+public:
+    static const size_t blockRows = 256;
+    static const size_t chunkRows = 64 * 1024;
+
+    explicit ColumnEvaluator(size_t threadCount = 1, AngleMode angleMode = AngleMode::Degrees);
+    ~ColumnEvaluator();
+
+    size_t getThreadCount() const;
+
+    // Writes the result of every row to output, or NaN for a failed row,
+    // whose error getErrors() then lists in row order. columns holds one
+    // pointer per variable slot and may be NULL when the expression uses
+    // no variables. Returns false, evaluating nothing, when the expression
+    // uses more variables than columnCount; error is then UnboundVariable.
+    bool evaluate(const CompiledExpression& expression, const double* const* columns, size_t columnCount,
+                  size_t rowCount, double* output, EvalError& error);
+
+    // Evaluates every expression of set in the same pass over the rows,
+    // writing expression k's results to outputs[k]. set must have been
+    // optimized. A row where any instruction of the fused program fails
+    // is evaluated again expression by expression, so only the
+    // expressions that really fail get NaN and an error.
+    bool evaluate(const ExpressionSet& set, const double* const* columns, size_t columnCount, size_t rowCount,
+                  double* const* outputs, EvalError& error);
+
+    const std::vector<ColumnError>& getErrors() const;
+
+private:
+    struct Worker;
+
+    WorkStealingPool pool;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::vector<ColumnError>> chunkErrors;
+    std::vector<ColumnError> errors;
+
+    // What one call evaluates: the program, the expressions it computes
+    // (for rerunning failed rows), the temporaries holding their results
+    // (NULL for a single result left on the stack) and the outputs.
+    struct Job {
+        const Bytecode* program;
+        const CompiledExpression* const* expressions;
+        const unsigned int* resultSlots;
+        size_t expressionCount;
+        double* const* outputs;
+        const double* const* columns;
+        size_t columnCount;
+    };
+
+    bool run(const Job& job, size_t rowCount, EvalError& error);
+    void evaluateChunk(const Job& job, size_t first, size_t count, Worker& worker,
+                       std::vector<ColumnError>& failures);
+
+    ColumnEvaluator(const ColumnEvaluator&);
+    ColumnEvaluator& operator=(const ColumnEvaluator&);
+};
+
+#endif
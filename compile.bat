@@ -5,7 +5,13 @@ REM Compile resource file
 windres calculator.rc -O coff -o calculator.res
 
 REM Compile GUI version
-g++ -std=c++11 -mwindows main.cpp calculator.cpp calculator.res -o calculator.exe
+g++ -std=c++17 -mwindows main.cpp calculator.cpp functions.cpp vectormath.cpp context.cpp expression.cpp optimizer.cpp jit.cpp lexer.cpp variables.cpp bytecode.cpp evalerror.cpp numberformat.cpp resultcache.cpp diskcache.cpp debuglog.cpp calculator.res -o calculator.exe
+
+REM Compile command-line evaluator
+g++ -std=c++17 -O2 cli.cpp calculator.cpp functions.cpp vectormath.cpp context.cpp expression.cpp optimizer.cpp jit.cpp lexer.cpp variables.cpp bytecode.cpp evalerror.cpp numberformat.cpp resultcache.cpp diskcache.cpp lineio.cpp threadpool.cpp batch.cpp columnar.cpp csv.cpp debuglog.cpp -o calc-cli.exe
+
+REM Compile evaluator benchmark
+g++ -std=c++17 -O2 benchmark.cpp calculator.cpp functions.cpp vectormath.cpp context.cpp expression.cpp optimizer.cpp jit.cpp lexer.cpp variables.cpp bytecode.cpp evalerror.cpp numberformat.cpp resultcache.cpp diskcache.cpp lineio.cpp threadpool.cpp batch.cpp columnar.cpp csv.cpp debuglog.cpp -o benchmark.exe
 
 echo.
 echo Compilation completed!
@@ -0,0 +1,116 @@
+#include "context.h"
+#include "expression.h"
+#include "variables.h"
+
+LogSink::~LogSink() {
+}
+
+bool LogSink::isEnabled() const {
+    return true;
+}
+
+EvaluationContext::EvaluationContext(AngleMode angleMode, LogSink* logSink)
+    : angleMode(angleMode), logSink(logSink), resultCache(NULL), diskCache(NULL), diskCacheBatch(NULL),
+      variables(NULL), variableValues(NULL), variableCount(0), scratchExpression(new CompiledExpression()) {
+}
+
+EvaluationContext::~EvaluationContext() {
+}
+
+Calculator& EvaluationContext::getCalculator() {
+    return calculator;
+}
+
+AngleMode EvaluationContext::getAngleMode() const {
+    return angleMode;
+}
+
+void EvaluationContext::setAngleMode(AngleMode mode) {
+    angleMode = mode;
+}
+
+bool EvaluationContext::inDegrees() const {
+    return angleMode == AngleMode::Degrees;
+}
+
+LogSink* EvaluationContext::getLogSink() const {
+    return logSink;
+}
+
+void EvaluationContext::setLogSink(LogSink* sink) {
+    logSink = sink;
+}
+
+bool EvaluationContext::isLogging() const {
+    return logSink != NULL && logSink->isEnabled();
+}
+
+ResultCache* EvaluationContext::getResultCache() const {
+    return resultCache;
+}
+
+void EvaluationContext::setResultCache(ResultCache* cache) {
+    resultCache = cache;
+}
+
+DiskCache* EvaluationContext::getDiskCache() const {
+    return diskCache;
+}
+
+void EvaluationContext::setDiskCache(DiskCache* cache) {
+    diskCache = cache;
+}
+
+DiskCacheBatch* EvaluationContext::getDiskCacheBatch() const {
+    return diskCacheBatch;
+}
+
+void EvaluationContext::setDiskCacheBatch(DiskCacheBatch* batch) {
+    diskCacheBatch = batch;
+}
+
+const VariableTable* EvaluationContext::getVariables() const {
+    return variables;
+}
+
+void EvaluationContext::setVariables(const VariableTable* table) {
+    variables = table;
+    variableValues = NULL;
+    variableCount = 0;
+}
+
+void EvaluationContext::setVariableValues(const double* values, size_t count) {
+    variables = NULL;
+    variableValues = values;
+    variableCount = count;
+}
+
+const double* EvaluationContext::getVariableValues() const {
+    return variables != NULL ? variables->getValues() : variableValues;
+}
+
+size_t EvaluationContext::getVariableCount() const {
+    return variables != NULL ? variables->size() : variableCount;
+}
+
+void EvaluationContext::log(const std::string& message, const std::string& category) {
+    if (logSink != NULL) {
+        logSink->write(message, category);
+    }
+}
+
+double* EvaluationContext::getStack(size_t depth) {
+    if (stack.size() < depth) {
+        stack.resize(depth);
+    }
+    return stack.data();
+}
+
+CompiledExpression& EvaluationContext::getScratchExpression() {
+    return *scratchExpression;
+}
+
+void EvaluationContext::reserve(size_t expressionLength, size_t stackDepth) {
+    getStack(stackDepth);
+    scratchExpression->reserve(expressionLength);
+}
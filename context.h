@@ -0,0 +1,109 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <memory>
+#include "calculator.h"
+
+class CompiledExpression;
+class DiskCache;
+class DiskCacheBatch;
+class ResultCache;
+class VariableTable;
+
+enum class AngleMode { Degrees, Radians };
+
+// Receives the evaluator's debug messages. A sink is only called from the
+// thread using the context it is attached to. Messages are only built
+// while isEnabled() returns true.
+class LogSink {
+public:
+    virtual ~LogSink();
+    virtual bool isEnabled() const;
+    virtual void write(const std::string& message, const std::string& category) = 0;
+};
+
+// Everything one evaluation needs: the Calculator whose functions are
+// called, the angle mode for trigonometric functions, an optional log
+// sink and scratch memory. Contexts share nothing, so any number of
+// threads can evaluate at once, one context per thread.
+//
+// The scratch memory (VM stack and a reusable compiled expression) only
+// ever grows, so once it has seen the largest expression in a workload,
+// evaluation performs no heap allocations. reserve() sizes it up front.
+class EvaluationContext {
+public:
+    explicit EvaluationContext(AngleMode angleMode = AngleMode::Degrees, LogSink* logSink = NULL);
+    ~EvaluationContext();
+
+    Calculator& getCalculator();
+
+    AngleMode getAngleMode() const;
+    void setAngleMode(AngleMode mode);
+    bool inDegrees() const;
+
+    LogSink* getLogSink() const;
+    void setLogSink(LogSink* sink);
+    bool isLogging() const;
+    void log(const std::string& message, const std::string& category = "CALC");
+
+    // Results cache consulted by EvaluateExpression; NULL (the default)
+    // evaluates every expression. The cache may be shared between
+    // contexts and must outlive them.
+    ResultCache* getResultCache() const;
+    void setResultCache(ResultCache* cache);
+
+    // Persistent cache consulted after the ResultCache misses; NULL (the
+    // default) for none. Shared and outliving the contexts, like above.
+    DiskCache* getDiskCache() const;
+    void setDiskCache(DiskCache* cache);
+
+    // When set, new results for the DiskCache are queued in batch, which
+    // must belong to that cache, and reach the file when it is flushed.
+    // NULL (the default) inserts each result as it is computed.
+    DiskCacheBatch* getDiskCacheBatch() const;
+    void setDiskCacheBatch(DiskCacheBatch* batch);
+
+    // Variables that expressions evaluated on this context may use; NULL
+    // (the default) for none. The table is read, not copied, so values
+    // set between evaluations take effect immediately.
+    const VariableTable* getVariables() const;
+    void setVariables(const VariableTable* table);
+
+    // Binds count values by slot without a table, for callers that keep
+    // values in their own storage; names then no longer resolve. Replaces
+    // the table, and setVariables() replaces these.
+    void setVariableValues(const double* values, size_t count);
+    const double* getVariableValues() const;
+    size_t getVariableCount() const;
+
+    // Returns at least depth doubles of scratch space; the buffer grows
+    // once and is reused by later evaluations on this context.
+    double* getStack(size_t depth);
+
+    // Expression buffer used by EvaluateExpression for text that is
+    // compiled and evaluated in one step.
+    CompiledExpression& getScratchExpression();
+
+    void reserve(size_t expressionLength, size_t stackDepth);
+
+private:
+    Calculator calculator;
+    AngleMode angleMode;
+    LogSink* logSink;
+    ResultCache* resultCache;
+    DiskCache* diskCache;
+    DiskCacheBatch* diskCacheBatch;
+    const VariableTable* variables;
+    const double* variableValues;
+    size_t variableCount;
+    std::vector<double> stack;
+    std::unique_ptr<CompiledExpression> scratchExpression;
+
+    EvaluationContext(const EvaluationContext&);
+    EvaluationContext& operator=(const EvaluationContext&);
+};
+
+#endif
@@ -0,0 +1,488 @@
+#include "csv.h"
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const size_t blockSize = 8 << 20;
+
+// Why a needed field of a row has no value: the row ends before it, or it
+// is not a number.
+enum class FieldStatus : unsigned char {
+    Missing,
+    Invalid
+};
+
+struct FieldFailure {
+    FieldStatus status;
+    int slot;
+    const char* text;
+    size_t length;
+};
+
+// A row's failed fields are the worker's fieldFailures[firstFailure,
+// endFailure); only the expressions that use one of them fail.
+struct RowInfo {
+    bool blank;
+    size_t firstFailure;
+    size_t endFailure;
+};
+
+bool IsBlank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Trims blanks and one pair of surrounding quotes from [begin, end).
+void TrimField(const char*& begin, const char*& end) {
+    while (begin < end && IsBlank(*begin)) {
+        begin++;
+    }
+    while (end > begin && IsBlank(end[-1])) {
+        end--;
+    }
+    if (end - begin >= 2 && *begin == '"' && end[-1] == '"') {
+        begin++;
+        end--;
+    }
+}
+
+const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+// Scans from begin to the first delimiter or line break (or end) and
+// returns where it stopped, reading the text on the way as a plain decimal
+// of at most 15 digits ("12", "-3.75"), which most numeric fields are.
+// Their digits form an integer below 2^53 and the power of ten is exact,
+// so the one division rounds exactly as from_chars would. simple is false,
+// and value untouched, for anything else, exponents included.
+const char* ScanSimpleDecimal(const char* begin, const char* end, char delimiter, double& value, bool& simple) {
+    bool negative = begin < end && *begin == '-';
+    const char* digits = begin + (negative ? 1 : 0);
+    const char* cursor = digits;
+    uint64_t mantissa = 0;
+    size_t fractionDigits = 0;
+    bool point = false;
+    bool plain = true;
+    for (; cursor < end && *cursor != delimiter && *cursor != '\n'; cursor++) {
+        unsigned int digit = static_cast<unsigned char>(*cursor) - '0';
+        if (digit < 10) {
+            mantissa = mantissa * 10 + digit;
+            fractionDigits += point ? 1 : 0;
+        } else if (*cursor == '.' && !point) {
+            point = true;
+        } else {
+            plain = false;
+        }
+    }
+    size_t digitCount = static_cast<size_t>(cursor - digits) - (point ? 1 : 0);
+    simple = plain && digitCount > 0 && digitCount <= 15;
+    if (simple) {
+        value = static_cast<double>(mantissa) / exactPowersOfTen[fractionDigits];
+        value = negative ? -value : value;
+    }
+    return cursor;
+}
+
+// The field is a number only if from_chars consumes all of it, after an
+// optional '+', which from_chars itself rejects. "nan" and "inf", which
+// from_chars accepts, are not numbers here.
+bool ParseField(const char* begin, const char* end, double& value) {
+    TrimField(begin, end);
+    if (begin < end && *begin == '+') {
+        begin++;
+    }
+    if (begin == end) {
+        return false;
+    }
+    // A trimmed field holds no delimiter or line break, so the scan reads
+    // all of it.
+    bool simple = false;
+    ScanSimpleDecimal(begin, end, '\n', value, simple);
+    if (simple) {
+        return true;
+    }
+    std::from_chars_result parsed = std::from_chars(begin, end, value);
+    return parsed.ec == std::errc() && parsed.ptr == end && std::isfinite(value);
+}
+
+// Quotes field when it holds the delimiter, a quote or a line break,
+// doubling any quotes inside.
+void AppendField(std::string& output, const char* text, size_t length, char delimiter) {
+    bool quote = false;
+    for (size_t i = 0; i < length && !quote; i++) {
+        quote = text[i] == delimiter || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+    }
+    if (!quote) {
+        output.append(text, length);
+        return;
+    }
+    output += '"';
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '"') {
+            output += '"';
+        }
+        output += text[i];
+    }
+    output += '"';
+}
+
+bool IsNameCharacter(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// Whether text holds name as a whole word, not as part of a longer name.
+bool Mentions(const std::string& text, const char* name, size_t length) {
+    for (size_t at = text.find(name, 0, length); at != std::string::npos; at = text.find(name, at + 1, length)) {
+        bool startsWord = at == 0 || !IsNameCharacter(text[at - 1]);
+        bool endsWord = at + length == text.size() || !IsNameCharacter(text[at + length]);
+        if (startsWord && endsWord) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+struct CsvEvaluator::Worker {
+    explicit Worker(AngleMode angleMode) : evaluator(1, angleMode) {}
+
+    ColumnEvaluator evaluator;
+    std::vector<std::vector<double>> columns;
+    std::vector<const double*> columnPointers;
+    std::vector<std::vector<double>> results;
+    std::vector<double*> resultPointers;
+    std::vector<RowInfo> rows;
+    std::vector<FieldFailure> fieldFailures;
+    std::string message;
+};
+
+CsvEvaluator::CsvEvaluator(size_t threadCount, AngleMode angleMode, size_t chunkSize)
+    : pool(threadCount), chunkSize(chunkSize), delimiter(','), digits(displayDigits),
+      started(false), fieldsNeeded(0) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker(angleMode)));
+    }
+}
+
+CsvEvaluator::~CsvEvaluator() {
+}
+
+void CsvEvaluator::setDelimiter(char delimiter) {
+    this->delimiter = delimiter;
+}
+
+void CsvEvaluator::setDigits(int digits) {
+    this->digits = digits;
+}
+
+void CsvEvaluator::addExpression(const std::string& expression) {
+    texts.push_back(expression);
+}
+
+const std::string& CsvEvaluator::getError() const {
+    return error;
+}
+
+// Defines a variable for every valid, first-seen header name, compiles the
+// expressions against them and records which fields the fused program
+// loads, so rows are parsed only as far as the last of those.
+bool CsvEvaluator::readHeader(const char* line, size_t length, OutputBuffer& output) {
+    const char* end = line + length;
+    std::vector<unsigned int> slots;
+    for (const char* field = line; ; ) {
+        const char* fieldEnd = static_cast<const char*>(std::memchr(field, delimiter, end - field));
+        if (fieldEnd == NULL) {
+            fieldEnd = end;
+        }
+        const char* nameBegin = field;
+        const char* nameEnd = fieldEnd;
+        TrimField(nameBegin, nameEnd);
+        size_t nameLength = nameEnd - nameBegin;
+        bool duplicate = header.find(nameBegin, nameLength) != VariableTable::notFound;
+        unsigned int slot = VariableTable::notFound;
+        if (!duplicate) {
+            slot = header.define(std::string(nameBegin, nameEnd));
+        }
+        // A column that cannot be a variable (a constant such as e, a
+        // function name, or a name like "unit price") is fine while no
+        // expression mentions it; otherwise the expression would silently
+        // read the constant or fail on part of the name.
+        if (slot == VariableTable::notFound && !duplicate && nameLength != 0) {
+            for (const std::string& text : texts) {
+                if (Mentions(text, nameBegin, nameLength)) {
+                    error = "Column '" + std::string(nameBegin, nameEnd) + "' cannot be used as a variable in: " + text;
+                    return false;
+                }
+            }
+        }
+        slots.push_back(slot);
+        if (fieldEnd == end) {
+            break;
+        }
+        field = fieldEnd + 1;
+    }
+
+    for (const std::string& text : texts) {
+        EvalError compileError = EvalError();
+        if (!expressions.tryAdd(text.data(), text.size(), compileError, &header)) {
+            error = DescribeError(compileError, text.c_str());
+            return false;
+        }
+    }
+    expressions.optimize();
+
+    std::vector<bool> used(header.size(), false);
+    for (const Instruction& instruction : expressions.getBytecode().getInstructions()) {
+        if (instruction.op == OpCode::LoadVar) {
+            used[instruction.operand] = true;
+        }
+    }
+    // Which slots each expression reads, so that a bad field fails only
+    // the expressions that use it.
+    expressionSlots.assign(texts.size(), std::vector<bool>(header.size(), false));
+    for (size_t i = 0; i < texts.size(); i++) {
+        for (const Instruction& instruction : expressions.getExpression(i).getBytecode().getInstructions()) {
+            if (instruction.op == OpCode::LoadVar) {
+                expressionSlots[i][instruction.operand] = true;
+            }
+        }
+    }
+
+    fieldSlots.assign(slots.size(), -1);
+    fieldsNeeded = 0;
+    for (size_t field = 0; field < slots.size(); field++) {
+        if (slots[field] != VariableTable::notFound && used[slots[field]]) {
+            fieldSlots[field] = static_cast<int>(slots[field]);
+            fieldsNeeded = field + 1;
+        }
+    }
+
+    std::string names;
+    for (size_t i = 0; i < texts.size(); i++) {
+        if (i > 0) {
+            names += delimiter;
+        }
+        AppendField(names, texts[i].data(), texts[i].size(), delimiter);
+    }
+    names += '\n';
+    output.write(names.data(), names.size());
+    return true;
+}
+
+void CsvEvaluator::evaluateChunk(const char* begin, const char* end, Worker& worker, std::string& output) {
+    size_t width = texts.size();
+    size_t columnCount = header.size();
+    worker.columns.resize(columnCount);
+    worker.columnPointers.resize(columnCount);
+    worker.results.resize(width);
+    worker.resultPointers.resize(width);
+    worker.rows.clear();
+    worker.fieldFailures.clear();
+
+    // Split the chunk into rows, parsing the needed fields of each into
+    // its column; a field that is missing or cannot be parsed reads as
+    // zero and is recorded with the row. Fields are short, so lines are
+    // scanned a byte at a time rather than with a memchr call per field,
+    // and the scan reads plain decimals as it goes; only other fields are
+    // parsed again by ParseField. Columns grow as rows arrive and keep
+    // their size for the worker's next chunk.
+    size_t rowCount = 0;
+    size_t rowCapacity = columnCount > 0 ? worker.columns[0].size() : 0;
+    for (const char* line = begin; line < end; ) {
+        if (rowCount == rowCapacity) {
+            rowCapacity = rowCapacity > 0 ? 2 * rowCapacity : 1024;
+            for (size_t slot = 0; slot < columnCount; slot++) {
+                worker.columns[slot].resize(rowCapacity);
+            }
+        }
+
+        bool blank = *line == '\n' || (*line == '\r' && (line + 1 == end || line[1] == '\n'));
+        RowInfo info = { blank, worker.fieldFailures.size(), 0 };
+        const char* cursor = line;
+        bool lineEnded = blank;
+        for (size_t index = 0; index < fieldsNeeded && !blank; index++) {
+            int slot = fieldSlots[index];
+            if (lineEnded) {
+                if (slot >= 0) {
+                    FieldFailure failure = { FieldStatus::Missing, slot, NULL, 0 };
+                    worker.fieldFailures.push_back(failure);
+                    worker.columns[slot][rowCount] = 0.0;
+                }
+                continue;
+            }
+            double value = 0.0;
+            bool simple = false;
+            const char* fieldEnd = ScanSimpleDecimal(cursor, end, delimiter, value, simple);
+            lineEnded = fieldEnd == end || *fieldEnd == '\n';
+            const char* valueEnd = lineEnded && fieldEnd > cursor && fieldEnd[-1] == '\r' ? fieldEnd - 1 : fieldEnd;
+            if (slot >= 0 && simple) {
+                worker.columns[slot][rowCount] = value;
+            } else if (slot >= 0 && !ParseField(cursor, valueEnd, worker.columns[slot][rowCount])) {
+                FieldFailure failure = { FieldStatus::Invalid, slot, cursor, static_cast<size_t>(valueEnd - cursor) };
+                worker.fieldFailures.push_back(failure);
+                worker.columns[slot][rowCount] = 0.0;
+            }
+            cursor = lineEnded ? fieldEnd : fieldEnd + 1;
+        }
+        if (blank) {
+            for (size_t slot = 0; slot < columnCount; slot++) {
+                worker.columns[slot][rowCount] = 0.0;
+            }
+        }
+        info.endFailure = worker.fieldFailures.size();
+        worker.rows.push_back(info);
+        rowCount++;
+
+        while (cursor < end && *cursor != '\n') {
+            cursor++;
+        }
+        line = cursor < end ? cursor + 1 : end;
+    }
+
+    for (size_t slot = 0; slot < columnCount; slot++) {
+        worker.columnPointers[slot] = worker.columns[slot].data();
+    }
+    for (size_t i = 0; i < width; i++) {
+        worker.results[i].resize(rowCount);
+        worker.resultPointers[i] = worker.results[i].data();
+    }
+    EvalError unused = EvalError();
+    worker.evaluator.evaluate(expressions, worker.columnPointers.data(), columnCount, rowCount,
+                              worker.resultPointers.data(), unused);
+
+    // Failed results are NaN; the evaluator lists them in row order. Rows
+    // are formatted straight into output, which is first grown by room
+    // for every remaining row of numbers; an error message trims it back,
+    // appends itself and makes that room again.
+    const std::vector<ColumnError>& failures = worker.evaluator.getErrors();
+    size_t nextFailure = 0;
+    const size_t rowRoom = width * (numberBufferSize + 1) + 1;
+    size_t used = output.size();
+    output.resize(used + rowCount * rowRoom);
+    for (size_t row = 0; row < rowCount; row++) {
+        const RowInfo& info = worker.rows[row];
+        for (size_t i = 0; i < width && !info.blank; i++) {
+            if (i > 0) {
+                output[used++] = delimiter;
+            }
+            while (nextFailure < failures.size() &&
+                   (failures[nextFailure].row < row ||
+                    (failures[nextFailure].row == row && failures[nextFailure].expression < i))) {
+                nextFailure++;
+            }
+            const FieldFailure* badField = NULL;
+            for (size_t f = info.firstFailure; f < info.endFailure && badField == NULL; f++) {
+                if (expressionSlots[i][worker.fieldFailures[f].slot]) {
+                    badField = &worker.fieldFailures[f];
+                }
+            }
+            bool failed = nextFailure < failures.size() && failures[nextFailure].row == row &&
+                          failures[nextFailure].expression == i;
+            if (badField == NULL && !failed) {
+                used += FormatNumber(worker.results[i][row], &output[used], digits);
+                continue;
+            }
+            if (badField != NULL) {
+                worker.message = badField->status == FieldStatus::Missing ? "Error: Missing field "
+                                                                          : "Error: Invalid number in field ";
+                worker.message += header.getName(badField->slot);
+                if (badField->status == FieldStatus::Invalid) {
+                    worker.message += ": '";
+                    worker.message.append(badField->text, badField->length);
+                    worker.message += '\'';
+                }
+            } else {
+                worker.message = "Error: ";
+                AppendErrorMessage(worker.message, failures[nextFailure].error, texts[i].c_str());
+            }
+            output.resize(used);
+            AppendField(output, worker.message.data(), worker.message.size(), delimiter);
+            used = output.size();
+            output.resize(used + (rowCount - row) * rowRoom);
+        }
+        output[used++] = '\n';
+    }
+    output.resize(used);
+}
+
+bool CsvEvaluator::evaluateBlock(const char* data, size_t length, OutputBuffer& output) {
+    const char* end = data + length;
+    if (!started) {
+        const char* newline = static_cast<const char*>(std::memchr(data, '\n', length));
+        const char* headerEnd = newline != NULL ? newline : end;
+        size_t headerLength = headerEnd - data;
+        if (headerLength > 0 && data[headerLength - 1] == '\r') {
+            headerLength--;
+        }
+        started = true;
+        if (!readHeader(data, headerLength, output)) {
+            return false;
+        }
+        data = newline != NULL ? newline + 1 : end;
+    }
+
+    chunkBounds.clear();
+    chunkBounds.push_back(data);
+    const char* cursor = data;
+    while (cursor < end) {
+        const char* target = (static_cast<size_t>(end - cursor) > chunkSize) ? cursor + chunkSize : end;
+        const char* newline = target < end
+            ? static_cast<const char*>(std::memchr(target, '\n', end - target))
+            : NULL;
+        cursor = newline != NULL ? newline + 1 : end;
+        chunkBounds.push_back(cursor);
+    }
+
+    size_t chunkCount = chunkBounds.size() - 1;
+    results.resize(chunkCount);
+    for (size_t i = 0; i < chunkCount; i++) {
+        results[i].clear();
+    }
+
+    pool.parallelFor(chunkCount, [this](size_t chunk, size_t worker) {
+        evaluateChunk(chunkBounds[chunk], chunkBounds[chunk + 1], *workers[worker], results[chunk]);
+    });
+
+    for (size_t i = 0; i < chunkCount; i++) {
+        output.write(results[i].data(), results[i].size());
+    }
+    return true;
+}
+
+bool CsvEvaluator::run(FILE* input, OutputBuffer& output) {
+    LineReader reader(input, blockSize);
+    const char* data;
+    size_t length;
+
+    while (reader.nextBlock(data, length)) {
+        if (!evaluateBlock(data, length, output)) {
+            return false;
+        }
+    }
+    if (!started) {
+        error = "Input has no header line";
+        return false;
+    }
+    return true;
+}
+
+bool CsvEvaluator::run(MappedFile& input, OutputBuffer& output) {
+    const char* data;
+    size_t length;
+
+    while (input.nextBlock(data, length)) {
+        if (!evaluateBlock(data, length, output)) {
+            return false;
+        }
+    }
+    if (!started) {
+        error = "Input has no header line";
+        return false;
+    }
+    return true;
+}
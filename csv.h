@@ -0,0 +1,82 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <cstdio>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "columnar.h"
+#include "context.h"
+#include "expression.h"
+#include "lineio.h"
+#include "numberformat.h"
+#include "threadpool.h"
+#include "variables.h"
+
+// Evaluates expressions over the rows of a delimited text file whose first
+// line names the columns ("qty,price,disc"). Each header name that is a
+// valid variable name becomes a variable, so "qty*price*(1-disc/100)"
+// reads those fields of every row.
+//
+// Input is streamed in blocks of whole lines and never held whole. Each
+// block is cut into chunks spread over a work-stealing pool; a worker
+// parses only the fields the expressions use into columns (from_chars,
+// no copies), evaluates them with a ColumnEvaluator and formats its
+// chunk's output, and chunks are written back in input order.
+//
+// The output has a header of the expression texts and one line per input
+// line: each result formatted with FormatNumber, or "Error: <message>" for
+// a result that failed or that uses a field the row is missing or that is
+// not a finite number. Other expressions on the same row are unaffected.
+// Blank lines are passed through. Fields may be quoted, but quoted fields
+// cannot contain the delimiter or line breaks.
+class CsvEvaluator {
+public:
+    explicit CsvEvaluator(size_t threadCount = 1, AngleMode angleMode = AngleMode::Degrees,
+                          size_t chunkSize = 64 * 1024);
+    ~CsvEvaluator();
+
+    void setDelimiter(char delimiter);
+    void setDigits(int digits);
+
+    // Expressions are compiled once the header has been read.
+    void addExpression(const std::string& expression);
+
+    // Return false, with the reason in getError(), when the input is empty
+    // or an expression does not compile against the header.
+    bool run(FILE* input, OutputBuffer& output);
+    bool run(MappedFile& input, OutputBuffer& output);
+
+    const std::string& getError() const;
+
+private:
+    struct Worker;
+
+    WorkStealingPool pool;
+    size_t chunkSize;
+    char delimiter;
+    int digits;
+    std::vector<std::string> texts;
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    bool started;
+    VariableTable header;
+    ExpressionSet expressions;
+    std::vector<int> fieldSlots;
+    std::vector<std::vector<bool>> expressionSlots;
+    size_t fieldsNeeded;
+    std::string error;
+
+    std::vector<const char*> chunkBounds;
+    std::vector<std::string> results;
+
+    bool evaluateBlock(const char* data, size_t length, OutputBuffer& output);
+    bool readHeader(const char* line, size_t length, OutputBuffer& output);
+    void evaluateChunk(const char* begin, const char* end, Worker& worker, std::string& output);
+
+    CsvEvaluator(const CsvEvaluator&);
+    CsvEvaluator& operator=(const CsvEvaluator&);
+};
+
+#endif
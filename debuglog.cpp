@@ -0,0 +1,223 @@
+#include "debuglog.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <thread>
+
+namespace {
+
+const size_t slotCount = 4096;
+const size_t categorySize = 16;
+const size_t messageSize = 232;
+
+// One message in the ring. sequence follows the bounded MPMC queue
+// scheme: a slot at position p is free for a writer when sequence == p
+// and holds a message for the reader when sequence == p + 1.
+struct Slot {
+    std::atomic<size_t> sequence;
+    long long timestamp;
+    unsigned short length;
+    char category[categorySize];
+    char message[messageSize];
+};
+
+Slot slots[slotCount];
+std::atomic<size_t> enqueuePosition(0);
+std::atomic<size_t> droppedCount(0);
+std::atomic<bool> running(false);
+size_t dequeuePosition = 0;
+FILE* logFile = NULL;
+std::thread writerThread;
+
+typedef std::chrono::system_clock Clock;
+
+const char* const separator =
+    "------------------------------------------------------------------------------\n";
+
+void WriteBanner(const char* label) {
+    std::time_t now = std::time(NULL);
+    std::fputs(separator, logFile);
+    std::fprintf(logFile, "Calculator Debug Log - %s: %s", label, std::ctime(&now));
+    std::fputs(separator, logFile);
+}
+
+// Formats and writes one message. localtime() is only called when the
+// second changes, which the writer thread alone does.
+void WriteSlot(const Slot& slot) {
+    static long long cachedSecond = -1;
+    static char cachedTime[16];
+
+    long long second = slot.timestamp / 1000;
+    if (second != cachedSecond) {
+        std::time_t seconds = static_cast<std::time_t>(second);
+        std::strftime(cachedTime, sizeof(cachedTime), "%H:%M:%S", std::localtime(&seconds));
+        cachedSecond = second;
+    }
+
+    std::fprintf(logFile, "[%s.%03d] [%s] ", cachedTime, static_cast<int>(slot.timestamp % 1000),
+                 slot.category);
+    std::fwrite(slot.message, 1, slot.length, logFile);
+    std::fputc('\n', logFile);
+}
+
+// Writes every published message and returns how many there were.
+size_t Drain() {
+    size_t written = 0;
+    for (;;) {
+        Slot& slot = slots[dequeuePosition % slotCount];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+            break;
+        }
+        WriteSlot(slot);
+        slot.sequence.store(dequeuePosition + slotCount, std::memory_order_release);
+        dequeuePosition++;
+        written++;
+    }
+
+    size_t dropped = droppedCount.exchange(0);
+    if (dropped != 0) {
+        std::fprintf(logFile, "[%zu messages dropped: log buffer full]\n", dropped);
+    }
+    return written;
+}
+
+void RunWriter() {
+    while (running.load(std::memory_order_acquire)) {
+        if (Drain() == 0) {
+            std::fflush(logFile);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+    Drain();
+    std::fflush(logFile);
+}
+
+}
+
+std::atomic<int> DebugLog::threshold(static_cast<int>(LogLevel::Off));
+
+bool DebugLog::open(const char* path, LogLevel level) {
+    close();
+
+    logFile = std::fopen(path, "w");
+    if (logFile == NULL) {
+        return false;
+    }
+    std::setvbuf(logFile, NULL, _IOFBF, 64 * 1024);
+
+    for (size_t i = 0; i < slotCount; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueuePosition.store(0);
+    droppedCount.store(0);
+    dequeuePosition = 0;
+
+    WriteBanner("Started");
+    std::fprintf(logFile, "Build version: %s %s\n\n", __DATE__, __TIME__);
+
+    running.store(true);
+    writerThread = std::thread(RunWriter);
+    setLevel(level);
+    return true;
+}
+
+void DebugLog::close() {
+    if (logFile == NULL) {
+        return;
+    }
+
+    threshold.store(static_cast<int>(LogLevel::Off));
+    running.store(false, std::memory_order_release);
+    writerThread.join();
+
+    std::fputs("\n", logFile);
+    WriteBanner("Ended");
+    std::fclose(logFile);
+    logFile = NULL;
+}
+
+void DebugLog::setLevel(LogLevel level) {
+    if (logFile != NULL) {
+        threshold.store(static_cast<int>(level));
+    }
+}
+
+LogLevel DebugLog::getLevel() {
+    return static_cast<LogLevel>(threshold.load());
+}
+
+size_t DebugLog::getDroppedCount() {
+    return droppedCount.load();
+}
+
+void DebugLog::write(LogLevel level, const char* category, const char* message, size_t length) {
+    if (!isEnabled(level)) {
+        return;
+    }
+
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &slots[position % slotCount];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == position) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (sequence < position) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now().time_since_epoch()).count();
+
+    size_t categoryLength = std::strlen(category);
+    if (categoryLength >= categorySize) {
+        categoryLength = categorySize - 1;
+    }
+    std::memcpy(slot->category, category, categoryLength);
+    slot->category[categoryLength] = '\0';
+
+    if (length > messageSize) {
+        length = messageSize;
+    }
+    std::memcpy(slot->message, message, length);
+    slot->length = static_cast<unsigned short>(length);
+
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+void DebugLog::write(LogLevel level, const char* category, const char* message) {
+    write(level, category, message, std::strlen(message));
+}
+
+void DebugLog::write(LogLevel level, const char* category, const std::string& message) {
+    write(level, category, message.data(), message.length());
+}
+
+bool ParseLogLevel(const char* name, LogLevel& level) {
+    static const char* const names[] = { "trace", "debug", "info", "warning", "error", "off" };
+    for (int i = 0; i <= static_cast<int>(LogLevel::Off); i++) {
+        if (std::strcmp(name, names[i]) == 0) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+DebugLogSink::DebugLogSink(LogLevel level) : level(level) {
+}
+
+bool DebugLogSink::isEnabled() const {
+    return DebugLog::isEnabled(level);
+}
+
+void DebugLogSink::write(const std::string& message, const std::string& category) {
+    DebugLog::write(level, category.c_str(), message);
+}
@@ -0,0 +1,79 @@
+#ifndef DEBUGLOG_H
+#define DEBUGLOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include "context.h"
+
+enum class LogLevel : int { Trace, Debug, Info, Warning, Error, Off };
+
+// Levels below this are compiled out entirely, e.g.
+// -DCALC_LOG_COMPILED_LEVEL=2 keeps only Info and above.
+#ifndef CALC_LOG_COMPILED_LEVEL
+#define CALC_LOG_COMPILED_LEVEL 0
+#endif
+
+// Logs message under category when level is enabled. The message
+// expression is only evaluated for enabled levels, so a disabled call
+// costs one relaxed atomic load and builds no strings.
+#define CALC_LOG(level, category, message)                                          \
+    do {                                                                            \
+        if (static_cast<int>(level) >= CALC_LOG_COMPILED_LEVEL &&                   \
+            DebugLog::isEnabled(level)) {                                           \
+            DebugLog::write(level, category, message);                              \
+        }                                                                           \
+    } while (0)
+
+#define LOG_TRACE(category, message) CALC_LOG(LogLevel::Trace, category, message)
+#define LOG_DEBUG(category, message) CALC_LOG(LogLevel::Debug, category, message)
+#define LOG_INFO(category, message) CALC_LOG(LogLevel::Info, category, message)
+#define LOG_WARNING(category, message) CALC_LOG(LogLevel::Warning, category, message)
+#define LOG_ERROR(category, message) CALC_LOG(LogLevel::Error, category, message)
+
+// Process-wide debug log. Writers copy each message into a fixed-size
+// slot of a lock-free ring buffer and return; a background thread formats
+// the timestamps and writes the file in large blocks. When the ring is
+// full, messages are dropped and counted rather than blocking the caller.
+// Messages longer than a slot are truncated.
+//
+// open() and close() must not race with threads that are logging; write()
+// may be called from any number of threads at once.
+class DebugLog {
+public:
+    static bool open(const char* path, LogLevel level = LogLevel::Trace);
+    static void close();
+
+    static bool isEnabled(LogLevel level) {
+        return static_cast<int>(level) >= threshold.load(std::memory_order_relaxed);
+    }
+
+    static void setLevel(LogLevel level);
+    static LogLevel getLevel();
+    static size_t getDroppedCount();
+
+    static void write(LogLevel level, const char* category, const char* message, size_t length);
+    static void write(LogLevel level, const char* category, const char* message);
+    static void write(LogLevel level, const char* category, const std::string& message);
+
+private:
+    static std::atomic<int> threshold;
+};
+
+// Parses "trace", "debug", "info", "warning", "error" or "off".
+bool ParseLogLevel(const char* name, LogLevel& level);
+
+// Forwards an EvaluationContext's messages to the DebugLog at the given
+// level. Safe to share between contexts on different threads.
+class DebugLogSink : public LogSink {
+public:
+    explicit DebugLogSink(LogLevel level = LogLevel::Debug);
+
+    bool isEnabled() const;
+    void write(const std::string& message, const std::string& category);
+
+private:
+    LogLevel level;
+};
+
+#endif
@@ -0,0 +1,604 @@
+#include "diskcache.h"
+#include "expression.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char recordMagic[8] = { 'C', 'A', 'L', 'C', 'R', 'E', 'C', '1' };
+const char indexMagic[8] = { 'C', 'A', 'L', 'C', 'I', 'D', 'X', '1' };
+
+// Start of the record file. generation changes whenever records move, so
+// an index built for other contents is recognised as stale.
+struct RecordHeader {
+    char magic[8];
+    uint32_t run;
+    uint32_t reserved;
+    uint64_t generation;
+    uint64_t recordCount;
+    uint64_t padding[4];
+};
+
+struct Record {
+    uint64_t hashLow;
+    uint64_t hashHigh;
+    double value;
+    uint32_t lastRun;
+    uint32_t check;
+};
+
+// Start of the index file; slotCount 32-bit slots follow, each holding a
+// record number plus one, or zero when empty.
+struct IndexHeader {
+    char magic[8];
+    uint64_t generation;
+    uint64_t recordCount;
+    uint64_t slotCount;
+};
+
+static_assert(sizeof(RecordHeader) == 64, "record header layout changed");
+static_assert(sizeof(Record) == 32, "record layout changed");
+static_assert(sizeof(IndexHeader) == 32, "index header layout changed");
+
+const uint64_t initialRecordCapacity = 4096;
+const uint64_t minimumSlotCount = 8192;
+
+uint64_t RotateLeft(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t Finalize(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3 x64 128-bit.
+void Hash128(const char* data, size_t length, uint64_t seed, uint64_t& low, uint64_t& high) {
+    const uint64_t c1 = 0x87C37B91114253D5ull;
+    const uint64_t c2 = 0x4CF5AD432745937Full;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    size_t blocks = length / 16;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t k1;
+        uint64_t k2;
+        std::memcpy(&k1, data + i * 16, 8);
+        std::memcpy(&k2, data + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = RotateLeft(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+        k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = RotateLeft(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+    }
+
+    const unsigned char* tail = reinterpret_cast<const unsigned char*>(data + blocks * 16);
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= static_cast<uint64_t>(tail[14]) << 48; // fall through
+        case 14: k2 ^= static_cast<uint64_t>(tail[13]) << 40; // fall through
+        case 13: k2 ^= static_cast<uint64_t>(tail[12]) << 32; // fall through
+        case 12: k2 ^= static_cast<uint64_t>(tail[11]) << 24; // fall through
+        case 11: k2 ^= static_cast<uint64_t>(tail[10]) << 16; // fall through
+        case 10: k2 ^= static_cast<uint64_t>(tail[9]) << 8;   // fall through
+        case 9:
+            k2 ^= static_cast<uint64_t>(tail[8]);
+            k2 *= c2; k2 = RotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+            // fall through
+        case 8: k1 ^= static_cast<uint64_t>(tail[7]) << 56;   // fall through
+        case 7: k1 ^= static_cast<uint64_t>(tail[6]) << 48;   // fall through
+        case 6: k1 ^= static_cast<uint64_t>(tail[5]) << 40;   // fall through
+        case 5: k1 ^= static_cast<uint64_t>(tail[4]) << 32;   // fall through
+        case 4: k1 ^= static_cast<uint64_t>(tail[3]) << 24;   // fall through
+        case 3: k1 ^= static_cast<uint64_t>(tail[2]) << 16;   // fall through
+        case 2: k1 ^= static_cast<uint64_t>(tail[1]) << 8;    // fall through
+        case 1:
+            k1 ^= static_cast<uint64_t>(tail[0]);
+            k1 *= c1; k1 = RotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = Finalize(h1);
+    h2 = Finalize(h2);
+    h1 += h2;
+    h2 += h1;
+    low = h1;
+    high = h2;
+}
+
+void HashKey(const char* text, size_t length, AngleMode mode, uint64_t& low, uint64_t& high) {
+    uint64_t seed = (static_cast<uint64_t>(evaluatorVersion) << 8) | static_cast<uint64_t>(mode);
+    Hash128(text, length, seed, low, high);
+}
+
+uint32_t CheckWord(const Record& record) {
+    uint64_t bits;
+    std::memcpy(&bits, &record.value, sizeof(bits));
+    uint64_t mixed = Finalize(record.hashLow ^ RotateLeft(record.hashHigh, 17) ^ bits ^ 0x5851F42D4C957F2Dull);
+    return static_cast<uint32_t>(mixed >> 32);
+}
+
+uint64_t RoundUpToPowerOfTwo(uint64_t value) {
+    uint64_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+uint64_t NewGeneration() {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) ^ device();
+}
+
+}
+
+#ifdef CALC_HAVE_MMAP
+
+namespace {
+
+bool Remap(int file, char*& data, uint64_t& size, uint64_t newSize) {
+    if (data != NULL) {
+        munmap(data, size);
+        data = NULL;
+        size = 0;
+    }
+    if (ftruncate(file, static_cast<off_t>(newSize)) != 0) {
+        return false;
+    }
+    void* mapped = mmap(NULL, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    data = static_cast<char*>(mapped);
+    size = newSize;
+    return true;
+}
+
+}
+
+#endif
+
+DiskCache::DiskCache() : maxBytes(0), hits(0), misses(0), insertions(0), compactions(0) {
+    records.file = -1;
+    records.data = NULL;
+    records.size = 0;
+    index = records;
+}
+
+DiskCache::~DiskCache() {
+    close();
+}
+
+bool DiskCache::fail(const std::string& message) {
+    error = message;
+    close();
+    return false;
+}
+
+#ifdef CALC_HAVE_MMAP
+
+bool DiskCache::open(const char* path, uint64_t maxBytes) {
+    close();
+    std::unique_lock<std::shared_mutex> guard(lock);
+
+    this->path = path;
+    this->maxBytes = maxBytes;
+    hits = 0;
+    misses = 0;
+    insertions = 0;
+    compactions = 0;
+
+    records.file = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (records.file < 0) {
+        guard.unlock();
+        return fail(std::string("Cannot open cache file: ") + path);
+    }
+    if (flock(records.file, LOCK_EX | LOCK_NB) != 0) {
+        guard.unlock();
+        return fail(std::string("Cache file is in use by another process: ") + path);
+    }
+
+    struct stat status;
+    fstat(records.file, &status);
+    uint64_t fileSize = static_cast<uint64_t>(status.st_size);
+    bool created = fileSize == 0;
+    if (created) {
+        fileSize = sizeof(RecordHeader) + initialRecordCapacity * sizeof(Record);
+    }
+    if (fileSize < sizeof(RecordHeader)) {
+        guard.unlock();
+        return fail(std::string("Not a calculator cache file: ") + path);
+    }
+    if (!Remap(records.file, records.data, records.size, fileSize)) {
+        guard.unlock();
+        return fail(std::string("Cannot map cache file: ") + path);
+    }
+
+    RecordHeader* header = reinterpret_cast<RecordHeader*>(records.data);
+    if (created) {
+        std::memcpy(header->magic, recordMagic, sizeof(recordMagic));
+        header->generation = NewGeneration();
+    }
+    if (std::memcmp(header->magic, recordMagic, sizeof(recordMagic)) != 0 ||
+        sizeof(RecordHeader) + header->recordCount * sizeof(Record) > records.size) {
+        guard.unlock();
+        return fail(std::string("Not a calculator cache file: ") + path);
+    }
+    header->run++;
+
+    std::string indexPath = this->path + ".idx";
+    index.file = ::open(indexPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (index.file < 0) {
+        guard.unlock();
+        return fail("Cannot open cache index: " + indexPath);
+    }
+    fstat(index.file, &status);
+    uint64_t indexSize = static_cast<uint64_t>(status.st_size);
+
+    bool usable = false;
+    if (indexSize >= sizeof(IndexHeader) && Remap(index.file, index.data, index.size, indexSize)) {
+        const IndexHeader* indexHeader = reinterpret_cast<const IndexHeader*>(index.data);
+        usable = std::memcmp(indexHeader->magic, indexMagic, sizeof(indexMagic)) == 0 &&
+                 indexHeader->generation == header->generation &&
+                 indexHeader->recordCount <= header->recordCount &&
+                 indexHeader->slotCount >= 2 * header->recordCount &&
+                 sizeof(IndexHeader) + indexHeader->slotCount * sizeof(uint32_t) == index.size;
+    }
+
+    bool ok;
+    if (usable) {
+        // Records appended after the index was last written (by a run that
+        // did not close cleanly) are indexed now.
+        IndexHeader* indexHeader = reinterpret_cast<IndexHeader*>(index.data);
+        for (uint64_t record = indexHeader->recordCount; record < header->recordCount; record++) {
+            indexRecord(static_cast<uint32_t>(record));
+        }
+        indexHeader->recordCount = header->recordCount;
+        ok = true;
+    } else {
+        ok = rebuildIndex(2 * header->recordCount);
+    }
+
+    if (ok && maxBytes != 0 && sizeof(RecordHeader) + header->recordCount * sizeof(Record) > maxBytes) {
+        ok = compactLocked(UINT_MAX, maxBytes / 2);
+    }
+    if (!ok) {
+        guard.unlock();
+        return fail("Cannot build cache index: " + indexPath);
+    }
+    return true;
+}
+
+void DiskCache::close() {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    Mapping* mappings[] = { &index, &records };
+    for (Mapping* mapping : mappings) {
+        if (mapping->data != NULL) {
+            munmap(mapping->data, mapping->size);
+        }
+        if (mapping->file >= 0) {
+            ::close(mapping->file);
+        }
+        mapping->file = -1;
+        mapping->data = NULL;
+        mapping->size = 0;
+    }
+}
+
+bool DiskCache::growRecords() {
+    uint64_t capacity = (records.size - sizeof(RecordHeader)) / sizeof(Record);
+    uint64_t grown = capacity < initialRecordCapacity ? initialRecordCapacity : 2 * capacity;
+    if (maxBytes != 0) {
+        uint64_t limit = (maxBytes - std::min<uint64_t>(maxBytes, sizeof(RecordHeader))) / sizeof(Record);
+        grown = std::min(grown, limit);
+    }
+    if (grown <= capacity) {
+        return false;
+    }
+    return Remap(records.file, records.data, records.size, sizeof(RecordHeader) + grown * sizeof(Record));
+}
+
+bool DiskCache::rebuildIndex(uint64_t slotCount) {
+    slotCount = RoundUpToPowerOfTwo(std::max(slotCount, minimumSlotCount));
+    if (!Remap(index.file, index.data, index.size, sizeof(IndexHeader) + slotCount * sizeof(uint32_t))) {
+        return false;
+    }
+
+    const RecordHeader* header = reinterpret_cast<const RecordHeader*>(records.data);
+    IndexHeader* indexHeader = reinterpret_cast<IndexHeader*>(index.data);
+    std::memcpy(indexHeader->magic, indexMagic, sizeof(indexMagic));
+    indexHeader->generation = header->generation;
+    indexHeader->slotCount = slotCount;
+    std::memset(index.data + sizeof(IndexHeader), 0, slotCount * sizeof(uint32_t));
+
+    for (uint64_t record = 0; record < header->recordCount; record++) {
+        indexRecord(static_cast<uint32_t>(record));
+    }
+    indexHeader->recordCount = header->recordCount;
+    return true;
+}
+
+#else
+
+bool DiskCache::open(const char* path, uint64_t) {
+    return fail(std::string("Disk cache is not supported on this platform: ") + path);
+}
+
+void DiskCache::close() {
+}
+
+bool DiskCache::growRecords() {
+    return false;
+}
+
+bool DiskCache::rebuildIndex(uint64_t) {
+    return false;
+}
+
+#endif
+
+bool DiskCache::isOpen() const {
+    return records.data != NULL;
+}
+
+const std::string& DiskCache::getError() const {
+    return error;
+}
+
+// Adds a record to the index unless it is torn or already present.
+void DiskCache::indexRecord(uint32_t record) {
+    const Record& entry = reinterpret_cast<const Record*>(records.data + sizeof(RecordHeader))[record];
+    if (entry.check != CheckWord(entry) || findRecord(entry.hashLow, entry.hashHigh) >= 0) {
+        return;
+    }
+
+    IndexHeader* indexHeader = reinterpret_cast<IndexHeader*>(index.data);
+    uint32_t* slots = reinterpret_cast<uint32_t*>(index.data + sizeof(IndexHeader));
+    uint64_t mask = indexHeader->slotCount - 1;
+    uint64_t slot = entry.hashLow & mask;
+    while (slots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = record + 1;
+}
+
+int64_t DiskCache::findRecord(uint64_t hashLow, uint64_t hashHigh) const {
+    const IndexHeader* indexHeader = reinterpret_cast<const IndexHeader*>(index.data);
+    const uint32_t* slots = reinterpret_cast<const uint32_t*>(index.data + sizeof(IndexHeader));
+    const Record* entries = reinterpret_cast<const Record*>(records.data + sizeof(RecordHeader));
+    uint64_t mask = indexHeader->slotCount - 1;
+
+    for (uint64_t slot = hashLow & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        const Record& entry = entries[slots[slot] - 1];
+        if (entry.hashLow == hashLow && entry.hashHigh == hashHigh && entry.check == CheckWord(entry)) {
+            return static_cast<int64_t>(slots[slot] - 1);
+        }
+    }
+    return -1;
+}
+
+bool DiskCache::lookup(const char* text, size_t length, AngleMode mode, double& value) {
+    Key key;
+    return lookup(text, length, mode, value, key);
+}
+
+bool DiskCache::lookup(const char* text, size_t length, AngleMode mode, double& value, Key& key) {
+    HashKey(text, length, mode, key.low, key.high);
+
+    std::shared_lock<std::shared_mutex> guard(lock);
+    if (records.data == NULL) {
+        return false;
+    }
+
+    int64_t found = findRecord(key.low, key.high);
+    if (found < 0) {
+        misses++;
+        return false;
+    }
+
+    Record& entry = reinterpret_cast<Record*>(records.data + sizeof(RecordHeader))[found];
+    uint32_t run = reinterpret_cast<const RecordHeader*>(records.data)->run;
+    if (__atomic_load_n(&entry.lastRun, __ATOMIC_RELAXED) != run) {
+        __atomic_store_n(&entry.lastRun, run, __ATOMIC_RELAXED);
+    }
+    value = entry.value;
+    hits++;
+    return true;
+}
+
+void DiskCache::insert(const char* text, size_t length, AngleMode mode, double value) {
+    Key key;
+    HashKey(text, length, mode, key.low, key.high);
+    insert(key, value);
+}
+
+void DiskCache::insert(const Key& key, double value) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    if (records.data != NULL) {
+        appendLocked(key, value);
+    }
+}
+
+void DiskCache::insert(const Pending* records, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> guard(lock);
+    if (this->records.data == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!appendLocked(records[i].key, records[i].value)) {
+            return;
+        }
+    }
+}
+
+// Appends a record unless one with the same hash exists. Returns false
+// only when the file is full and cannot grow or be compacted.
+bool DiskCache::appendLocked(const Key& key, double value) {
+    if (findRecord(key.low, key.high) >= 0) {
+        return true;
+    }
+
+    RecordHeader* header = reinterpret_cast<RecordHeader*>(records.data);
+    uint64_t capacity = (records.size - sizeof(RecordHeader)) / sizeof(Record);
+    if (header->recordCount == capacity && !growRecords()) {
+        if (maxBytes == 0 || !compactLocked(UINT_MAX, maxBytes / 2)) {
+            return false;
+        }
+        header = reinterpret_cast<RecordHeader*>(records.data);
+        capacity = (records.size - sizeof(RecordHeader)) / sizeof(Record);
+        if (header->recordCount == capacity) {
+            return false;
+        }
+    }
+    header = reinterpret_cast<RecordHeader*>(records.data);
+
+    // The record is written before the count that commits it.
+    Record& entry = reinterpret_cast<Record*>(records.data + sizeof(RecordHeader))[header->recordCount];
+    entry.hashLow = key.low;
+    entry.hashHigh = key.high;
+    entry.value = value;
+    entry.lastRun = header->run;
+    entry.check = CheckWord(entry);
+    uint32_t record = static_cast<uint32_t>(header->recordCount);
+    header->recordCount++;
+    insertions++;
+
+    IndexHeader* indexHeader = reinterpret_cast<IndexHeader*>(index.data);
+    if (2 * header->recordCount > indexHeader->slotCount) {
+        rebuildIndex(2 * indexHeader->slotCount);
+    } else {
+        indexRecord(record);
+        indexHeader->recordCount = header->recordCount;
+    }
+    return true;
+}
+
+bool DiskCache::compact(unsigned keepRuns) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    if (records.data == NULL) {
+        return false;
+    }
+    return compactLocked(keepRuns, 0);
+}
+
+// Keeps the records used in the last keepRuns runs and, when targetBytes
+// is set, only the most recently used of those that fit in it. Records
+// move down in place, keeping their order.
+bool DiskCache::compactLocked(unsigned keepRuns, uint64_t targetBytes) {
+    RecordHeader* header = reinterpret_cast<RecordHeader*>(records.data);
+    Record* entries = reinterpret_cast<Record*>(records.data + sizeof(RecordHeader));
+    uint32_t run = header->run;
+    uint64_t count = header->recordCount;
+
+    std::vector<uint32_t> ages;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t age = run - entries[i].lastRun;
+        if (entries[i].check == CheckWord(entries[i]) && age < keepRuns) {
+            ages.push_back(age);
+        }
+    }
+
+    // Under a byte target, the oldest survivors go too: everything older
+    // than cutoff, and as many at cutoff as still fit.
+    uint64_t limit = ages.size();
+    uint32_t cutoff = UINT_MAX;
+    uint64_t atCutoff = 0;
+    if (targetBytes != 0) {
+        limit = std::min<uint64_t>(limit, (targetBytes - std::min<uint64_t>(targetBytes, sizeof(RecordHeader))) /
+                                              sizeof(Record));
+        if (limit < ages.size()) {
+            std::nth_element(ages.begin(), ages.begin() + limit, ages.end());
+            cutoff = ages[limit];
+            atCutoff = limit - static_cast<uint64_t>(std::count_if(ages.begin(), ages.end(),
+                                                                   [cutoff](uint32_t age) { return age < cutoff; }));
+        }
+    }
+
+    header->generation = NewGeneration();
+    uint64_t kept = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t age = run - entries[i].lastRun;
+        if (entries[i].check != CheckWord(entries[i]) || age >= keepRuns || age > cutoff) {
+            continue;
+        }
+        if (age == cutoff) {
+            if (atCutoff == 0) {
+                continue;
+            }
+            atCutoff--;
+        }
+        entries[kept++] = entries[i];
+    }
+    header->recordCount = kept;
+    compactions++;
+
+    uint64_t capacity = std::max<uint64_t>(initialRecordCapacity, 2 * kept);
+    if (maxBytes != 0) {
+        capacity = std::min<uint64_t>(capacity, (maxBytes - std::min<uint64_t>(maxBytes, sizeof(RecordHeader))) /
+                                                    sizeof(Record));
+    }
+#ifdef CALC_HAVE_MMAP
+    if (!Remap(records.file, records.data, records.size, sizeof(RecordHeader) + capacity * sizeof(Record))) {
+        return false;
+    }
+#endif
+    return rebuildIndex(2 * kept);
+}
+
+DiskCache::Stats DiskCache::getStats() const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    Stats stats = Stats();
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.insertions = insertions;
+    stats.compactions = compactions;
+    if (records.data != NULL) {
+        stats.records = reinterpret_cast<const RecordHeader*>(records.data)->recordCount;
+        stats.fileBytes = sizeof(RecordHeader) + stats.records * sizeof(Record);
+    }
+    return stats;
+}
+
+DiskCacheBatch::DiskCacheBatch(DiskCache& cache) : cache(cache) {
+}
+
+DiskCacheBatch::~DiskCacheBatch() {
+    flush();
+}
+
+void DiskCacheBatch::insert(const DiskCache::Key& key, double value) {
+    DiskCache::Pending record = { key, value };
+    pending.push_back(record);
+}
+
+void DiskCacheBatch::flush() {
+    if (!pending.empty()) {
+        cache.insert(pending.data(), pending.size());
+        pending.clear();
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include "context.h"
+
+// A persistent cache of evaluation results for reruns over mostly
+// unchanged inputs. Each record is content-addressed: it stores a 128-bit
+// hash of the exact expression text, seeded with evaluatorVersion and the
+// angle mode, next to the value. The text itself is not stored. Changing
+// the evaluator version or the mode therefore misses, and never returns
+// a stale result. Attach a cache to EvaluationContexts with
+// setDiskCache(). Like ResultCache, it only holds successful results.
+//
+// The records live in an append-only, memory-mapped file. A second mapped
+// file, PATH.idx, holds the index: an open-addressing table of 32-bit
+// record numbers, about 8 bytes per record. The index is rebuilt from the
+// records whenever it is missing or stale. Every record carries a check
+// word, so a record torn by a crash is ignored, not returned.
+//
+// Each open() starts a new run, and a hit stamps the record with it.
+// compact() drops records that no recent run used. When maxBytes is set
+// and an append would exceed it, the cache compacts itself down to the
+// most recently used half.
+//
+// Lookups from several threads proceed in parallel; appends, growth and
+// compaction take the lock exclusively. A cache file can be open in one
+// process at a time. Requires POSIX mmap; on other platforms open()
+// fails.
+class DiskCache {
+public:
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t insertions;
+        size_t compactions;
+        size_t records;
+        uint64_t fileBytes;
+    };
+
+    DiskCache();
+    ~DiskCache();
+
+    // Opens or creates the cache at path. maxBytes caps the record file
+    // (0 for no limit). On failure returns false and getError() says why.
+    bool open(const char* path, uint64_t maxBytes = 0);
+    void close();
+    bool isOpen() const;
+    const std::string& getError() const;
+
+    // The record hash lookup() computes for a text and mode; handing it to
+    // insert() after a miss saves hashing the text again.
+    struct Key {
+        uint64_t low;
+        uint64_t high;
+    };
+
+    // A result waiting in a DiskCacheBatch.
+    struct Pending {
+        Key key;
+        double value;
+    };
+
+    bool lookup(const char* text, size_t length, AngleMode mode, double& value);
+    bool lookup(const char* text, size_t length, AngleMode mode, double& value, Key& key);
+    void insert(const char* text, size_t length, AngleMode mode, double value);
+    void insert(const Key& key, double value);
+
+    // Appends every record not already present under one exclusive lock.
+    void insert(const Pending* records, size_t count);
+
+    // Drops every record not used in the last keepRuns runs, including
+    // the current one, and shrinks the file.
+    bool compact(unsigned keepRuns = 1);
+
+    Stats getStats() const;
+
+private:
+    struct Mapping {
+        int file;
+        char* data;
+        uint64_t size;
+    };
+
+    Mapping records;
+    Mapping index;
+    uint64_t maxBytes;
+    std::string path;
+    std::string error;
+    mutable std::shared_mutex lock;
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+    size_t insertions;
+    size_t compactions;
+
+    bool fail(const std::string& message);
+    bool growRecords();
+    bool rebuildIndex(uint64_t slotCount);
+    void indexRecord(uint32_t record);
+    bool compactLocked(unsigned keepRuns, uint64_t targetBytes);
+    int64_t findRecord(uint64_t hashLow, uint64_t hashHigh) const;
+    bool appendLocked(const Key& key, double value);
+
+    DiskCache(const DiskCache&);
+    DiskCache& operator=(const DiskCache&);
+};
+
+// Collects one thread's inserts into a DiskCache and appends them under a
+// single exclusive lock on flush(), so a cold run does not take the lock
+// once per result. Queued results are not found by lookups until then.
+// A batch is not itself thread-safe: give each thread its own. It flushes
+// on destruction, so it must not outlive its cache with results queued.
+class DiskCacheBatch {
+public:
+    explicit DiskCacheBatch(DiskCache& cache);
+    ~DiskCacheBatch();
+
+    void insert(const DiskCache::Key& key, double value);
+    void flush();
+
+private:
+    DiskCache& cache;
+    std::vector<DiskCache::Pending> pending;
+
+    DiskCacheBatch(const DiskCacheBatch&);
+    DiskCacheBatch& operator=(const DiskCacheBatch&);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "evalerror.h"
+#include <cstdio>
+
+namespace {
+
+// std::to_string's format, without the temporary string.
+void AppendOperand(std::string& output, double value) {
+    char text[512];
+    int length = std::snprintf(text, sizeof(text), "%f", value);
+    output.append(text, static_cast<size_t>(length));
+}
+
+void AppendOperatorContext(std::string& output, const EvalError& error) {
+    output += " when evaluating ";
+    AppendOperand(output, error.left);
+    output += ' ';
+    output += error.op;
+    output += ' ';
+    AppendOperand(output, error.right);
+}
+
+void AppendQuoted(std::string& output, const EvalError& error, const char* source) {
+    output += '\'';
+    output.append(source + error.position, error.length);
+    output += '\'';
+}
+
+}
+
+void AppendErrorMessage(std::string& output, const EvalError& error, const char* source) {
+    switch (error.kind) {
+        case EvalErrorKind::None:
+            output += "OK";
+            return;
+
+        case EvalErrorKind::UnrecognizedCharacter:
+            output += "Unrecognized character in expression: ";
+            AppendQuoted(output, error, source);
+            return;
+        case EvalErrorKind::MultipleDecimalPoints:
+            output += "Invalid number format: multiple decimal points in ";
+            AppendQuoted(output, error, source);
+            return;
+        case EvalErrorKind::InvalidNumber:
+            output += "Invalid number format: ";
+            AppendQuoted(output, error, source);
+            return;
+        case EvalErrorKind::UnknownIdentifier:
+            output += "Unknown identifier: ";
+            AppendQuoted(output, error, source);
+            return;
+
+        case EvalErrorKind::NoOperands:
+            output += "Invalid expression: no operands";
+            return;
+        case EvalErrorKind::TooManyOperands:
+            output += "Invalid expression: too many operands";
+            return;
+        case EvalErrorKind::NestedTooDeeply:
+            output += "Invalid expression: nested too deeply";
+            return;
+        case EvalErrorKind::UnclosedParenthesis:
+            output += "Mismatched parentheses: extra '('";
+            return;
+        case EvalErrorKind::UnclosedCall:
+            output += "Missing closing parenthesis for function";
+            return;
+        case EvalErrorKind::ExtraClosingParenthesis:
+            output += "Mismatched parentheses: extra ')'";
+            return;
+        case EvalErrorKind::EmptyParentheses:
+            output += "Invalid expression: empty parentheses or missing operand before ')'";
+            return;
+        case EvalErrorKind::ConsecutiveOperators:
+            output += "Invalid expression: operator '";
+            output += error.op;
+            output += "' cannot follow another operator";
+            return;
+        case EvalErrorKind::EndsWithOperator:
+            output += "Invalid expression: ends with an operator";
+            return;
+        case EvalErrorKind::MissingArgument:
+            output += "Function ";
+            output += GetFunctionName(error.function);
+            output += " requires an argument";
+            return;
+
+        case EvalErrorKind::DivisionByZero:
+            output += "Division by zero";
+            AppendOperatorContext(output, error);
+            return;
+        case EvalErrorKind::ModuloByZero:
+            output += "Modulo by zero";
+            AppendOperatorContext(output, error);
+            return;
+        case EvalErrorKind::InvalidPower:
+            output += "Power error: ";
+            output += GetStatusMessage(error.powerStatus);
+            AppendOperatorContext(output, error);
+            return;
+        case EvalErrorKind::FunctionDomain:
+            output += GetFunctionErrorMessage(error.function, error.functionError);
+            return;
+        case EvalErrorKind::UnboundVariable:
+            output += "No value for variable: ";
+            AppendQuoted(output, error, source);
+            return;
+    }
+    output += "Unknown error";
+}
+
+std::string DescribeError(const EvalError& error, const char* source) {
+    std::string message;
+    AppendErrorMessage(message, error, source);
+    return message;
+}
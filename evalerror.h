@@ -0,0 +1,67 @@
+#ifndef EVALERROR_H
+#define EVALERROR_H
+
+#include <string>
+#include <cstddef>
+#include "calculator.h"
+#include "functions.h"
+
+// Why an expression could not be evaluated. Lexer and parser errors are
+// found while compiling, the rest while executing.
+enum class EvalErrorKind : unsigned char {
+    None,
+
+    UnrecognizedCharacter,
+    MultipleDecimalPoints,
+    InvalidNumber,
+    UnknownIdentifier,
+
+    NoOperands,
+    TooManyOperands,
+    NestedTooDeeply,
+    UnclosedParenthesis,
+    UnclosedCall,
+    ExtraClosingParenthesis,
+    EmptyParentheses,
+    ConsecutiveOperators,
+    EndsWithOperator,
+    MissingArgument,
+
+    DivisionByZero,
+    ModuloByZero,
+    InvalidPower,
+    FunctionDomain,
+    UnboundVariable
+};
+
+// The first error in an expression. position and length span the
+// offending text: the bad lexeme, the unmatched '(' or call, the failing
+// operator or function name; at the end of input length is 0. The
+// remaining fields are filled in for the kinds whose message needs them.
+struct EvalError {
+    EvalErrorKind kind;
+    size_t position;
+    size_t length;
+    char op;                      // ConsecutiveOperators and the operator kinds
+    MathFunction function;        // MissingArgument, FunctionDomain
+    CalcStatus powerStatus;       // InvalidPower
+    FunctionError functionError;  // FunctionDomain
+    double left;                  // operands of a failed operator, or the
+    double right;                 // rejected function argument in left
+};
+
+// What the non-throwing entry points return: value when error.kind is
+// None, otherwise the error.
+struct EvalResult {
+    double value;
+    EvalError error;
+
+    bool ok() const { return error.kind == EvalErrorKind::None; }
+};
+
+// Appends the message the throwing API reports for error. source is the
+// expression text the error positions refer to.
+void AppendErrorMessage(std::string& output, const EvalError& error, const char* source);
+std::string DescribeError(const EvalError& error, const char* source);
+
+#endif
@@ -0,0 +1,523 @@
+#include "expression.h"
+#include "diskcache.h"
+#include "jit.h"
+#include "lexer.h"
+#include "numberformat.h"
+#include "optimizer.h"
+#include "resultcache.h"
+#include <stdexcept>
+
+namespace {
+
+// Recursive-descent parser over the lexer's token stream. Nodes are
+// appended as each production completes, which leaves the array in
+// post-order.
+//
+//   expression := term (('+' | '-') term)*
+//   term       := power (('*' | '/' | '%') power)*
+//   power      := unary ('^' unary)*
+//   unary      := '-' term | primary
+//   primary    := number | variable | call | implicit-call | '(' expression ')'
+//   call       := function '(' expression? ')'
+//   implicit   := function number
+//
+// Unary minus takes a whole term as its operand ("8/-2/2" is 8/-(2/2)),
+// and '^' is left-associative, matching the original operator-stack parser.
+class ExpressionParser {
+public:
+    ExpressionParser(std::string_view expression, const VariableTable* variables,
+                     std::vector<CompiledExpression::Node>& nodes, EvalError& error)
+        : lexer(expression, variables), depth(0), nodes(nodes), error(error) {}
+
+    bool parse();
+
+private:
+    static const int maxNestingDepth = 1000;
+
+    Lexer lexer;
+    int depth;
+    std::vector<CompiledExpression::Node>& nodes;
+    EvalError& error;
+
+    bool atOperator(char first, char second = 0, char third = 0) const;
+    Token next();
+
+    int addNumber(double value, size_t position);
+    int addVariable(unsigned int slot, size_t position, size_t length);
+    int addOperator(char op, int left, int right, size_t position);
+    int addFunction(MathFunction function, int argument, size_t position);
+
+    int parseExpression();
+    int parseTerm();
+    int parsePower();
+    int parseUnary();
+    int parsePrimary();
+    int parseCall(const Token& call);
+    int expectClose(int inner, const Token& open, EvalErrorKind missing);
+    bool enter(const Token& token);
+    int fail(EvalErrorKind kind, const Token& token);
+};
+
+bool ExpressionParser::atOperator(char first, char second, char third) const {
+    const Token& token = lexer.peek();
+    return token.type == TokenType::Operator &&
+           (token.op == first || (second && token.op == second) || (third && token.op == third));
+}
+
+// Consumes a token. A malformed lexeme is reported as soon as it becomes
+// the lookahead, before the parser looks at it, so callers check error
+// after every call.
+Token ExpressionParser::next() {
+    Token token = lexer.next();
+    if (lexer.peek().type == TokenType::Error) {
+        fail(lexer.peek().error, lexer.peek());
+    }
+    return token;
+}
+
+int ExpressionParser::addNumber(double value, size_t position) {
+    CompiledExpression::Node node = { CompiledExpression::NodeType::Number, 0,
+                                      MathFunction::Sin, value, -1, -1,
+                                      static_cast<unsigned int>(position), 0, 0 };
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+int ExpressionParser::addOperator(char op, int left, int right, size_t position) {
+    CompiledExpression::Node node = { CompiledExpression::NodeType::Operator, op,
+                                      MathFunction::Sin, 0.0, left, right,
+                                      static_cast<unsigned int>(position), 0, 0 };
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+int ExpressionParser::addFunction(MathFunction function, int argument, size_t position) {
+    CompiledExpression::Node node = { CompiledExpression::NodeType::Function, 0,
+                                      function, 0.0, argument, -1,
+                                      static_cast<unsigned int>(position), 0, 0 };
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+int ExpressionParser::addVariable(unsigned int slot, size_t position, size_t length) {
+    CompiledExpression::Node node = { CompiledExpression::NodeType::Variable, 0,
+                                      MathFunction::Sin, 0.0, -1, -1,
+                                      static_cast<unsigned int>(position), slot,
+                                      static_cast<unsigned int>(length) };
+    nodes.push_back(node);
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+// Records the first error and returns the failed-production marker.
+int ExpressionParser::fail(EvalErrorKind kind, const Token& token) {
+    if (error.kind == EvalErrorKind::None) {
+        error.kind = kind;
+        error.position = token.position;
+        error.length = token.length;
+        error.op = token.op;
+        error.function = token.function;
+    }
+    return -1;
+}
+
+bool ExpressionParser::enter(const Token& token) {
+    if (++depth > maxNestingDepth) {
+        fail(EvalErrorKind::NestedTooDeeply, token);
+        return false;
+    }
+    return true;
+}
+
+// Consumes the ')' closing a group or call opened by open, or reports what
+// is there instead.
+int ExpressionParser::expectClose(int inner, const Token& open, EvalErrorKind missing) {
+    switch (lexer.peek().type) {
+        case TokenType::RightParen:
+            next();
+            return error.kind == EvalErrorKind::None ? inner : -1;
+        case TokenType::End:
+            return fail(missing, open);
+        default:
+            return fail(EvalErrorKind::TooManyOperands, lexer.peek());
+    }
+}
+
+bool ExpressionParser::parse() {
+    const Token& first = lexer.peek();
+    if (first.type == TokenType::Error) {
+        fail(first.error, first);
+        return false;
+    }
+    if (first.type == TokenType::End) {
+        fail(EvalErrorKind::NoOperands, first);
+        return false;
+    }
+
+    if (parseExpression() < 0) {
+        return false;
+    }
+
+    switch (lexer.peek().type) {
+        case TokenType::End:
+            return true;
+        case TokenType::RightParen:
+            fail(EvalErrorKind::ExtraClosingParenthesis, lexer.peek());
+            return false;
+        default:
+            fail(EvalErrorKind::TooManyOperands, lexer.peek());
+            return false;
+    }
+}
+
+int ExpressionParser::parseExpression() {
+    int left = parseTerm();
+
+    while (left >= 0 && atOperator('+', '-')) {
+        Token op = next();
+        int right = error.kind == EvalErrorKind::None ? parseTerm() : -1;
+        left = right < 0 ? -1 : addOperator(op.op, left, right, op.position);
+    }
+    return left;
+}
+
+int ExpressionParser::parseTerm() {
+    int left = parsePower();
+
+    while (left >= 0 && atOperator('*', '/', '%')) {
+        Token op = next();
+        int right = error.kind == EvalErrorKind::None ? parsePower() : -1;
+        left = right < 0 ? -1 : addOperator(op.op, left, right, op.position);
+    }
+    return left;
+}
+
+int ExpressionParser::parsePower() {
+    int left = parseUnary();
+
+    while (left >= 0 && atOperator('^')) {
+        Token op = next();
+        int right = error.kind == EvalErrorKind::None ? parseUnary() : -1;
+        left = right < 0 ? -1 : addOperator('^', left, right, op.position);
+    }
+    return left;
+}
+
+int ExpressionParser::parseUnary() {
+    if (!atOperator('-')) {
+        return parsePrimary();
+    }
+
+    Token minus = next();
+    if (error.kind != EvalErrorKind::None || !enter(minus)) {
+        return -1;
+    }
+    int zero = addNumber(0.0, minus.position);
+    int operand = parseTerm();
+    depth--;
+    return operand < 0 ? -1 : addOperator('-', zero, operand, minus.position);
+}
+
+int ExpressionParser::parsePrimary() {
+    Token token = next();
+    if (error.kind != EvalErrorKind::None) {
+        return -1;
+    }
+
+    switch (token.type) {
+        case TokenType::Number:
+            return addNumber(token.value, token.position);
+
+        case TokenType::Variable:
+            return addVariable(token.slot, token.position, token.length);
+
+        case TokenType::LeftParen: {
+            if (!enter(token)) {
+                return -1;
+            }
+            int inner = parseExpression();
+            depth--;
+            return inner < 0 ? -1 : expectClose(inner, token, EvalErrorKind::UnclosedParenthesis);
+        }
+
+        case TokenType::Call:
+            return parseCall(token);
+
+        case TokenType::ImplicitCall: {
+            Token argument = next();
+            if (error.kind != EvalErrorKind::None) {
+                return -1;
+            }
+            return addFunction(token.function, addNumber(argument.value, argument.position), token.position);
+        }
+
+        case TokenType::RightParen:
+            return fail(EvalErrorKind::EmptyParentheses, token);
+
+        case TokenType::Operator:
+            return fail(EvalErrorKind::ConsecutiveOperators, token);
+
+        case TokenType::End:
+        case TokenType::Error:
+            break;
+    }
+    return fail(EvalErrorKind::EndsWithOperator, token);
+}
+
+int ExpressionParser::parseCall(const Token& call) {
+    if (lexer.peek().type == TokenType::RightParen) {
+        next();
+        if (error.kind != EvalErrorKind::None) {
+            return -1;
+        }
+        const FunctionInfo& info = GetFunctionInfo(call.function);
+        if (!info.hasDefault) {
+            return fail(EvalErrorKind::MissingArgument, call);
+        }
+        return addFunction(call.function, addNumber(info.defaultArgument, call.position), call.position);
+    }
+
+    if (!enter(call)) {
+        return -1;
+    }
+    int argument = parseExpression();
+    depth--;
+    if (argument < 0) {
+        return -1;
+    }
+    argument = expectClose(argument, call, EvalErrorKind::UnclosedCall);
+
+    return argument < 0 ? -1 : addFunction(call.function, argument, call.position);
+}
+
+}
+
+CompiledExpression::CompiledExpression() {
+}
+
+CompiledExpression::CompiledExpression(const std::string& expression, const VariableTable* variables) {
+    compile(expression.data(), expression.length(), variables);
+}
+
+void CompiledExpression::compile(const char* text, size_t length, const VariableTable* variables) {
+    EvalError error = EvalError();
+    if (!tryCompile(text, length, error, variables)) {
+        throw std::runtime_error(DescribeError(error, source.c_str()));
+    }
+}
+
+bool CompiledExpression::tryCompile(const char* text, size_t length, EvalError& error,
+                                    const VariableTable* variables) {
+    source.assign(text, length);
+    return parse(source, error, variables);
+}
+
+bool CompiledExpression::tryCompileInPlace(std::string_view text, EvalError& error, const VariableTable* variables) {
+    source.clear();
+    return parse(text, error, variables);
+}
+
+bool CompiledExpression::parse(std::string_view text, EvalError& error, const VariableTable* variables) {
+    nodes.clear();
+    program.clear();
+    native.reset();
+
+    if (text.empty()) {
+        return true;
+    }
+
+    ExpressionParser parser(text, variables, nodes, error);
+    if (!parser.parse()) {
+        nodes.clear();
+        return false;
+    }
+
+    for (const Node& node : nodes) {
+        switch (node.type) {
+            case NodeType::Number: program.emitConstant(node.value, node.position); break;
+            case NodeType::Operator: program.emitOperator(node.op, node.position); break;
+            case NodeType::Function: program.emitCall(node.function, node.position); break;
+            case NodeType::Variable: program.emitVariable(node.slot, node.position, node.length); break;
+        }
+    }
+    return true;
+}
+
+void CompiledExpression::reserve(size_t length) {
+    // A character produces at most two nodes: unary minus adds an
+    // implicit zero operand alongside its operator.
+    source.reserve(length);
+    nodes.reserve(2 * length);
+    program.reserve(2 * length);
+}
+
+void CompiledExpression::optimize(OptimizerStats* stats, const OptimizerOptions* options) {
+    OptimizerStats ignored = OptimizerStats();
+    native.reset();
+    OptimizeExpression(nodes, program, options != NULL ? *options : OptimizerOptions(),
+                       stats != NULL ? *stats : ignored);
+}
+
+bool CompiledExpression::jit() {
+    std::shared_ptr<JitCode> code(new JitCode());
+    if (!code->compile(program)) {
+        native.reset();
+        return false;
+    }
+    native = code;
+    return true;
+}
+
+bool CompiledExpression::isJitted() const {
+    return native != NULL;
+}
+
+double CompiledExpression::evaluate(EvaluationContext& context) const {
+    double result;
+    EvalError error = EvalError();
+    if (!tryEvaluate(context, result, error)) {
+        throw std::runtime_error(DescribeError(error, source.c_str()));
+    }
+    return result;
+}
+
+bool CompiledExpression::tryEvaluate(EvaluationContext& context, double& result, EvalError& error) const {
+    if (program.getVariableCount() != 0 && program.getVariableCount() > context.getVariableCount()) {
+        error.kind = EvalErrorKind::UnboundVariable;
+        error.position = program.getHighestVariablePosition();
+        error.length = program.getHighestVariableLength();
+        return false;
+    }
+
+    double inlineStack[Bytecode::inlineStackSize];
+    double* stack = program.getStackDepth() <= Bytecode::inlineStackSize
+        ? inlineStack : context.getStack(program.getStackDepth());
+
+    if (native) {
+        return native->tryExecute(program, context, stack, result, error);
+    }
+    return program.tryExecute(context, stack, result, error);
+}
+
+const std::string& CompiledExpression::getSource() const {
+    return source;
+}
+
+const std::vector<CompiledExpression::Node>& CompiledExpression::getNodes() const {
+    return nodes;
+}
+
+const Bytecode& CompiledExpression::getBytecode() const {
+    return program;
+}
+
+bool CompiledExpression::empty() const {
+    return nodes.empty();
+}
+
+ExpressionSet::ExpressionSet() {
+}
+
+bool ExpressionSet::tryAdd(const char* text, size_t length, EvalError& error, const VariableTable* variables) {
+    expressions.push_back(CompiledExpression());
+    if (!expressions.back().tryCompile(text, length, error, variables)) {
+        expressions.pop_back();
+        return false;
+    }
+    return true;
+}
+
+void ExpressionSet::add(const std::string& expression, const VariableTable* variables) {
+    EvalError error = EvalError();
+    if (!tryAdd(expression.data(), expression.length(), error, variables)) {
+        throw std::runtime_error(DescribeError(error, expression.c_str()));
+    }
+}
+
+void ExpressionSet::optimize(OptimizerStats* stats, const OptimizerOptions* options) {
+    std::vector<const std::vector<CompiledExpression::Node>*> trees;
+    for (const CompiledExpression& expression : expressions) {
+        trees.push_back(&expression.getNodes());
+    }
+    OptimizerStats ignored = OptimizerStats();
+    OptimizeExpressions(trees, program, resultSlots, options != NULL ? *options : OptimizerOptions(),
+                        stats != NULL ? *stats : ignored);
+}
+
+size_t ExpressionSet::size() const {
+    return expressions.size();
+}
+
+const CompiledExpression& ExpressionSet::getExpression(size_t index) const {
+    return expressions[index];
+}
+
+const Bytecode& ExpressionSet::getBytecode() const {
+    return program;
+}
+
+unsigned int ExpressionSet::getResultSlot(size_t index) const {
+    return resultSlots[index];
+}
+
+EvalResult TryEvaluateExpression(const char* text, size_t length, EvaluationContext& context) {
+    if (context.isLogging()) {
+        context.log("EvaluateExpression called with: " + std::string(text, length));
+    }
+
+    EvalResult result = EvalResult();
+    const VariableTable* variables = context.getVariables();
+    bool cacheable = context.getVariableCount() == 0;
+    ResultCache* cache = cacheable ? context.getResultCache() : NULL;
+    ResultCache::Key cacheKey;
+    if (cache != NULL && cache->lookup(text, length, context.getAngleMode(), result.value, cacheKey)) {
+        if (context.isLogging()) {
+            context.log("Final result (cached): " + NumberToString(result.value));
+        }
+        return result;
+    }
+
+    DiskCache* diskCache = cacheable ? context.getDiskCache() : NULL;
+    DiskCache::Key diskKey;
+    if (diskCache != NULL && diskCache->lookup(text, length, context.getAngleMode(), result.value, diskKey)) {
+        if (cache != NULL) {
+            cache->insert(text, length, context.getAngleMode(), result.value, cacheKey);
+        }
+        if (context.isLogging()) {
+            context.log("Final result (disk cache): " + NumberToString(result.value));
+        }
+        return result;
+    }
+
+    CompiledExpression& compiled = context.getScratchExpression();
+    if (compiled.tryCompileInPlace(std::string_view(text, length), result.error, variables) &&
+        compiled.tryEvaluate(context, result.value, result.error)) {
+        if (cache != NULL) {
+            cache->insert(text, length, context.getAngleMode(), result.value, cacheKey);
+        }
+        if (diskCache != NULL && context.getDiskCacheBatch() != NULL) {
+            context.getDiskCacheBatch()->insert(diskKey, result.value);
+        } else if (diskCache != NULL) {
+            diskCache->insert(diskKey, result.value);
+        }
+        if (context.isLogging()) {
+            context.log("Final result: " + NumberToString(result.value));
+        }
+    }
+    return result;
+}
+
+EvalResult TryEvaluateExpression(const std::string& expression, EvaluationContext& context) {
+    return TryEvaluateExpression(expression.data(), expression.length(), context);
+}
+
+double EvaluateExpression(const char* text, size_t length, EvaluationContext& context) {
+    EvalResult result = TryEvaluateExpression(text, length, context);
+    if (!result.ok()) {
+        throw std::runtime_error(DescribeError(result.error, text));
+    }
+    return result.value;
+}
+
+double EvaluateExpression(const std::string& expression, EvaluationContext& context) {
+    return EvaluateExpression(expression.data(), expression.length(), context);
+}
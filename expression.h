@@ -0,0 +1,150 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "calculator.h"
+#include "bytecode.h"
+#include "context.h"
+#include "evalerror.h"
+#include "lexer.h"
+#include "variables.h"
+
+class JitCode;
+struct OptimizerOptions;
+struct OptimizerStats;
+
+// Identifies the evaluator's results in persistent caches. Bump it with
+// any change that can alter the value an expression evaluates to, so
+// results stored by older builds are no longer found.
+const uint32_t evaluatorVersion = 1;
+
+// An expression parsed once into a flat node array that can be evaluated
+// any number of times. Nodes are stored in post-order, so every node's
+// operands sit at lower indices and the last node is the root; the array
+// is lowered to bytecode once at construction.
+//
+// compile() replaces the expression in place and reuses the existing
+// buffers, so recompiling expressions no larger than earlier ones does not
+// allocate. evaluate() never allocates once the context's stack is sized.
+//
+// tryCompile() and tryEvaluate() report errors through an EvalError
+// instead of throwing; compile() and evaluate() wrap them and throw
+// std::runtime_error with the error's message.
+//
+// Compiling against a VariableTable resolves its names to slots (kept in
+// Variable nodes); evaluation then reads the context's variable values.
+class CompiledExpression {
+public:
+    enum class NodeType { Number, Operator, Function, Variable };
+
+    struct Node {
+        NodeType type;
+        char op;
+        MathFunction function;
+        double value;
+        int left;
+        int right;
+        unsigned int position;
+        unsigned int slot;
+        unsigned int length;
+    };
+
+    CompiledExpression();
+    explicit CompiledExpression(const std::string& expression, const VariableTable* variables = NULL);
+
+    void compile(const char* text, size_t length, const VariableTable* variables = NULL);
+    bool tryCompile(const char* text, size_t length, EvalError& error, const VariableTable* variables = NULL);
+
+    // Like tryCompile, but parses text where it is instead of keeping a
+    // copy: getSource() is then empty, and error messages are built from
+    // the caller's text. For text that is evaluated once, straight from an
+    // input buffer.
+    bool tryCompileInPlace(std::string_view text, EvalError& error, const VariableTable* variables = NULL);
+
+    // Sizes the buffers for expressions of up to length characters.
+    void reserve(size_t length);
+
+    // Replaces the program with one that folds constant subtrees, rewrites
+    // costly operations and computes repeated subexpressions once (see
+    // optimizer.h), adding what it removed to stats when given. NULL
+    // options use the defaults. Worth it for an expression that is
+    // evaluated many times; the next compile() undoes it.
+    void optimize(OptimizerStats* stats = NULL, const OptimizerOptions* options = NULL);
+
+    // Compiles the program to native code (see jit.h), which evaluate()
+    // then runs instead of the interpreter. Returns false, and keeps
+    // interpreting, where native code is unavailable. Call it after
+    // optimize(); the next compile() or optimize() drops the native code.
+    // Copies of the expression share it.
+    bool jit();
+    bool isJitted() const;
+
+    // An expression using variables fails with UnboundVariable when the
+    // context has fewer variables than the expression refers to.
+    double evaluate(EvaluationContext& context) const;
+    bool tryEvaluate(EvaluationContext& context, double& result, EvalError& error) const;
+
+    const std::string& getSource() const;
+    const std::vector<Node>& getNodes() const;
+    const Bytecode& getBytecode() const;
+    bool empty() const;
+
+private:
+    std::string source;
+    std::vector<Node> nodes;
+    Bytecode program;
+    std::shared_ptr<const JitCode> native;
+
+    bool parse(std::string_view text, EvalError& error, const VariableTable* variables);
+};
+
+// Several expressions over the same inputs compiled together into one
+// program that computes them all, with subexpressions that appear in more
+// than one of them computed once (see OptimizeExpressions). Meant for
+// deriving many columns from the same variables in one pass with
+// ColumnEvaluator. Each expression is also kept compiled on its own, which
+// is how a failing row is evaluated to find which results fail and why.
+class ExpressionSet {
+public:
+    ExpressionSet();
+
+    // Compiles and appends an expression; on error nothing is added.
+    bool tryAdd(const char* text, size_t length, EvalError& error, const VariableTable* variables = NULL);
+    void add(const std::string& expression, const VariableTable* variables = NULL);
+
+    // Builds the fused program from the expressions added so far, adding
+    // what was removed and shared to stats when given.
+    void optimize(OptimizerStats* stats = NULL, const OptimizerOptions* options = NULL);
+
+    size_t size() const;
+    const CompiledExpression& getExpression(size_t index) const;
+
+    // The fused program, which leaves expression index's value in
+    // temporary getResultSlot(index).
+    const Bytecode& getBytecode() const;
+    unsigned int getResultSlot(size_t index) const;
+
+private:
+    std::vector<CompiledExpression> expressions;
+    Bytecode program;
+    std::vector<unsigned int> resultSlots;
+};
+
+// Parses and evaluates an expression in one step, compiling into the
+// context's scratch expression so repeated calls reuse its buffers. When
+// the context has a ResultCache or DiskCache, a cached result skips both
+// steps. Names are resolved against the context's variables; while it has
+// any, results depend on their values and the caches are not used.
+double EvaluateExpression(const std::string& expression, EvaluationContext& context);
+double EvaluateExpression(const char* text, size_t length, EvaluationContext& context);
+
+// The non-throwing form, for inputs where errors are common: a malformed
+// expression costs no more than a valid one. Error positions index text.
+EvalResult TryEvaluateExpression(const char* text, size_t length, EvaluationContext& context);
+EvalResult TryEvaluateExpression(const std::string& expression, EvaluationContext& context);
+
+#endif
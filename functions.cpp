@@ -0,0 +1,234 @@
+#include "functions.h"
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const double notANumber = std::numeric_limits<double>::quiet_NaN();
+
+double Reject(FunctionError& error, FunctionError reason) {
+    error = reason;
+    return notANumber;
+}
+
+double ApplySin(Calculator& calculator, double argValue, bool inDegrees, FunctionError&) {
+    return calculator.sine(argValue, inDegrees);
+}
+
+double ApplyCos(Calculator& calculator, double argValue, bool inDegrees, FunctionError&) {
+    return calculator.cosine(argValue, inDegrees);
+}
+
+// Calculator::tangent's test, checked here so the rejection is reported
+// rather than thrown.
+double ApplyTan(Calculator& calculator, double argValue, bool inDegrees, FunctionError& error) {
+    double radians = inDegrees ? calculator.degreesToRadians(argValue) : argValue;
+    if (std::abs(std::cos(radians)) < 1e-10) {
+        return Reject(error, FunctionError::UndefinedTangent);
+    }
+    return std::tan(radians);
+}
+
+double ApplyAsin(Calculator& calculator, double argValue, bool inDegrees, FunctionError& error) {
+    if (argValue < -1.0 || argValue > 1.0) {
+        return Reject(error, FunctionError::Domain);
+    }
+    return calculator.arcsine(argValue, inDegrees);
+}
+
+double ApplyAcos(Calculator& calculator, double argValue, bool inDegrees, FunctionError& error) {
+    if (argValue < -1.0 || argValue > 1.0) {
+        return Reject(error, FunctionError::Domain);
+    }
+    return calculator.arccosine(argValue, inDegrees);
+}
+
+double ApplyAtan(Calculator& calculator, double argValue, bool inDegrees, FunctionError&) {
+    return calculator.arctangent(argValue, inDegrees);
+}
+
+double ApplySinh(Calculator& calculator, double argValue, bool, FunctionError&) {
+    return calculator.sineH(argValue);
+}
+
+double ApplyCosh(Calculator& calculator, double argValue, bool, FunctionError&) {
+    return calculator.cosineH(argValue);
+}
+
+double ApplyTanh(Calculator& calculator, double argValue, bool, FunctionError&) {
+    return calculator.tangentH(argValue);
+}
+
+double ApplySqrt(Calculator& calculator, double argValue, bool, FunctionError& error) {
+    if (argValue < 0.0) {
+        return Reject(error, FunctionError::Domain);
+    }
+    return calculator.squareRoot(argValue);
+}
+
+double ApplyLog(Calculator& calculator, double argValue, bool, FunctionError& error) {
+    if (argValue <= 0.0) {
+        return Reject(error, FunctionError::Domain);
+    }
+    return calculator.logarithm(argValue, 10.0);
+}
+
+double ApplyLn(Calculator& calculator, double argValue, bool, FunctionError& error) {
+    if (argValue <= 0.0) {
+        return Reject(error, FunctionError::Domain);
+    }
+    return calculator.naturalLogarithm(argValue);
+}
+
+double ApplyAbs(Calculator& calculator, double argValue, bool, FunctionError&) {
+    return calculator.absolute(argValue);
+}
+
+double ApplyFact(Calculator& calculator, double argValue, bool, FunctionError& error) {
+    if (argValue < 0 || std::floor(argValue) != argValue) {
+        return Reject(error, FunctionError::Domain);
+    }
+    if (argValue > 170) {
+        return Reject(error, FunctionError::FactorialTooLarge);
+    }
+    return calculator.factorial(argValue);
+}
+
+// In MathFunction order.
+constexpr FunctionInfo functionTable[] = {
+    { "sin",  3, true,  0.0, NULL, ApplySin },
+    { "cos",  3, true,  0.0, NULL, ApplyCos },
+    { "tan",  3, true,  0.0, NULL, ApplyTan },
+    { "asin", 4, false, 0.0, "Arcsine argument must be between -1 and 1", ApplyAsin },
+    { "acos", 4, false, 0.0, "Arccosine argument must be between -1 and 1", ApplyAcos },
+    { "atan", 4, false, 0.0, NULL, ApplyAtan },
+    { "sinh", 4, false, 0.0, NULL, ApplySinh },
+    { "cosh", 4, false, 0.0, NULL, ApplyCosh },
+    { "tanh", 4, false, 0.0, NULL, ApplyTanh },
+    { "sqrt", 4, true,  0.0, "Cannot take square root of negative number", ApplySqrt },
+    { "log",  3, true,  1.0, "Cannot take logarithm of non-positive number", ApplyLog },
+    { "ln",   2, true,  1.0, "Cannot take natural logarithm of non-positive number", ApplyLn },
+    { "abs",  3, true,  0.0, NULL, ApplyAbs },
+    { "fact", 4, true,  1.0, "Factorial is defined only for non-negative integers", ApplyFact },
+};
+
+static_assert(sizeof(functionTable) / sizeof(functionTable[0]) == mathFunctionCount,
+              "functionTable must have one entry per MathFunction");
+
+const size_t minNameLength = 2;
+const size_t maxNameLength = 4;
+const unsigned hashSize = 16;
+
+// Mixes the first two and the last character with the length. The
+// multipliers were picked so the 14 names land in distinct slots of a
+// 16-entry table; the static_assert below rejects any name added later
+// that collides.
+constexpr unsigned FunctionHash(const char* name, size_t length) {
+    return (7u * static_cast<unsigned char>(name[0]) +
+            3u * static_cast<unsigned char>(name[1]) +
+            5u * static_cast<unsigned char>(name[length - 1]) +
+            static_cast<unsigned>(length)) & (hashSize - 1);
+}
+
+constexpr unsigned EntryHash(size_t i) {
+    return FunctionHash(functionTable[i].name, functionTable[i].length);
+}
+
+constexpr bool HashIsPerfect(size_t i, size_t j) {
+    return i == mathFunctionCount ? true
+         : j == mathFunctionCount ? HashIsPerfect(i + 1, i + 2)
+         : EntryHash(i) != EntryHash(j) && HashIsPerfect(i, j + 1);
+}
+
+static_assert(HashIsPerfect(0, 1), "function names collide; choose new FunctionHash multipliers");
+
+constexpr signed char FindSlot(unsigned slot, size_t i) {
+    return i == mathFunctionCount ? -1
+         : EntryHash(i) == slot ? static_cast<signed char>(i)
+         : FindSlot(slot, i + 1);
+}
+
+// Maps each hash value to its MathFunction, or -1 for an empty slot.
+constexpr signed char hashSlots[hashSize] = {
+    FindSlot(0, 0),  FindSlot(1, 0),  FindSlot(2, 0),  FindSlot(3, 0),
+    FindSlot(4, 0),  FindSlot(5, 0),  FindSlot(6, 0),  FindSlot(7, 0),
+    FindSlot(8, 0),  FindSlot(9, 0),  FindSlot(10, 0), FindSlot(11, 0),
+    FindSlot(12, 0), FindSlot(13, 0), FindSlot(14, 0), FindSlot(15, 0),
+};
+
+bool NameEquals(const char* name, const char* text, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (name[i] != text[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+const FunctionInfo& GetFunctionInfo(MathFunction function) {
+    return functionTable[static_cast<size_t>(function)];
+}
+
+const char* GetFunctionName(MathFunction function) {
+    return functionTable[static_cast<size_t>(function)].name;
+}
+
+bool LookupFunction(const char* name, size_t length, MathFunction& function) {
+    if (length < minNameLength || length > maxNameLength) {
+        return false;
+    }
+
+    int slot = hashSlots[FunctionHash(name, length)];
+    if (slot < 0) {
+        return false;
+    }
+
+    const FunctionInfo& info = functionTable[slot];
+    if (info.length != length || !NameEquals(info.name, name, length)) {
+        return false;
+    }
+    function = static_cast<MathFunction>(slot);
+    return true;
+}
+
+bool IsFunction(const std::string& token) {
+    MathFunction function;
+    return LookupFunction(token.data(), token.length(), function);
+}
+
+size_t MatchFunctionPrefix(const char* text, size_t length, MathFunction& function) {
+    size_t longest = length < maxNameLength ? length : maxNameLength;
+    for (size_t candidate = longest; candidate >= minNameLength; candidate--) {
+        if (LookupFunction(text, candidate, function)) {
+            return candidate;
+        }
+    }
+    return 0;
+}
+
+const char* GetFunctionErrorMessage(MathFunction function, FunctionError error) {
+    switch (error) {
+        case FunctionError::None: return "OK";
+        case FunctionError::Domain: return functionTable[static_cast<size_t>(function)].domainMessage;
+        case FunctionError::UndefinedTangent: return GetStatusMessage(CalcStatus::UndefinedTangent);
+        case FunctionError::FactorialTooLarge: return "Factorial too large to compute";
+    }
+    return "Unknown error";
+}
+
+double TryApplyFunction(Calculator& calculator, MathFunction function, double argValue, bool inDegrees,
+                        FunctionError& error) {
+    return functionTable[static_cast<size_t>(function)].apply(calculator, argValue, inDegrees, error);
+}
+
+double ApplyFunction(Calculator& calculator, MathFunction function, double argValue, bool inDegrees) {
+    FunctionError error = FunctionError::None;
+    double result = TryApplyFunction(calculator, function, argValue, inDegrees, error);
+    if (error != FunctionError::None) {
+        throw std::runtime_error(GetFunctionErrorMessage(function, error));
+    }
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <cstddef>
+#include <string>
+#include "calculator.h"
+
+enum class MathFunction : unsigned char {
+    Sin, Cos, Tan, Asin, Acos, Atan,
+    Sinh, Cosh, Tanh, Sqrt, Log, Ln,
+    Abs, Fact
+};
+
+const size_t mathFunctionCount = 14;
+
+// Why a function rejected its argument. Domain covers the checks listed
+// in a function's domainMessage; the other two come from tan and fact.
+enum class FunctionError : unsigned char {
+    None,
+    Domain,
+    UndefinedTangent,
+    FactorialTooLarge
+};
+
+// Everything the evaluator knows about a function. hasDefault functions
+// may be called with empty parentheses ("sin()" is sin(0)). apply
+// evaluates the function with its domain checks and never throws: a
+// rejected argument sets error and returns NaN.
+struct FunctionInfo {
+    const char* name;
+    size_t length;
+    bool hasDefault;
+    double defaultArgument;
+    const char* domainMessage;
+    double (*apply)(Calculator& calculator, double argValue, bool inDegrees, FunctionError& error);
+};
+
+// The registry is a constant table indexed by MathFunction. Names are
+// resolved once, at parse time, through a compile-time perfect hash, so
+// evaluation only ever indexes the table.
+const FunctionInfo& GetFunctionInfo(MathFunction function);
+const char* GetFunctionName(MathFunction function);
+
+// Resolves an exact function name.
+bool LookupFunction(const char* name, size_t length, MathFunction& function);
+bool IsFunction(const std::string& token);
+
+// Resolves the longest function name that prefixes text ("sinh1" is sinh,
+// "sine" is sin) and returns its length, or 0 when none does.
+size_t MatchFunctionPrefix(const char* text, size_t length, MathFunction& function);
+
+// The message ApplyFunction throws for a rejected argument.
+const char* GetFunctionErrorMessage(MathFunction function, FunctionError error);
+
+// Evaluates without throwing. error is only written when the argument is
+// rejected, so callers set it to None first.
+double TryApplyFunction(Calculator& calculator, MathFunction function, double argValue, bool inDegrees,
+                        FunctionError& error);
+
+// Throws std::runtime_error with GetFunctionErrorMessage's text.
+double ApplyFunction(Calculator& calculator, MathFunction function, double argValue, bool inDegrees = true);
+
+#endif
@@ -0,0 +1,338 @@
+#include "jit.h"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#if !defined(CALC_NO_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define CALC_HAVE_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef CALC_HAVE_JIT
+
+namespace {
+
+// Passed to the generated code, which keeps its fields in callee-saved
+// registers. status receives the CalcStatus or FunctionError of the last
+// call; both are one byte and zero on success.
+struct JitFrame {
+    Calculator* calculator;
+    int32_t inDegrees;
+    unsigned char status;
+    const double* variables;
+};
+
+static_assert(sizeof(CalcStatus) == 1 && sizeof(FunctionError) == 1, "status byte layout");
+static_assert(offsetof(JitFrame, inDegrees) == 8 && offsetof(JitFrame, status) == 12 &&
+              offsetof(JitFrame, variables) == 16, "frame layout");
+
+double JitPower(Calculator* calculator, double base, double exponent, CalcStatus* status) {
+    return calculator->power(base, exponent, *status);
+}
+
+double JitModulo(double a, double b) {
+    return std::fmod(a, b);
+}
+
+// Just enough of an x86-64 encoder for the code below. Registers are
+// fixed: rbx holds the value stack, r12 the variable values, r13 the
+// Calculator, r14d the angle mode flag and r15 the frame's status byte;
+// xmm0-xmm2 are scratch.
+class Assembler {
+public:
+    std::vector<unsigned char> code;
+
+    void bytes(std::initializer_list<unsigned char> values) {
+        code.insert(code.end(), values);
+    }
+
+    void imm32(uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            code.push_back(static_cast<unsigned char>(value >> (8 * i)));
+        }
+    }
+
+    void imm64(uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            code.push_back(static_cast<unsigned char>(value >> (8 * i)));
+        }
+    }
+
+    static uint32_t slot(size_t index) {
+        return static_cast<uint32_t>(8 * index);
+    }
+
+    // SSE2 op xmm, [rbx + 8 * index] (and the store form): F2 0F op /r.
+    void sseMemory(unsigned char op, int xmm, size_t index) {
+        bytes({ 0xF2, 0x0F, op, static_cast<unsigned char>(0x83 | (xmm << 3)) });
+        imm32(slot(index));
+    }
+
+    void loadXmm(int xmm, size_t index) { sseMemory(0x10, xmm, index); }
+    void storeXmm0(size_t index) { sseMemory(0x11, 0, index); }
+
+    // mov rax, [rbx + 8 * index] / mov [rbx + 8 * index], rax
+    void loadRax(size_t index) { bytes({ 0x48, 0x8B, 0x83 }); imm32(slot(index)); }
+    void storeRax(size_t index) { bytes({ 0x48, 0x89, 0x83 }); imm32(slot(index)); }
+
+    // mov rax, [r12 + 8 * index]
+    void loadRaxVariable(size_t index) { bytes({ 0x49, 0x8B, 0x84, 0x24 }); imm32(slot(index)); }
+
+    void moveRaxImmediate(uint64_t value) { bytes({ 0x48, 0xB8 }); imm64(value); }
+    void moveRcxImmediate(uint64_t value) { bytes({ 0x48, 0xB9 }); imm64(value); }
+
+    void callAbsolute(const void* target) {
+        moveRaxImmediate(reinterpret_cast<uint64_t>(target));
+        bytes({ 0xFF, 0xD0 });
+    }
+
+    // Jumps whose 32-bit displacement is patched once the target is known.
+    size_t jumpIf(unsigned char condition) {
+        bytes({ 0x0F, condition });
+        imm32(0);
+        return code.size();
+    }
+
+    size_t jump() {
+        bytes({ 0xE9 });
+        imm32(0);
+        return code.size();
+    }
+
+    void patch(size_t end, size_t target) {
+        uint32_t displacement = static_cast<uint32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(end));
+        std::memcpy(&code[end - 4], &displacement, 4);
+    }
+};
+
+const unsigned char jumpIfEqual = 0x84;
+const unsigned char jumpIfNotEqual = 0x85;
+const unsigned char jumpIfParity = 0x8A;
+
+uint64_t Bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+// Emits the machine code for program and returns the slot holding the
+// result. Failure jumps are collected in failures.
+size_t Generate(const Bytecode& program, Assembler& assembler, std::vector<size_t>& failures) {
+    const std::vector<Instruction>& instructions = program.getInstructions();
+    const std::vector<double>& constants = program.getConstants();
+    size_t sp = program.getTemporaryCount();
+
+    for (const Instruction& instruction : instructions) {
+        switch (instruction.op) {
+            case OpCode::PushConst:
+                assembler.moveRaxImmediate(Bits(constants[instruction.operand]));
+                assembler.storeRax(sp++);
+                break;
+
+            case OpCode::PushModeConst:
+                assembler.moveRaxImmediate(Bits(constants[instruction.operand]));
+                assembler.moveRcxImmediate(Bits(constants[instruction.operand + 1]));
+                assembler.bytes({ 0x45, 0x85, 0xF6 });       // test r14d, r14d
+                assembler.bytes({ 0x48, 0x0F, 0x44, 0xC1 }); // cmovz rax, rcx
+                assembler.storeRax(sp++);
+                break;
+
+            case OpCode::Store:
+                assembler.loadRax(sp - 1);
+                assembler.storeRax(instruction.operand);
+                break;
+
+            case OpCode::Load:
+                assembler.loadRax(instruction.operand);
+                assembler.storeRax(sp++);
+                break;
+
+            case OpCode::LoadVar:
+                assembler.loadRaxVariable(instruction.operand);
+                assembler.storeRax(sp++);
+                break;
+
+            case OpCode::Result:
+                assembler.loadRax(--sp);
+                assembler.storeRax(instruction.operand);
+                break;
+
+            case OpCode::Add:
+            case OpCode::Subtract:
+            case OpCode::Multiply: {
+                sp--;
+                unsigned char op = instruction.op == OpCode::Add ? 0x58 : instruction.op == OpCode::Subtract ? 0x5C : 0x59;
+                assembler.loadXmm(0, sp - 1);
+                assembler.sseMemory(op, 0, sp);
+                assembler.storeXmm0(sp - 1);
+                break;
+            }
+
+            case OpCode::Divide:
+            case OpCode::Modulo: {
+                sp--;
+                assembler.loadXmm(1, sp);
+                assembler.bytes({ 0x66, 0x0F, 0x57, 0xD2 }); // xorpd xmm2, xmm2
+                assembler.bytes({ 0x66, 0x0F, 0x2E, 0xCA }); // ucomisd xmm1, xmm2
+                size_t unordered = assembler.jumpIf(jumpIfParity);
+                failures.push_back(assembler.jumpIf(jumpIfEqual));
+                assembler.patch(unordered, assembler.code.size());
+                assembler.loadXmm(0, sp - 1);
+                if (instruction.op == OpCode::Divide) {
+                    assembler.bytes({ 0xF2, 0x0F, 0x5E, 0xC1 }); // divsd xmm0, xmm1
+                } else {
+                    assembler.callAbsolute(reinterpret_cast<const void*>(&JitModulo));
+                }
+                assembler.storeXmm0(sp - 1);
+                break;
+            }
+
+            case OpCode::Power:
+                sp--;
+                assembler.loadXmm(0, sp - 1);
+                assembler.loadXmm(1, sp);
+                assembler.bytes({ 0x4C, 0x89, 0xEF });       // mov rdi, r13
+                assembler.bytes({ 0x4C, 0x89, 0xFE });       // mov rsi, r15
+                assembler.callAbsolute(reinterpret_cast<const void*>(&JitPower));
+                assembler.bytes({ 0x41, 0x80, 0x3F, 0x00 }); // cmp byte [r15], 0
+                failures.push_back(assembler.jumpIf(jumpIfNotEqual));
+                assembler.storeXmm0(sp - 1);
+                break;
+
+            case OpCode::Call:
+                assembler.bytes({ 0x41, 0xC6, 0x07, 0x00 }); // mov byte [r15], 0
+                assembler.loadXmm(0, sp - 1);
+                assembler.bytes({ 0x4C, 0x89, 0xEF });       // mov rdi, r13
+                assembler.bytes({ 0x44, 0x89, 0xF6 });       // mov esi, r14d
+                assembler.bytes({ 0x4C, 0x89, 0xFA });       // mov rdx, r15
+                assembler.callAbsolute(reinterpret_cast<const void*>(GetFunctionInfo(instruction.function).apply));
+                assembler.bytes({ 0x41, 0x80, 0x3F, 0x00 }); // cmp byte [r15], 0
+                failures.push_back(assembler.jumpIf(jumpIfNotEqual));
+                assembler.storeXmm0(sp - 1);
+                break;
+        }
+    }
+    return sp - 1;
+}
+
+}
+
+bool JitCode::isSupported() {
+    return true;
+}
+
+bool JitCode::compile(const Bytecode& program) {
+    release();
+
+    // int entry(double* stack, JitFrame* frame)
+    Assembler assembler;
+    // Five pushes after the return address leave rsp aligned for calls.
+    assembler.bytes({ 0x53, 0x41, 0x54, 0x41, 0x55 });             // push rbx, r12, r13
+    assembler.bytes({ 0x41, 0x56, 0x41, 0x57 });                   // push r14, r15
+    assembler.bytes({ 0x48, 0x89, 0xFB });                         // mov rbx, rdi
+    assembler.bytes({ 0x4C, 0x8B, 0x66, 0x10 });                   // mov r12, [rsi + 16]
+    assembler.bytes({ 0x4C, 0x8B, 0x2E });                         // mov r13, [rsi]
+    assembler.bytes({ 0x44, 0x8B, 0x76, 0x08 });                   // mov r14d, [rsi + 8]
+    assembler.bytes({ 0x4C, 0x8D, 0x7E, 0x0C });                   // lea r15, [rsi + 12]
+
+    std::vector<size_t> failures;
+    size_t result = program.empty() ? 0 : Generate(program, assembler, failures);
+
+    assembler.bytes({ 0x31, 0xC0 });                               // xor eax, eax
+    size_t epilogue = assembler.code.size();
+    assembler.bytes({ 0x41, 0x5F, 0x41, 0x5E });                   // pop r15, r14
+    assembler.bytes({ 0x41, 0x5D, 0x41, 0x5C, 0x5B });             // pop r13, r12, rbx
+    assembler.bytes({ 0xC3 });                                     // ret
+
+    size_t failure = assembler.code.size();
+    assembler.bytes({ 0xB8 });                                     // mov eax, 1
+    assembler.imm32(1);
+    assembler.patch(assembler.jump(), epilogue);
+    for (size_t jump : failures) {
+        assembler.patch(jump, failure);
+    }
+
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (assembler.code.size() + pageSize - 1) / pageSize * pageSize;
+    void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    std::memcpy(mapped, assembler.code.data(), assembler.code.size());
+    if (mprotect(mapped, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    memory = mapped;
+    memorySize = size;
+    codeSize = assembler.code.size();
+    resultSlot = result;
+    entry = reinterpret_cast<EntryPoint>(mapped);
+    return true;
+}
+
+bool JitCode::tryExecute(const Bytecode& program, EvaluationContext& context, double* stack, double& result,
+                         EvalError& error) const {
+    if (program.empty()) {
+        result = 0.0;
+        return true;
+    }
+
+    JitFrame frame = { &context.getCalculator(), context.inDegrees() ? 1 : 0, 0, context.getVariableValues() };
+    if (entry(stack, &frame) != 0) {
+        return program.tryExecute(context, stack, result, error);
+    }
+    result = stack[resultSlot];
+    return true;
+}
+
+void JitCode::release() {
+    if (memory != NULL) {
+        munmap(memory, memorySize);
+    }
+    entry = NULL;
+    memory = NULL;
+    memorySize = 0;
+    codeSize = 0;
+    resultSlot = 0;
+}
+
+#else
+
+bool JitCode::isSupported() {
+    return false;
+}
+
+bool JitCode::compile(const Bytecode&) {
+    return false;
+}
+
+bool JitCode::tryExecute(const Bytecode& program, EvaluationContext& context, double* stack, double& result,
+                         EvalError& error) const {
+    return program.tryExecute(context, stack, result, error);
+}
+
+void JitCode::release() {
+}
+
+#endif
+
+JitCode::JitCode() : entry(NULL), memory(NULL), memorySize(0), codeSize(0), resultSlot(0) {
+}
+
+JitCode::~JitCode() {
+    release();
+}
+
+bool JitCode::isCompiled() const {
+    return entry != NULL;
+}
+
+size_t JitCode::getCodeSize() const {
+    return codeSize;
+}
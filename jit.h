@@ -0,0 +1,57 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include "bytecode.h"
+#include "context.h"
+#include "evalerror.h"
+
+// A Bytecode program compiled to x86-64 machine code. Every stack slot's
+// position is known at compile time, so each instruction becomes a few
+// scalar SSE2 instructions on fixed stack addresses, with no dispatch.
+// Functions and '^' call the same routines the interpreter does (each
+// FunctionInfo::apply, Calculator::power and fmod) through direct calls,
+// so results are bit-for-bit those of Bytecode::tryExecute.
+//
+// The machine code only detects that an instruction failed; tryExecute
+// then reruns the interpreter to describe the error, which costs nothing
+// on the success path.
+//
+// compile() fails, and the caller keeps interpreting, on anything other
+// than x86-64 with the System V calling convention (Linux, macOS, BSD),
+// when executable memory cannot be mapped, or when the build defines
+// CALC_NO_JIT (cmake -DCALC_ENABLE_JIT=OFF).
+class JitCode {
+public:
+    JitCode();
+    ~JitCode();
+
+    static bool isSupported();
+
+    // Compiles program; its constants are copied into the code. Returns
+    // false, leaving nothing compiled, when native code is unavailable.
+    bool compile(const Bytecode& program);
+    bool isCompiled() const;
+    size_t getCodeSize() const;
+
+    // Same contract as Bytecode::tryExecute. program is the one compiled
+    // (or an identical copy); it is only run to describe an error.
+    bool tryExecute(const Bytecode& program, EvaluationContext& context, double* stack, double& result,
+                    EvalError& error) const;
+
+private:
+    typedef int (*EntryPoint)(double* stack, void* frame);
+
+    EntryPoint entry;
+    void* memory;
+    size_t memorySize;
+    size_t codeSize;
+    size_t resultSlot;
+
+    void release();
+
+    JitCode(const JitCode&);
+    JitCode& operator=(const JitCode&);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "lexer.h"
+#include <cctype>
+#include <charconv>
+#include <system_error>
+
+namespace {
+
+bool IsConstantAt(std::string_view input, size_t start, size_t end) {
+    return (end - start == 2 && input.compare(start, 2, "pi") == 0) ||
+           (end - start == 1 && input[start] == 'e');
+}
+
+}
+
+bool IsConstant(const std::string& token) {
+    return token == "pi" || token == "e";
+}
+
+Lexer::Lexer(std::string_view input, const VariableTable* variables) : input(input), variables(variables), pos(0) {
+    scan();
+}
+
+const Token& Lexer::peek() const {
+    return current;
+}
+
+Token Lexer::next() {
+    Token token = current;
+    scan();
+    return token;
+}
+
+void Lexer::setToken(TokenType type, size_t start, size_t end) {
+    current.type = type;
+    current.position = start;
+    current.length = end - start;
+    pos = end;
+}
+
+void Lexer::setError(EvalErrorKind error, size_t start, size_t end) {
+    current.error = error;
+    setToken(TokenType::Error, start, end);
+}
+
+void Lexer::scan() {
+    while (pos < input.length() && input[pos] == ' ') {
+        pos++;
+    }
+
+    if (pos >= input.length()) {
+        setToken(TokenType::End, pos, pos);
+        return;
+    }
+
+    char c = input[pos];
+    switch (c) {
+        case '(':
+            setToken(TokenType::LeftParen, pos, pos + 1);
+            return;
+        case ')':
+            setToken(TokenType::RightParen, pos, pos + 1);
+            return;
+        case '+': case '-': case '*': case '/': case '%': case '^':
+            current.op = c;
+            setToken(TokenType::Operator, pos, pos + 1);
+            return;
+    }
+
+    if (isdigit(static_cast<unsigned char>(c)) || c == '.') {
+        scanNumber(pos);
+        return;
+    }
+
+    if (isalpha(static_cast<unsigned char>(c))) {
+        scanIdentifier(pos);
+        return;
+    }
+
+    setError(EvalErrorKind::UnrecognizedCharacter, pos, pos + 1);
+}
+
+void Lexer::scanNumber(size_t start) {
+    size_t end = start;
+    int decimalPoints = 0;
+
+    while (end < input.length() && (isdigit(static_cast<unsigned char>(input[end])) || input[end] == '.')) {
+        if (input[end] == '.') {
+            decimalPoints++;
+        }
+        end++;
+    }
+
+    if (decimalPoints > 1) {
+        setError(EvalErrorKind::MultipleDecimalPoints, start, end);
+        return;
+    }
+
+    // An 'e' or 'E' is an exponent only when digits (optionally signed)
+    // follow; otherwise it is left to scanIdentifier, so "2e" is still 2
+    // followed by the constant e.
+    if (end < input.length() && (input[end] == 'e' || input[end] == 'E')) {
+        size_t digits = end + 1;
+        if (digits < input.length() && (input[digits] == '+' || input[digits] == '-')) {
+            digits++;
+        }
+        if (digits < input.length() && isdigit(static_cast<unsigned char>(input[digits]))) {
+            end = digits;
+            while (end < input.length() && isdigit(static_cast<unsigned char>(input[end]))) {
+                end++;
+            }
+        }
+    }
+
+    // from_chars parses the literal in place, without a terminated copy,
+    // and ignores the locale, so '.' is the decimal point everywhere.
+    const char* first = input.data() + start;
+    const char* last = input.data() + end;
+    std::from_chars_result parsed = std::from_chars(first, last, current.value);
+    if (parsed.ec != std::errc() || parsed.ptr != last) {
+        setError(EvalErrorKind::InvalidNumber, start, end);
+        return;
+    }
+
+    setToken(TokenType::Number, start, end);
+}
+
+void Lexer::scanIdentifier(size_t start) {
+    size_t end = start;
+    while (end < input.length() && isalpha(static_cast<unsigned char>(input[end]))) {
+        end++;
+    }
+
+    // Digits and '_' continue a variable name, so "e2" and "e_rate" are
+    // not the constant e.
+    bool followedByNameCharacter = end < input.length() &&
+                           (isdigit(static_cast<unsigned char>(input[end])) || input[end] == '_');
+
+    if (!followedByNameCharacter && IsConstantAt(input, start, end)) {
+        static Calculator calculator;
+        current.value = end - start == 2 ? calculator.getPi() : calculator.getE();
+        setToken(TokenType::Number, start, end);
+        return;
+    }
+
+    // A defined variable takes the whole name, before any split into a
+    // function and its argument.
+    size_t identifierEnd = end;
+    while (identifierEnd < input.length() &&
+           (isalnum(static_cast<unsigned char>(input[identifierEnd])) || input[identifierEnd] == '_')) {
+        identifierEnd++;
+    }
+    if (variables != NULL) {
+        current.slot = variables->find(input.data() + start, identifierEnd - start);
+        if (current.slot != VariableTable::notFound) {
+            setToken(TokenType::Variable, start, identifierEnd);
+            return;
+        }
+    }
+
+    // The longest function name that prefixes the identifier wins, so
+    // "sinh1" is sinh(1) and "sine" is sin(e).
+    MathFunction function;
+    size_t nameLength = MatchFunctionPrefix(input.data() + start, end - start, function);
+
+    if (nameLength != 0) {
+        size_t nameEnd = start + nameLength;
+        current.function = function;
+
+        if (nameEnd == end && end < input.length() && input[end] == '(') {
+            setToken(TokenType::Call, start, end + 1);
+            return;
+        }
+
+        bool numberFollows = nameEnd == end && end < input.length() &&
+                             (isdigit(static_cast<unsigned char>(input[end])) || input[end] == '.');
+        bool constantFollows = nameEnd < end && !followedByNameCharacter &&
+                               IsConstantAt(input, nameEnd, end);
+        if (numberFollows || constantFollows) {
+            setToken(TokenType::ImplicitCall, start, nameEnd);
+            return;
+        }
+    }
+
+    setError(EvalErrorKind::UnknownIdentifier, start, identifierEnd);
+}
@@ -0,0 +1,68 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include "bytecode.h"
+#include "evalerror.h"
+#include "variables.h"
+
+enum class TokenType {
+    Number,
+    Operator,
+    LeftParen,
+    RightParen,
+    Call,
+    ImplicitCall,
+    Variable,
+    End,
+    Error
+};
+
+// Call covers a function name and its '(' ("sin("). ImplicitCall covers a
+// function name written without parentheses; its argument is the next
+// token ("sin30" lexes as ImplicitCall(sin), Number(30)). Numbers may
+// carry an exponent ("1.5e-3"); constants are returned as Number tokens.
+// A malformed lexeme is returned as an Error token spanning it, with the
+// reason in error. A Variable token carries the slot its name has in the
+// lexer's VariableTable.
+struct Token {
+    TokenType type;
+    size_t position;
+    size_t length;
+    double value;
+    char op;
+    MathFunction function;
+    EvalErrorKind error;
+    unsigned int slot;
+};
+
+// Scans an expression exactly once, producing tokens on demand. The input
+// is a view of the caller's text, which must outlive the lexer; it is
+// never copied or modified, and nothing throws: malformed lexemes
+// become Error tokens as they are reached. Names are resolved against
+// variables when given; otherwise every unknown name is an error.
+class Lexer {
+public:
+    explicit Lexer(std::string_view input, const VariableTable* variables = NULL);
+
+    const Token& peek() const;
+    Token next();
+
+private:
+    std::string_view input;
+    const VariableTable* variables;
+    size_t pos;
+    Token current;
+
+    void scan();
+    void scanNumber(size_t start);
+    void scanIdentifier(size_t start);
+    void setToken(TokenType type, size_t start, size_t end);
+    void setError(EvalErrorKind error, size_t start, size_t end);
+};
+
+bool IsConstant(const std::string& token);
+
+#endif
@@ -0,0 +1,241 @@
+#include "lineio.h"
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+LineReader::LineReader(FILE* file, size_t bufferSize)
+    : file(file), buffer(bufferSize), begin(0), end(0), eof(false) {
+}
+
+bool LineReader::fill() {
+    if (eof) {
+        return false;
+    }
+
+    if (begin > 0) {
+        std::memmove(buffer.data(), buffer.data() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+    }
+
+    if (end == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    size_t bytesRead = std::fread(buffer.data() + end, 1, buffer.size() - end, file);
+    if (bytesRead == 0) {
+        eof = true;
+        return false;
+    }
+
+    end += bytesRead;
+    return true;
+}
+
+bool LineReader::next(const char*& line, size_t& length) {
+    size_t searchFrom = begin;
+
+    for (;;) {
+        const char* start = buffer.data() + searchFrom;
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - searchFrom));
+
+        if (newline != NULL) {
+            line = buffer.data() + begin;
+            length = static_cast<size_t>(newline - line);
+            begin += length + 1;
+            break;
+        }
+
+        size_t scanned = end - begin;
+        if (!fill()) {
+            if (begin == end) {
+                return false;
+            }
+            line = buffer.data() + begin;
+            length = end - begin;
+            begin = end;
+            break;
+        }
+        searchFrom = begin + scanned;
+    }
+
+    if (length > 0 && line[length - 1] == '\r') {
+        length--;
+    }
+    return true;
+}
+
+bool LineReader::nextBlock(const char*& data, size_t& length) {
+    for (;;) {
+        while (end < buffer.size() && fill()) {
+        }
+
+        if (begin == end) {
+            return false;
+        }
+
+        const char* first = buffer.data() + begin;
+        const char* last = buffer.data() + end;
+        while (last != first && last[-1] != '\n') {
+            last--;
+        }
+
+        if (last != first || eof) {
+            data = first;
+            length = static_cast<size_t>((last != first ? last : buffer.data() + end) - first);
+            begin += length;
+            return true;
+        }
+
+        // A single line longer than the buffer; fill() grows it.
+        fill();
+    }
+}
+
+MappedFile::MappedFile(size_t blockSize)
+    : mapping(NULL), mappingSize(0), blockSize(blockSize), offset(0), released(0), opened(false) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::isOpen() const {
+    return opened;
+}
+
+size_t MappedFile::size() const {
+    return mappingSize;
+}
+
+bool MappedFile::nextBlock(const char*& data, size_t& length) {
+    release(offset);
+    if (offset >= mappingSize) {
+        return false;
+    }
+
+    size_t end = mappingSize;
+    if (mappingSize - offset > blockSize) {
+        const char* newline = static_cast<const char*>(
+            std::memchr(mapping + offset + blockSize, '\n', mappingSize - offset - blockSize));
+        if (newline != NULL) {
+            end = newline + 1 - mapping;
+        }
+    }
+
+    data = mapping + offset;
+    length = end - offset;
+    offset = end;
+    return true;
+}
+
+#ifdef CALC_HAVE_MMAP
+
+bool MappedFile::open(const char* path) {
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(status.st_size);
+    void* mapped = NULL;
+    if (size != 0) {
+        mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    mapping = static_cast<const char*>(mapped);
+    mappingSize = size;
+    opened = true;
+    return true;
+}
+
+void MappedFile::close() {
+    if (mapping != NULL) {
+        munmap(const_cast<char*>(mapping), mappingSize);
+    }
+    mapping = NULL;
+    mappingSize = 0;
+    offset = 0;
+    released = 0;
+    opened = false;
+}
+
+// Clean file pages cost nothing to drop: touching them again would just
+// read them back from the page cache.
+void MappedFile::release(size_t end) {
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t stop = end / pageSize * pageSize;
+    if (stop > released) {
+        madvise(const_cast<char*>(mapping) + released, stop - released, MADV_DONTNEED);
+        released = stop;
+    }
+}
+
+#else
+
+bool MappedFile::open(const char*) {
+    return false;
+}
+
+void MappedFile::close() {
+}
+
+void MappedFile::release(size_t) {
+}
+
+#endif
+
+OutputBuffer::OutputBuffer(FILE* file, size_t capacity)
+    : file(file), buffer(capacity), used(0) {
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+void OutputBuffer::write(const char* data, size_t length) {
+    if (length > buffer.size() - used) {
+        flush();
+        if (length > buffer.size()) {
+            std::fwrite(data, 1, length, file);
+            return;
+        }
+    }
+
+    std::memcpy(buffer.data() + used, data, length);
+    used += length;
+}
+
+void OutputBuffer::put(char c) {
+    if (used == buffer.size()) {
+        flush();
+    }
+    buffer[used++] = c;
+}
+
+void OutputBuffer::flush() {
+    if (used > 0) {
+        std::fwrite(buffer.data(), 1, used, file);
+        used = 0;
+    }
+    std::fflush(file);
+}
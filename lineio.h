@@ -0,0 +1,83 @@
+#ifndef LINEIO_H
+#define LINEIO_H
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+
+// Reads newline-delimited records from a FILE* in large blocks. The data
+// returned by next() and nextBlock() points into the internal buffer and
+// stays valid until the following call. next() strips a trailing '\r';
+// nextBlock() returns whole lines, newlines included.
+class LineReader {
+public:
+    explicit LineReader(FILE* file, size_t bufferSize = 1 << 20);
+
+    bool next(const char*& line, size_t& length);
+    bool nextBlock(const char*& data, size_t& length);
+
+private:
+    FILE* file;
+    std::vector<char> buffer;
+    size_t begin;
+    size_t end;
+    bool eof;
+
+    bool fill();
+};
+
+// Maps a whole file read-only and hands it out in blocks of whole lines,
+// like LineReader::nextBlock but without copying: blocks point into the
+// mapping and stay valid until the following call. The kernel is told the
+// file is read sequentially, and each block's pages are dropped from the
+// process when the next one is requested, so resident memory stays at
+// about one block however large the file is. open() fails, and callers
+// fall back to LineReader, for anything but a regular file and where
+// memory mapping is unavailable.
+class MappedFile {
+public:
+    explicit MappedFile(size_t blockSize = 8 << 20);
+    ~MappedFile();
+
+    bool open(const char* path);
+    bool isOpen() const;
+    size_t size() const;
+
+    bool nextBlock(const char*& data, size_t& length);
+
+private:
+    const char* mapping;
+    size_t mappingSize;
+    size_t blockSize;
+    size_t offset;
+    size_t released;
+    bool opened;
+
+    void close();
+    void release(size_t end);
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+// Collects output in a large block and writes it with a single fwrite when
+// the block fills up, on flush() and on destruction.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(FILE* file, size_t capacity = 1 << 20);
+    ~OutputBuffer();
+
+    void write(const char* data, size_t length);
+    void put(char c);
+    void flush();
+
+private:
+    FILE* file;
+    std::vector<char> buffer;
+    size_t used;
+
+    OutputBuffer(const OutputBuffer&);
+    OutputBuffer& operator=(const OutputBuffer&);
+};
+
+#endif
@@ -7,14 +7,14 @@
 #include <memory>
 #include <codecvt>
 #include <locale>
-#include <stack>
 #include <cctype>
 #include <cmath>
 #include <algorithm>
 #include "calculator.h"
-#include <fstream>
-#include <iomanip>
-#include <ctime>
+#include "expression.h"
+#include "debuglog.h"
+#include "numberformat.h"
+#include "resultcache.h"
 
 #ifndef EM_SETBKGNDCOLOR
 #define EM_SETBKGNDCOLOR (WM_USER + 67)
@@ -114,57 +114,6 @@ ThemeColors* currentTheme = &availableThemes[currentThemeIndex];
 HBRUSH themeBackgroundBrush = NULL;
 HBRUSH buttonBrushes[10] = {NULL};
 
-std::ofstream debugLogFile;
-
-void initDebugLog() {
-    debugLogFile.open("calculator_debug.log", std::ios::out | std::ios::trunc);
-    
-    time_t now = time(0);
-    char timeStr[26];
-    ctime_s(timeStr, sizeof(timeStr), &now);
-    
-    debugLogFile << "------------------------------------------------------------------------------" << std::endl;
-    debugLogFile << "Calculator Debug Log - Started: " << timeStr;
-    debugLogFile << "------------------------------------------------------------------------------" << std::endl;
-    debugLogFile << "Build version: " << __DATE__ << " " << __TIME__ << std::endl;
-    debugLogFile << std::endl;
-    
-    debugLogFile << std::fixed << std::setprecision(6);
-    
-    debugLogFile.flush();
-}
-
-void closeDebugLog() {
-    if (debugLogFile.is_open()) {
-        time_t now = time(0);
-        char timeStr[26];
-        ctime_s(timeStr, sizeof(timeStr), &now);
-        
-        debugLogFile << std::endl;
-        debugLogFile << "------------------------------------------------------------------------------" << std::endl;
-        debugLogFile << "Calculator Debug Log - Ended: " << timeStr;
-        debugLogFile << "------------------------------------------------------------------------------" << std::endl;
-        
-        debugLogFile.close();
-    }
-}
-
-void logDebug(const std::string& message, const std::string& category = "INFO") {
-    if (debugLogFile.is_open()) {
-        SYSTEMTIME st;
-        GetLocalTime(&st);
-        
-        debugLogFile << "[" 
-                   << std::setw(2) << std::setfill('0') << st.wHour << ":"
-                   << std::setw(2) << std::setfill('0') << st.wMinute << ":" 
-                   << std::setw(2) << std::setfill('0') << st.wSecond << "." 
-                   << std::setw(3) << std::setfill('0') << st.wMilliseconds << "] "
-                   << "[" << category << "] " << message << std::endl;
-        
-        debugLogFile.flush();
-    }
-}
-
 std::wstring StringToWString(const std::string& str) {
     std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter;
     return converter.from_bytes(str);
@@ -183,7 +132,10 @@ HWND hWndButtons[45];
 HFONT hDisplayFont = NULL;
 HFONT hHistoryFont = NULL;
 HFONT hButtonFonts[45] = { NULL };
-Calculator calculator;
+DebugLogSink debugLogSink;
+// M+ and M- re-evaluate the expression that was usually just calculated.
+ResultCache resultCache(256, 1);
+EvaluationContext evaluationContext(AngleMode::Degrees, &debugLogSink);
 std::string currentExpression = "0";
 std::string previousExpression = "0";
 bool newExpression = true;
@@ -214,8 +166,6 @@ void MemorySubtract();
 void MemoryRecall();
 void MemoryClear();
 bool IsOperator(char c);
-int GetPrecedence(char op);
-double ApplyOperator(double a, double b, char op);
 double EvaluateExpression(const std::string& expression);
 void SwitchTheme();
 void ApplyTheme(HWND hwnd);
@@ -223,8 +173,9 @@ void CleanupResources();
 std::string FormatExpressionWithPrecedence(const std::string& expr);
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow) {
-    initDebugLog();
-    logDebug("Application started", "MAIN");
+    DebugLog::open("calculator_debug.log");
+    evaluationContext.setResultCache(&resultCache);
+    LOG_INFO("MAIN", "Application started");
     
     const wchar_t CLASS_NAME[] = L"CalculatorWindowClass";
     
@@ -280,8 +231,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         DispatchMessage(&msg);
     }
     
-    logDebug("Application ending", "MAIN");
-    closeDebugLog();
+    LOG_INFO("MAIN", "Application ending");
+    DebugLog::close();
     return 0;
 }
 
@@ -444,8 +395,7 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         case WM_COMMAND: {
             int buttonId = LOWORD(wParam);
             
-            std::string debugMsg = "WM_COMMAND received, buttonId: " + std::to_string(buttonId);
-            logDebug(debugMsg, "UI");
+            LOG_DEBUG("UI", "WM_COMMAND received, buttonId: " + std::to_string(buttonId));
             
             if (buttonId >= 1000 && buttonId <= 1050) {
                 HWND buttonHwnd = (HWND)lParam;
@@ -453,23 +403,22 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
                 GetWindowTextW(buttonHwnd, buttonText, 50);
                 
                 std::string narrowBtnText = WStringToString(buttonText);
-                std::string btnClickMsg = "Button clicked in WindowProc: " + narrowBtnText;
-                logDebug(btnClickMsg, "UI");
+                LOG_DEBUG("UI", "Button clicked in WindowProc: " + narrowBtnText);
                 
                 if (wcscmp(buttonText, L"THEME") == 0) {
-                    logDebug("Theme button detected in WindowProc", "UI");
+                    LOG_DEBUG("UI", "Theme button detected in WindowProc");
                     SwitchTheme();
                     RedrawWindow(hwnd, NULL, NULL, RDW_INVALIDATE);
                     return 0;
                 }
                 
                 if (wcscmp(buttonText, L"UNDO") == 0) {
-                    logDebug("UNDO button detected in WindowProc", "UI");
+                    LOG_DEBUG("UI", "UNDO button detected in WindowProc");
                     HandleButtonClick(buttonText);
                     return 0;
                 }
                 
-                logDebug("Regular button detected in WindowProc", "UI");
+                LOG_DEBUG("UI", "Regular button detected in WindowProc");
                 HandleButtonClick(buttonText);
             }
             break;
@@ -580,9 +529,9 @@ LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
         }
         
         case WM_DESTROY:
-            logDebug("WM_DESTROY received, closing application", "MAIN");
+            LOG_INFO("MAIN", "WM_DESTROY received, closing application");
             CleanupResources();
-            closeDebugLog();
+            DebugLog::close();
             PostQuitMessage(0);
             return 0;
             
@@ -710,12 +659,10 @@ void CreateCalculatorUI(HWND hwnd) {
 
 void HandleButtonClick(const wchar_t* buttonText) {
     std::string narrowBtnText = WStringToString(buttonText);
-    std::string debugMsg = "HandleButtonClick called with button: " + narrowBtnText;
     
     if (wcscmp(buttonText, L"=") == 0) {
-        logDebug("Equals button detected, calling CalculateExpression()", "CALC");
-        std::string debugExpr = "Current expression before calculation: " + currentExpression;
-        logDebug(debugExpr, "CALC");
+        LOG_DEBUG("CALC", "Equals button detected, calling CalculateExpression()");
+        LOG_DEBUG("CALC", "Current expression before calculation: " + currentExpression);
         CalculateExpression();
         return;
     }
@@ -796,7 +743,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
         wcscmp(buttonText, L"tanh") == 0 || wcscmp(buttonText, L"abs") == 0 ||
         wcscmp(buttonText, L"fact") == 0) {
         
-        logDebug("Function button clicked: " + narrowBtnText, "UI");
+        LOG_DEBUG("UI", "Function button clicked: " + narrowBtnText);
         
         if (newExpression || currentExpression == "0") {
             currentExpression = narrowBtnText + "(";
@@ -816,7 +763,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
             if (c == ')') closeCount++;
         }
         if (openCount > closeCount) {
-            logDebug("Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses", "UI");
+            LOG_DEBUG("UI", "Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses");
         }
         
         UpdateDisplay(currentExpression);
@@ -824,7 +771,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
     }
     
     if (wcscmp(buttonText, L"sqrt") == 0) {
-        logDebug("Square root function clicked: sqrt", "UI");
+        LOG_DEBUG("UI", "Square root function clicked: sqrt");
         
         if (newExpression || currentExpression == "0") {
             currentExpression = "sqrt(";
@@ -844,7 +791,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
             if (c == ')') closeCount++;
         }
         if (openCount > closeCount) {
-            logDebug("Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses", "UI");
+            LOG_DEBUG("UI", "Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses");
         }
         
         UpdateDisplay(currentExpression);
@@ -854,10 +801,9 @@ void HandleButtonClick(const wchar_t* buttonText) {
     if (wcscmp(buttonText, L"DEL") == 0) {
         if (currentExpression.length() > 0 && !newExpression && currentExpression != "0") {
             previousExpression = currentExpression;
-            logDebug("Saved expression for undo: " + previousExpression, "UI");
+            LOG_DEBUG("UI", "Saved expression for undo: " + previousExpression);
             
-            std::string debugMsg = "DEL button pressed, current expression: " + currentExpression;
-            logDebug(debugMsg, "UI");
+            LOG_DEBUG("UI", "DEL button pressed, current expression: " + currentExpression);
             
             std::vector<std::string> functions = {"sin", "cos", "tan", "asin", "acos", "atan", 
                                                 "sinh", "cosh", "tanh", "sqrt", "log", "ln",
@@ -869,7 +815,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
                     currentExpression.substr(currentExpression.length() - (func.length() + 1)) == func + "(") {
                     currentExpression.erase(currentExpression.length() - (func.length() + 1));
                     deletedFunction = true;
-                    logDebug("Deleted function: " + func + "(", "UI");
+                    LOG_DEBUG("UI", "Deleted function: " + func + "(");
                     break;
                 }
             }
@@ -877,13 +823,13 @@ void HandleButtonClick(const wchar_t* buttonText) {
             if (!deletedFunction) {
                 if (currentExpression.length() >= 2 && currentExpression.substr(currentExpression.length() - 2) == "pi") {
                     currentExpression.erase(currentExpression.length() - 2);
-                    logDebug("Deleted constant: pi", "UI");
+                    LOG_DEBUG("UI", "Deleted constant: pi");
                 } else if (currentExpression.length() >= 1 && currentExpression.back() == 'e') {
                     currentExpression.pop_back();
-                    logDebug("Deleted constant: e", "UI");
+                    LOG_DEBUG("UI", "Deleted constant: e");
                 } else {
                     currentExpression.pop_back();
-                    logDebug("Deleted single character", "UI");
+                    LOG_DEBUG("UI", "Deleted single character");
                 }
             }
             
@@ -901,7 +847,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
             currentExpression = previousExpression;
             previousExpression = temp;
             
-            logDebug("Undo performed, restored: " + currentExpression, "UI");
+            LOG_DEBUG("UI", "Undo performed, restored: " + currentExpression);
             UpdateDisplay(currentExpression);
         }
         return;
@@ -964,7 +910,7 @@ void HandleButtonClick(const wchar_t* buttonText) {
             funcName = "log";
         }
         
-        logDebug("Logarithm function clicked: " + funcName, "UI");
+        LOG_DEBUG("UI", "Logarithm function clicked: " + funcName);
         
         if (newExpression || currentExpression == "0") {
             currentExpression = funcName + "(";
@@ -984,18 +930,18 @@ void HandleButtonClick(const wchar_t* buttonText) {
             if (c == ')') closeCount++;
         }
         if (openCount > closeCount) {
-            logDebug("Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses", "UI");
+            LOG_DEBUG("UI", "Detected " + std::to_string(openCount - closeCount) + " unclosed parentheses");
         }
         
         UpdateDisplay(currentExpression);
     }
     else if (wcscmp(buttonText, L"Theme") == 0) {
-        logDebug("Theme button clicked, switching theme", "UI");
+        LOG_DEBUG("UI", "Theme button clicked, switching theme");
         SwitchTheme();
         ApplyTheme(hWndMain);
     }
     else if (wcscmp(buttonText, L"About") == 0) {
-        logDebug("About button clicked, showing dialog", "UI");
+        LOG_DEBUG("UI", "About button clicked, showing dialog");
         ShowAboutDialog(hWndMain);
     }
     else if (wcscmp(buttonText, L"C") == 0) {
@@ -1122,20 +1068,11 @@ void MemorySubtract() {
 void MemoryRecall() {
     if (memoryUsed) {
         if (newExpression) {
-            currentExpression = std::to_string(memoryValue);
-            currentExpression.erase(currentExpression.find_last_not_of('0') + 1, std::string::npos);
-            if (currentExpression.back() == '.') {
-                currentExpression.pop_back();
-            }
+            currentExpression = NumberToString(memoryValue, displayDigits);
             newExpression = false;
         } else {
             if (IsOperator(currentExpression.back())) {
-                std::string memStr = std::to_string(memoryValue);
-                memStr.erase(memStr.find_last_not_of('0') + 1, std::string::npos);
-                if (memStr.back() == '.') {
-                    memStr.pop_back();
-                }
-                currentExpression += memStr;
+                AppendNumber(currentExpression, memoryValue, displayDigits);
             }
         }
         UpdateDisplay(currentExpression);
@@ -1149,28 +1086,23 @@ void MemoryClear() {
 }
 
 void CalculateExpression() {
-    logDebug("CalculateExpression() called", "CALC");
+    LOG_DEBUG("CALC", "CalculateExpression() called");
     
     if (currentExpression.empty() || currentExpression == "0") {
-        logDebug("Expression is empty or just '0', returning without calculation", "CALC");
+        LOG_DEBUG("CALC", "Expression is empty or just '0', returning without calculation");
         return;
     }
     
     char lastChar = currentExpression.back();
-    std::string debugMsg = "Last character of expression: " + std::string(1, lastChar);
-    logDebug(debugMsg, "CALC");
+    LOG_DEBUG("CALC", "Last character of expression: " + std::string(1, lastChar));
     
     if (lastChar == '%') {
-        logDebug("Processing percentage calculation", "CALC");
+        LOG_DEBUG("CALC", "Processing percentage calculation");
         currentExpression = currentExpression.substr(0, currentExpression.length() - 1);
         double value = EvaluateExpression(currentExpression);
         value = value / 100.0;
         
-        std::string resultStr = std::to_string(value);
-        resultStr.erase(resultStr.find_last_not_of('0') + 1, std::string::npos);
-        if (resultStr.back() == '.') {
-            resultStr.pop_back();
-        }
+        std::string resultStr = NumberToString(value, displayDigits);
         
         std::string historyEntry = currentExpression + "% = " + resultStr;
         calculationHistory.push_back(historyEntry);
@@ -1182,11 +1114,11 @@ void CalculateExpression() {
     }
     
     if (lastChar == '+' || lastChar == '-' || lastChar == '*' || lastChar == '/') {
-        logDebug("Not calculating due to ending with operator", "CALC");
+        LOG_DEBUG("CALC", "Not calculating due to ending with operator");
         return;
     }
     
-    logDebug("Checking for matching parentheses", "CALC");
+    LOG_DEBUG("CALC", "Checking for matching parentheses");
     int openCount = 0, closeCount = 0;
     for (char c : currentExpression) {
         if (c == '(') openCount++;
@@ -1197,28 +1129,25 @@ void CalculateExpression() {
     
     int addedClosingParenthesis = 0;
     if (openCount > closeCount) {
-        logDebug("Adding missing closing parentheses", "CALC");
+        LOG_DEBUG("CALC", "Adding missing closing parentheses");
         addedClosingParenthesis = openCount - closeCount;
         for (int i = 0; i < addedClosingParenthesis; i++) {
             currentExpression += ")";
         }
         UpdateDisplay(currentExpression);
         
-        std::string noteMsg = std::to_string(addedClosingParenthesis) + 
-                             " closing parentheses were added to " + originalExpr;
-        logDebug(noteMsg, "CALC");
+        LOG_DEBUG("CALC", std::to_string(addedClosingParenthesis) +
+                          " closing parentheses were added to " + originalExpr);
         
         originalExpr = currentExpression;
     }
     
-    debugMsg = "Starting evaluation of expression: " + originalExpr;
-    logDebug(debugMsg, "CALC");
+    LOG_DEBUG("CALC", "Starting evaluation of expression: " + originalExpr);
     
     double result;
     try {
         result = EvaluateExpression(currentExpression);
-        std::string resultMsg = "Result: " + std::to_string(result) + " (from expression: " + originalExpr + ")";
-        logDebug(resultMsg, "CALC");
+        LOG_DEBUG("CALC", "Result: " + NumberToString(result) + " (from expression: " + originalExpr + ")");
         
         std::string displayExpression = originalExpr;
         size_t pos = 0;
@@ -1226,11 +1155,7 @@ void CalculateExpression() {
             displayExpression.replace(pos, 1, "x");
         }
         
-        std::string resultStr = std::to_string(result);
-        resultStr.erase(resultStr.find_last_not_of('0') + 1, std::string::npos);
-        if (resultStr.back() == '.') {
-            resultStr.pop_back();
-        }
+        std::string resultStr = NumberToString(result, displayDigits);
         
         std::string historyEntry = displayExpression + " = " + resultStr;
         calculationHistory.push_back(historyEntry);
@@ -1243,13 +1168,12 @@ void CalculateExpression() {
         
         currentExpression = resultStr;
         
-        logDebug("Updating display with result", "CALC");
+        LOG_DEBUG("CALC", "Updating display with result");
         UpdateDisplay(currentExpression);
         newExpression = true;
         
     } catch (const std::exception& e) {
-        std::string errorMsg = "Error during calculation: " + std::string(e.what());
-        logDebug(errorMsg, "ERROR");
+        LOG_ERROR("ERROR", "Error during calculation: " + std::string(e.what()));
         
         calculationHistory.push_back(originalExpr + " = Error: " + e.what());
         
@@ -1277,8 +1201,7 @@ void CalculateExpression() {
         UpdateDisplay(currentExpression);
         newExpression = false;
     } catch (...) {
-        std::string errorMsg = "Unknown error during calculation";
-        logDebug(errorMsg, "ERROR");
+        LOG_ERROR("ERROR", "Unknown error during calculation");
         
         calculationHistory.push_back(originalExpr + " = Error: Unknown error");
         
@@ -1298,7 +1221,7 @@ void ClearCalculator() {
 }
 
 void ShowAboutDialog(HWND hwnd) {
-    logDebug("About dialog shown", "UI");
+    LOG_DEBUG("UI", "About dialog shown");
     
     MessageBoxW(hwnd,
         L"C++ Calculator\n\n"
@@ -1335,507 +1258,8 @@ bool IsOperator(char c) {
     return c == '+' || c == '-' || c == '*' || c == 'x' || c == '/' || c == '^' || c == '%';
 }
 
-int GetPrecedence(char op) {
-    if (op == '+' || op == '-')
-        return 1;
-    if (op == '*' || op == '/')
-        return 2;
-    if (op == '^')
-        return 3;
-    if (op == '%')
-        return 2;  // Give % same precedence as multiplication
-    return 0;  // Default case for any other operator
-}
-
-double ApplyOperator(double a, double b, char op) {
-    switch (op) {
-        case '+': return a + b;
-        case '-': return a - b;
-        case '*': 
-            return a * b;
-        case '/': 
-            if (b == 0) throw std::runtime_error("Division by zero");
-            return a / b;
-        case '%':
-            if (b == 0) throw std::runtime_error("Modulo by zero");
-            return std::fmod(a, b);
-        case '^': 
-            try {
-                return calculator.power(a, b);
-            } catch (const std::exception& e) {
-                throw std::runtime_error(std::string("Power error: ") + e.what());
-            }
-        default: throw std::runtime_error("Unknown operator: " + std::string(1, op));
-    }
-}
-
-bool IsFunction(const std::string& token) {
-    static const std::vector<std::string> functions = {
-        "sin", "cos", "tan", "asin", "acos", "atan",
-        "sinh", "cosh", "tanh", "sqrt", "log", "ln",
-        "abs", "fact"
-    };
-    
-    return std::find(functions.begin(), functions.end(), token) != functions.end();
-}
-
-bool IsConstant(const std::string& token) {
-    return token == "pi" || token == "e";
-}
-
-double GetConstantValue(const std::string& token) {
-    if (token == "pi") return calculator.getPi();
-    if (token == "e") return calculator.getE();
-    throw std::invalid_argument("Unknown constant: " + token);
-}
-
-double ParseFunction(const std::string& func, const std::string& expr, size_t& i) {
-    logDebug("ParseFunction called with function: " + func + ", expr: " + expr + ", i: " + std::to_string(i), "CALC");
-    
-    size_t funcPos = expr.find(func, i > func.length() ? i - func.length() : 0);
-    if (funcPos == std::string::npos) {
-        funcPos = expr.find(func);
-    }
-    
-    if (funcPos == std::string::npos) {
-        std::string errorMsg = "Function " + func + " not found in expression " + expr;
-        logDebug(errorMsg, "ERROR");
-        throw std::runtime_error("Function not found in expression");
-    }
-    
-    size_t openParenPos = funcPos + func.length();
-    
-    if (openParenPos >= expr.length() || expr[openParenPos] != '(') {
-        std::string errorMsg = "Missing opening parenthesis after function " + func;
-        logDebug(errorMsg, "ERROR");
-        
-        if (openParenPos < expr.length() && 
-            (isdigit(expr[openParenPos]) || expr[openParenPos] == '.' || 
-             expr[openParenPos] == 'p' || expr[openParenPos] == 'e')) {
-            
-            std::string correctedExpr = expr.substr(0, openParenPos) + "(" + expr.substr(openParenPos);
-            
-            size_t closePos = openParenPos + 1;
-            while (closePos < correctedExpr.length() && 
-                  (isdigit(correctedExpr[closePos]) || correctedExpr[closePos] == '.' || 
-                   correctedExpr[closePos] == 'e' || correctedExpr[closePos] == 'E' ||
-                   correctedExpr[closePos] == 'p' || correctedExpr[closePos] == 'i')) {
-                closePos++;
-            }
-            
-            correctedExpr.insert(closePos, ")");
-            
-            logDebug("Auto-corrected function call: " + correctedExpr, "CALC");
-            
-            return EvaluateExpression(correctedExpr);
-        }
-        
-        throw std::runtime_error("Missing opening parenthesis after function");
-    }
-    
-    size_t start = openParenPos + 1;
-    size_t pos = start;
-    
-    std::string debugParens = "Parsing function arguments: Start position = " + std::to_string(start) + 
-                            ", Expression length = " + std::to_string(expr.length());
-    logDebug(debugParens, "CALC");
-    
-    int parenCount = 1;
-    while (pos < expr.length() && parenCount > 0) {
-        if (expr[pos] == '(') parenCount++;
-        if (expr[pos] == ')') parenCount--;
-        pos++;
-    }
-    
-    if (parenCount > 0) {
-        std::string errorMsg = "Missing closing parenthesis for function " + func;
-        logDebug(errorMsg, "ERROR");
-        throw std::runtime_error("Missing closing parenthesis for function");
-    }
-    
-    std::string argStr = expr.substr(start, pos - start - 1);
-    
-    std::string debugArgStr = "Extracted argument: " + argStr;
-    logDebug(debugArgStr, "CALC");
-    
-    if (argStr.empty()) {
-        std::string errorMsg = "Function " + func + " requires an argument";
-        logDebug(errorMsg, "ERROR");
-        
-        if (func == "sin" || func == "cos" || func == "tan") {
-            logDebug("Using default value 0 for empty trigonometric function argument", "CALC");
-            argStr = "0";
-        } else if (func == "sqrt") {
-            logDebug("Using default value 0 for empty square root argument", "CALC");
-            argStr = "0";
-        } else if (func == "log" || func == "ln") {
-            logDebug("Using default value 1 for empty logarithm argument", "CALC");
-            argStr = "1";
-        } else if (func == "abs") {
-            logDebug("Using default value 0 for empty absolute value argument", "CALC");
-            argStr = "0";
-        } else if (func == "fact") {
-            logDebug("Using default value 1 for empty factorial argument", "CALC");
-            argStr = "1";
-        } else {
-            throw std::runtime_error("Function " + func + " requires an argument");
-        }
-    }
-    
-    i = pos;
-    
-    double argValue = EvaluateExpression(argStr);
-    
-    double result = 0.0;
-    if (func == "sin") {
-        result = calculator.sine(argValue);
-    } else if (func == "cos") {
-        result = calculator.cosine(argValue);
-    } else if (func == "tan") {
-        result = calculator.tangent(argValue);
-    } else if (func == "asin") {
-        if (argValue < -1.0 || argValue > 1.0) {
-            throw std::runtime_error("Arcsine argument must be between -1 and 1");
-        }
-        result = calculator.arcsine(argValue);
-    } else if (func == "acos") {
-        if (argValue < -1.0 || argValue > 1.0) {
-            throw std::runtime_error("Arccosine argument must be between -1 and 1");
-        }
-        result = calculator.arccosine(argValue);
-    } else if (func == "atan") {
-        result = calculator.arctangent(argValue);
-    } else if (func == "sinh") {
-        result = calculator.sineH(argValue);
-    } else if (func == "cosh") {
-        result = calculator.cosineH(argValue);
-    } else if (func == "tanh") {
-        result = calculator.tangentH(argValue);
-    } else if (func == "sqrt") {
-        if (argValue < 0.0) {
-            throw std::runtime_error("Cannot take square root of negative number");
-        }
-        result = calculator.squareRoot(argValue);
-    } else if (func == "log") {
-        if (argValue <= 0.0) {
-            throw std::runtime_error("Cannot take logarithm of non-positive number");
-        }
-        result = calculator.logarithm(argValue, 10.0);
-    } else if (func == "ln") {
-        if (argValue <= 0.0) {
-            throw std::runtime_error("Cannot take natural logarithm of non-positive number");
-        }
-        result = calculator.naturalLogarithm(argValue);
-    } else if (func == "abs") {
-        result = calculator.absolute(argValue);
-    } else if (func == "fact") {
-        if (argValue < 0 || std::floor(argValue) != argValue) {
-            throw std::runtime_error("Factorial is defined only for non-negative integers");
-        }
-        result = calculator.factorial(argValue);
-    } else {
-        throw std::runtime_error("Unknown function: " + func);
-    }
-    
-    return result;
-}
-
 double EvaluateExpression(const std::string& expression) {
-    std::string debugMsg = "EvaluateExpression called with: " + expression;
-    logDebug(debugMsg, "CALC");
-    
-    std::vector<std::string> functions = {"sin", "cos", "tan", "asin", "acos", "atan", 
-                                        "sinh", "cosh", "tanh", "sqrt", "log", "ln",
-                                        "abs", "fact"};
-    
-    std::string processedExpr = expression;
-    
-    // Special handling for abs with negative numbers: abs(-X) needs special care
-    size_t absPos = 0;
-    while ((absPos = processedExpr.find("abs(", absPos)) != std::string::npos) {
-        size_t argStart = absPos + 4; // position after "abs("
-        if (argStart < processedExpr.length() && processedExpr[argStart] == '-') {
-            // We have abs(-something) - which is a unary minus inside abs
-            // Ensure we have proper expression for this case
-            size_t rightParenPos = argStart;
-            int parenCount = 1;
-            while (rightParenPos < processedExpr.length() && parenCount > 0) {
-                rightParenPos++;
-                if (rightParenPos < processedExpr.length()) {
-                    if (processedExpr[rightParenPos] == '(') parenCount++;
-                    if (processedExpr[rightParenPos] == ')') parenCount--;
-                }
-            }
-            
-            // If we found the closing parenthesis, handle the abs(-X) case specially
-            if (parenCount == 0 && rightParenPos < processedExpr.length()) {
-                std::string argContent = processedExpr.substr(argStart, rightParenPos - argStart);
-                if (argContent.length() > 0 && argContent[0] == '-') {
-                    // Replace abs(-X) with abs(0-X) which parser can handle better
-                    processedExpr = processedExpr.substr(0, argStart) + "0" + 
-                                   processedExpr.substr(argStart);
-                }
-            }
-        }
-        absPos += 4; // Move past "abs("
-    }
-    
-    for (const std::string& func : functions) {
-        size_t pos = 0;
-        while ((pos = processedExpr.find(func, pos)) != std::string::npos) {
-            bool isValidFunction = false;
-            
-            if (pos == 0 || IsOperator(processedExpr[pos-1]) || processedExpr[pos-1] == '(' || 
-                processedExpr[pos-1] == '*' || processedExpr[pos-1] == '/' || 
-                processedExpr[pos-1] == '+' || processedExpr[pos-1] == '-') {
-                isValidFunction = true;
-            }
-            
-            if (isValidFunction) {
-                size_t nextPos = pos + func.length();
-                if (nextPos < processedExpr.length() && processedExpr[nextPos] != '(') {
-                    if (nextPos < processedExpr.length() && 
-                        (isdigit(processedExpr[nextPos]) || processedExpr[nextPos] == '.' || 
-                         processedExpr[nextPos] == 'p' || processedExpr[nextPos] == 'e')) {
-                        
-                        processedExpr.insert(nextPos, "(");
-                        
-                        size_t argEnd = nextPos + 1;
-                        int nestedParens = 0;
-                        
-                        while (argEnd < processedExpr.length()) {
-                            if (processedExpr[argEnd] == '(') {
-                                nestedParens++;
-                            } else if (processedExpr[argEnd] == ')') {
-                                if (nestedParens == 0) break;
-                                nestedParens--;
-                            } else if (nestedParens == 0 && IsOperator(processedExpr[argEnd]) && 
-                                      argEnd > nextPos + 1) {
-                                break;
-                            }
-                            argEnd++;
-                        }
-                        
-                        if (argEnd == processedExpr.length()) {
-                            processedExpr += ")";
-                        } else if (!IsOperator(processedExpr[argEnd]) && processedExpr[argEnd] != ')') {
-                            processedExpr.insert(argEnd + 1, ")");
-                        } else {
-                            processedExpr.insert(argEnd, ")");
-                        }
-                        
-                        std::string fixedExpr = "Auto-fixed function '" + func + "' without parentheses: " + processedExpr;
-                        logDebug(fixedExpr, "CALC");
-                    }
-                }
-            }
-            
-            pos += func.length();
-        }
-    }
-    
-    if (processedExpr != expression) {
-        logDebug("Using modified expression: " + processedExpr, "CALC");
-        return EvaluateExpression(processedExpr);
-    }
-    
-    if (expression.empty()) {
-        logDebug("Expression is empty, returning 0", "CALC");
-        return 0.0;
-    }
-    
-    std::stack<double> values;
-    std::stack<char> operators;
-    std::string currentToken;
-    bool expectingOperand = true;
-    
-    logDebug("Starting to parse expression", "CALC");
-    
-    for (size_t i = 0; i < expression.length(); i++) {
-        if (expression[i] == ' ')
-            continue;
-        
-        if (expression[i] == '-' && expectingOperand) {
-            logDebug("Found unary minus", "CALC");
-            values.push(0.0);
-            operators.push('-');
-            expectingOperand = true;
-            continue;
-        }
-        
-        if (expression[i] == '+' && expectingOperand) {
-            logDebug("Found unary plus, ignoring", "CALC");
-        }
-        
-        if (expression[i] == '(') {
-            operators.push(expression[i]);
-            expectingOperand = true;
-            continue;
-        }
-        
-        if (expression[i] == ')') {
-            if (expectingOperand) {
-                throw std::runtime_error("Invalid expression: empty parentheses or missing operand before ')'");
-            }
-            
-            bool foundMatchingParen = false;
-            
-            while (!operators.empty()) {
-                if (operators.top() == '(') {
-                    foundMatchingParen = true;
-                    break;
-                }
-                
-                char op = operators.top(); operators.pop();
-                
-                if (values.size() < 2) {
-                    throw std::runtime_error("Invalid expression: not enough operands for operator '" + std::string(1, op) + "'");
-                }
-                
-                double val2 = values.top(); values.pop();
-                double val1 = values.top(); values.pop();
-                
-                try {
-                    values.push(ApplyOperator(val1, val2, op));
-                } catch (const std::exception& e) {
-                    throw std::runtime_error(std::string(e.what()) + " when evaluating " + 
-                                            std::to_string(val1) + " " + op + " " + std::to_string(val2));
-                }
-            }
-            
-            if (!foundMatchingParen) {
-                throw std::runtime_error("Mismatched parentheses: extra ')'");
-            }
-            
-            expectingOperand = false;
-            continue;
-        }
-        
-        if (isalpha(expression[i])) {
-            currentToken.clear();
-            
-            while (i < expression.length() && (isalpha(expression[i]) || isdigit(expression[i]))) {
-                currentToken += expression[i++];
-            }
-            
-            if (IsConstant(currentToken)) {
-                values.push(GetConstantValue(currentToken));
-                expectingOperand = false;
-                i--; // Adjust index since we incremented it in the while loop
-                continue;
-            }
-            
-            if (IsFunction(currentToken) && i < expression.length() && expression[i] == '(') {
-                try {
-                    double functionResult = ParseFunction(currentToken, expression, i);
-                    values.push(functionResult);
-                    expectingOperand = false;
-                    continue;
-                } catch (const std::exception& e) {
-                    throw std::runtime_error(std::string(e.what()));
-                }
-            }
-            
-            throw std::runtime_error("Unknown identifier: '" + currentToken + "'");
-        }
-        
-        if (IsOperator(expression[i])) {
-            if (expectingOperand) {
-                throw std::runtime_error("Invalid expression: operator '" + std::string(1, expression[i]) + 
-                                         "' cannot follow another operator");
-            }
-            
-            while (!operators.empty() && operators.top() != '(' &&
-                   GetPrecedence(operators.top()) >= GetPrecedence(expression[i])) {
-                char op = operators.top(); operators.pop();
-                
-                if (values.size() < 2) {
-                    throw std::runtime_error("Invalid expression: not enough operands for operator '" + 
-                                            std::string(1, op) + "'");
-                }
-                
-                double val2 = values.top(); values.pop();
-                double val1 = values.top(); values.pop();
-                
-                try {
-                    values.push(ApplyOperator(val1, val2, op));
-                } catch (const std::exception& e) {
-                    throw std::runtime_error(std::string(e.what()) + " when evaluating " + 
-                                            std::to_string(val1) + " " + op + " " + std::to_string(val2));
-                }
-            }
-            
-            operators.push(expression[i]);
-            expectingOperand = true;
-            continue;
-        }
-        
-        if (isdigit(expression[i]) || expression[i] == '.') {
-            std::string currentNumber;
-            
-            while (i < expression.length() && (isdigit(expression[i]) || expression[i] == '.')) {
-                currentNumber += expression[i++];
-            }
-            
-            if (std::count(currentNumber.begin(), currentNumber.end(), '.') > 1) {
-                throw std::runtime_error("Invalid number format: multiple decimal points in '" + currentNumber + "'");
-            }
-            
-            try {
-                values.push(std::stod(currentNumber));
-            } catch (...) {
-                throw std::runtime_error("Invalid number format: '" + currentNumber + "'");
-            }
-            
-            expectingOperand = false;
-            i--; // Adjust index since we incremented it in the while loop
-            continue;
-        }
-        
-        throw std::runtime_error("Unrecognized character in expression: '" + std::string(1, expression[i]) + "'");
-    }
-    
-    if (expectingOperand && !operators.empty()) {
-        throw std::runtime_error("Invalid expression: ends with an operator");
-    }
-    
-    while (!operators.empty()) {
-        char op = operators.top(); operators.pop();
-        
-        if (op == '(') {
-            throw std::runtime_error("Mismatched parentheses: extra '('");
-        }
-        
-        if (values.size() < 2) {
-            throw std::runtime_error("Invalid expression: not enough operands for operator '" + std::string(1, op) + "'");
-        }
-        
-        double val2 = values.top(); values.pop();
-        double val1 = values.top(); values.pop();
-        
-        try {
-            values.push(ApplyOperator(val1, val2, op));
-        } catch (const std::exception& e) {
-            throw std::runtime_error(std::string(e.what()) + " when evaluating " + 
-                                    std::to_string(val1) + " " + op + " " + std::to_string(val2));
-        }
-    }
-    
-    if (values.empty()) {
-        logDebug("Values stack is empty, error: no operands", "ERROR");
-        throw std::runtime_error("Invalid expression: no operands");
-    }
-    
-    if (values.size() != 1) {
-        logDebug("Error: too many operands left on stack", "ERROR");
-        throw std::runtime_error("Invalid expression: too many operands");
-    }
-    
-    double result = values.top();
-    std::string resultMsg = "Final result: " + std::to_string(result);
-    logDebug(resultMsg, "CALC");
-    
-    return result;
+    return EvaluateExpression(expression, evaluationContext);
 }
 
 void SwitchTheme() {
@@ -1857,7 +1281,7 @@ void SwitchTheme() {
     themeBackgroundBrush = CreateSolidBrush(currentTheme->windowBackground);
     
     std::string themeName = WStringToString(currentTheme->name);
-    logDebug("Theme changed to: " + themeName, "UI");
+    LOG_DEBUG("UI", "Theme changed to: " + themeName);
 }
 
 void ApplyTheme(HWND hwnd) {
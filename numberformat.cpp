@@ -0,0 +1,181 @@
+#include "numberformat.h"
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+namespace {
+
+#ifdef __SIZEOF_INT128__
+
+const uint64_t integerPowersOfTen[] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+    1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+    1000000000000000000ull, 10000000000000000000ull
+};
+
+// 1e-5 to 1e16; the negative powers are not exact, which at worst makes
+// the decimal exponent estimate off by one near a power of ten.
+const double doublePowersOfTen[] = {
+    1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16
+};
+
+const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const bool bigEndian = true;
+#else
+const bool bigEndian = false;
+#endif
+
+// Returns number, which must be below 10^8, as eight ASCII digits in a
+// word that stores them in order. Divisions by constants compile to
+// multiplications, and the word is built in a register so that it can be
+// examined and stored without reading back narrow stores.
+uint64_t EightDigits(uint32_t number) {
+    uint32_t pairs[4] = { number / 1000000, number / 10000 % 100, number / 100 % 100, number % 100 };
+    uint64_t word = 0;
+    for (int i = 0; i < 4; i++) {
+        uint16_t pair;
+        std::memcpy(&pair, digitPairs + 2 * pairs[i], sizeof(pair));
+        word |= static_cast<uint64_t>(pair) << (bigEndian ? 48 - 16 * i : 16 * i);
+    }
+    return word;
+}
+
+// How many of the sixteen digits in high and low are trailing '0's: XOR
+// with "00000000" zeroes exactly the bytes that are '0', and the last
+// bytes in memory are the most significant on little-endian machines,
+// the least on big-endian ones. Some digit must be nonzero.
+int TrailingZeros(uint64_t high, uint64_t low) {
+    const uint64_t zeros = 0x3030303030303030ull;
+    low ^= zeros;
+    high ^= zeros;
+    if (bigEndian) {
+        return low != 0 ? __builtin_ctzll(low) / 8 : 8 + __builtin_ctzll(high) / 8;
+    }
+    return low != 0 ? __builtin_clzll(low) / 8 : 8 + __builtin_clzll(high) / 8;
+}
+
+// "%.*g" prints magnitudes from 1e-4 up to 10^digits in fixed notation,
+// which is most results. For those this rounds the exact binary value
+// times a power of ten to a digits-digit integer in 128-bit arithmetic,
+// prints that two digits at a time and places the point, at a
+// fraction of the cost of the general floating-point to_chars. Returns 0
+// to leave the value to to_chars: outside that range, at an exact tie
+// (where rounding is to even) or when the exponent estimate was off.
+size_t FormatFixed(double value, char* buffer, int digits) {
+    double magnitude = std::fabs(value);
+    if (!(magnitude >= 1e-4 && magnitude < doublePowersOfTen[digits + 5])) {
+        return 0;
+    }
+
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    int binaryExponent = static_cast<int>((bits >> 52) & 0x7FF) - 1023;
+    uint64_t mantissa = (bits & ((1ull << 52) - 1)) | (1ull << 52);
+
+    // floor(binaryExponent * log10(2)), then corrected by one comparison.
+    int exponent = (binaryExponent * 1233) >> 12;
+    if (magnitude >= doublePowersOfTen[exponent + 6]) {
+        exponent++;
+    }
+
+    // value * 10^scale = mantissa * 10^scale / 2^shift exactly; below
+    // 10^digits every value has fractional bits, so shift is at least 3.
+    int scale = digits - 1 - exponent;
+    int shift = 52 - binaryExponent;
+    unsigned __int128 product = static_cast<unsigned __int128>(mantissa) * integerPowersOfTen[scale];
+    uint64_t rounded = static_cast<uint64_t>(product >> shift);
+    unsigned __int128 remainder = product - (static_cast<unsigned __int128>(rounded) << shift);
+    unsigned __int128 half = static_cast<unsigned __int128>(1) << (shift - 1);
+    if (remainder == half) {
+        return 0;
+    }
+    rounded += remainder > half ? 1 : 0;
+    if (rounded < integerPowersOfTen[digits - 1] || rounded >= integerPowersOfTen[digits]) {
+        return 0;
+    }
+
+    // The digits without their trailing zeros go out in fixed 16-byte
+    // copies, which stay inside the buffer, around a point after the first
+    // exponent + 1 of them, or after "0." and leading zeros below 1.
+    uint64_t high = EightDigits(static_cast<uint32_t>(rounded / 100000000));
+    uint64_t low = EightDigits(static_cast<uint32_t>(rounded % 100000000));
+    char digitText[32];
+    std::memcpy(digitText, &high, sizeof(high));
+    std::memcpy(digitText + 8, &low, sizeof(low));
+    const char* text = digitText + 16 - digits;
+    int significant = digits - TrailingZeros(high, low);
+    int integerDigits = exponent + 1;
+    char* out = buffer;
+    *out = '-';
+    out += value < 0 ? 1 : 0;
+    if (integerDigits >= significant) {
+        std::memcpy(out, text, 16);
+        out += integerDigits;
+    } else if (integerDigits > 0) {
+        std::memcpy(out, text, 16);
+        out[integerDigits] = '.';
+        std::memcpy(out + integerDigits + 1, text + integerDigits, 16);
+        out += significant + 1;
+    } else {
+        std::memcpy(out, "0.000", 5);
+        out += 2 - integerDigits;
+        std::memcpy(out, text, 16);
+        out += significant;
+    }
+    *out = '\0';
+    return static_cast<size_t>(out - buffer);
+}
+
+#endif
+
+}
+
+size_t FormatNumber(double value, char* buffer, int digits) {
+    char* last = buffer + numberBufferSize - 1;
+
+    // At 15 or more digits an integer below 1e15 prints as its plain
+    // digits, which to_chars writes several times faster from an integer.
+    if (digits >= displayDigits && std::fabs(value) < 1e15 && value == std::trunc(value)) {
+        char* first = buffer;
+        if (std::signbit(value)) {
+            *first++ = '-';
+        }
+        std::to_chars_result written = std::to_chars(first, last, static_cast<uint64_t>(std::fabs(value)));
+        *written.ptr = '\0';
+        return static_cast<size_t>(written.ptr - buffer);
+    }
+
+#ifdef __SIZEOF_INT128__
+    if (digits > shortestDigits && digits <= displayDigits) {
+        size_t length = FormatFixed(value, buffer, digits);
+        if (length != 0) {
+            return length;
+        }
+    }
+#endif
+
+    std::to_chars_result written = digits <= shortestDigits
+        ? std::to_chars(buffer, last, value)
+        : std::to_chars(buffer, last, value, std::chars_format::general, digits < 17 ? digits : 17);
+    *written.ptr = '\0';
+    return static_cast<size_t>(written.ptr - buffer);
+}
+
+void AppendNumber(std::string& output, double value, int digits) {
+    char buffer[numberBufferSize];
+    output.append(buffer, FormatNumber(value, buffer, digits));
+}
+
+std::string NumberToString(double value, int digits) {
+    char buffer[numberBufferSize];
+    return std::string(buffer, FormatNumber(value, buffer, digits));
+}
@@ -0,0 +1,27 @@
+#ifndef NUMBERFORMAT_H
+#define NUMBERFORMAT_H
+
+#include <string>
+#include <cstddef>
+
+// Digit settings for FormatNumber. shortestDigits gives the shortest text
+// that reads back as exactly the same double; 1 to 17 rounds to that
+// many significant digits, as printf's "%.*g" does. displayDigits is what
+// the GUI and calc-cli show: enough to hide binary rounding noise
+// ("sin(30)" is 0.5, not 0.49999999999999994).
+const int shortestDigits = 0;
+const int displayDigits = 15;
+
+// Enough room for any double at any setting, plus the terminator.
+const size_t numberBufferSize = 32;
+
+// Writes value to buffer, which must hold numberBufferSize characters,
+// terminates it and returns the length. Large and small magnitudes switch
+// to scientific notation ("1e-09", "1.5e+20"), which the lexer reads back.
+// Never allocates and ignores the locale.
+size_t FormatNumber(double value, char* buffer, int digits = shortestDigits);
+
+void AppendNumber(std::string& output, double value, int digits = shortestDigits);
+std::string NumberToString(double value, int digits = shortestDigits);
+
+#endif
@@ -0,0 +1,468 @@
+#include "optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace {
+
+typedef CompiledExpression::Node Node;
+typedef CompiledExpression::NodeType NodeType;
+
+// A node of the DAG. Folded constants are Number nodes holding their value
+// in each angle mode and no operands; Variable nodes only their slot and
+// the length of their name.
+struct DagNode {
+    NodeType type;
+    char op;
+    MathFunction function;
+    double degrees;
+    double radians;
+    int left;
+    int right;
+    unsigned int position;
+    unsigned int slot;
+    unsigned int length;
+};
+
+uint64_t Bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+uint64_t HashNode(const DagNode& node) {
+    uint64_t hash;
+    if (node.type == NodeType::Number) {
+        hash = Bits(node.degrees) * 0x9E3779B97F4A7C15ull ^ Bits(node.radians);
+    } else {
+        hash = (static_cast<uint64_t>(node.type) << 56) ^ (static_cast<uint64_t>(static_cast<unsigned char>(node.op)) << 48) ^
+               (static_cast<uint64_t>(node.function) << 40) ^
+               static_cast<uint64_t>(static_cast<uint32_t>(node.left)) * 0x9E3779B97F4A7C15ull ^
+               static_cast<uint32_t>(node.right) ^ static_cast<uint64_t>(node.slot) << 32;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool SameNode(const DagNode& a, const DagNode& b) {
+    if (a.type != b.type) {
+        return false;
+    }
+    if (a.type == NodeType::Number) {
+        return Bits(a.degrees) == Bits(b.degrees) && Bits(a.radians) == Bits(b.radians);
+    }
+    return a.op == b.op && a.function == b.function && a.left == b.left && a.right == b.right && a.slot == b.slot;
+}
+
+// The VM's operator semantics; false where the VM would report an error.
+bool FoldOperator(Calculator& calculator, char op, double a, double b, double& result) {
+    switch (op) {
+        case '+': result = a + b; return true;
+        case '-': result = a - b; return true;
+        case '*': result = a * b; return true;
+        case '/':
+            result = a / b;
+            return b != 0;
+        case '%':
+            result = std::fmod(a, b);
+            return b != 0;
+        case '^': {
+            CalcStatus status;
+            result = calculator.power(a, b, status);
+            return status == CalcStatus::Ok;
+        }
+    }
+    return false;
+}
+
+bool FoldFunction(Calculator& calculator, MathFunction function, double argument, bool inDegrees, double& result) {
+    FunctionError error = FunctionError::None;
+    result = TryApplyFunction(calculator, function, argument, inDegrees, error);
+    return error == FunctionError::None;
+}
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+// The DAG under construction: nodes are interned through an open-addressing
+// table, so building a node that already exists returns the existing one.
+class DagBuilder {
+public:
+    DagBuilder(size_t nodeCount, OptimizerStats& stats)
+        : table(RoundUpToPowerOfTwo(2 * nodeCount + 2), -1), stats(stats) {
+        nodes.reserve(nodeCount);
+    }
+
+    std::vector<DagNode> nodes;
+
+    // Returns the id of node, adding it when new; shared counts repeated
+    // subexpressions of the input, not of the rewrites.
+    int intern(const DagNode& node, bool fromInput);
+    int constant(double value, unsigned int position);
+    int binary(char op, int left, int right, unsigned int position);
+    int call(MathFunction function, int argument, unsigned int position);
+
+    // The value of node id when it is a constant that does not depend on
+    // the angle mode.
+    bool constantValue(int id, double& value) const;
+
+private:
+    std::vector<int> table;
+    OptimizerStats& stats;
+
+    void grow();
+};
+
+int DagBuilder::intern(const DagNode& node, bool fromInput) {
+    if (2 * (nodes.size() + 1) > table.size()) {
+        grow();
+    }
+    size_t mask = table.size() - 1;
+    size_t slot = HashNode(node) & mask;
+    while (table[slot] >= 0 && !SameNode(nodes[table[slot]], node)) {
+        slot = (slot + 1) & mask;
+    }
+    if (table[slot] >= 0) {
+        if (fromInput && node.left >= 0) {
+            stats.shared++;
+        }
+        return table[slot];
+    }
+    table[slot] = static_cast<int>(nodes.size());
+    nodes.push_back(node);
+    return table[slot];
+}
+
+void DagBuilder::grow() {
+    table.assign(2 * table.size(), -1);
+    size_t mask = table.size() - 1;
+    for (size_t id = 0; id < nodes.size(); id++) {
+        size_t slot = HashNode(nodes[id]) & mask;
+        while (table[slot] >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = static_cast<int>(id);
+    }
+}
+
+int DagBuilder::constant(double value, unsigned int position) {
+    DagNode node = { NodeType::Number, 0, MathFunction::Sin, value, value, -1, -1, position, 0, 0 };
+    return intern(node, false);
+}
+
+int DagBuilder::binary(char op, int left, int right, unsigned int position) {
+    DagNode node = { NodeType::Operator, op, MathFunction::Sin, 0.0, 0.0, left, right, position, 0, 0 };
+    return intern(node, false);
+}
+
+int DagBuilder::call(MathFunction function, int argument, unsigned int position) {
+    DagNode node = { NodeType::Function, 0, function, 0.0, 0.0, argument, -1, position, 0, 0 };
+    return intern(node, false);
+}
+
+bool DagBuilder::constantValue(int id, double& value) const {
+    const DagNode& node = nodes[id];
+    if (node.type != NodeType::Number || Bits(node.degrees) != Bits(node.radians)) {
+        return false;
+    }
+    value = node.degrees;
+    return true;
+}
+
+// Rewrite rules. Each returns the id of the replacement for node, whose
+// operands are already in the DAG, or -1 when it does not apply.
+
+const int maxPowerChainExponent = 16;
+
+// x^1 is x: pow returns its base unchanged.
+int RewriteUnitPower(DagBuilder& dag, const DagNode& node) {
+    double exponent;
+    if (node.type == NodeType::Operator && node.op == '^' && dag.constantValue(node.right, exponent) &&
+        exponent == 1.0) {
+        return node.left;
+    }
+    return -1;
+}
+
+// x*1 and 1*x are x.
+int RewriteUnitFactor(DagBuilder& dag, const DagNode& node) {
+    double factor;
+    if (node.type != NodeType::Operator || node.op != '*') {
+        return -1;
+    }
+    if (dag.constantValue(node.right, factor) && factor == 1.0) {
+        return node.left;
+    }
+    if (dag.constantValue(node.left, factor) && factor == 1.0) {
+        return node.right;
+    }
+    return -1;
+}
+
+// Division by a constant becomes a multiply by its reciprocal. When exact
+// is set, only for powers of two, whose reciprocal is exact and so gives
+// the same rounding as the division.
+int RewriteReciprocal(DagBuilder& dag, const DagNode& node, bool exact) {
+    double divisor;
+    if (node.type != NodeType::Operator || node.op != '/' || !dag.constantValue(node.right, divisor) ||
+        divisor == 0.0 || !std::isfinite(divisor)) {
+        return -1;
+    }
+    double reciprocal = 1.0 / divisor;
+    int exponent;
+    if (reciprocal == 0.0 || !std::isfinite(reciprocal) ||
+        (exact && std::fabs(std::frexp(divisor, &exponent)) != 0.5)) {
+        return -1;
+    }
+    return dag.binary('*', node.left, dag.constant(reciprocal, node.position), node.position);
+}
+
+int RewriteExactReciprocal(DagBuilder& dag, const DagNode& node) {
+    return RewriteReciprocal(dag, node, true);
+}
+
+int RewriteAnyReciprocal(DagBuilder& dag, const DagNode& node) {
+    return RewriteReciprocal(dag, node, false);
+}
+
+// x^n for a small positive integer n becomes a multiply chain by
+// repeated squaring: x^2 is x*x, x^5 is ((x*x)*(x*x))*x. Even x*x can
+// differ from pow in the last bit, since pow is not correctly rounded.
+int RewritePowerChain(DagBuilder& dag, const DagNode& node) {
+    double exponent;
+    if (node.type != NodeType::Operator || node.op != '^' || !dag.constantValue(node.right, exponent) ||
+        exponent < 2.0 || exponent > maxPowerChainExponent || std::floor(exponent) != exponent) {
+        return -1;
+    }
+
+    int remaining = static_cast<int>(exponent);
+    int square = node.left;
+    int result = -1;
+    while (remaining != 0) {
+        if (remaining & 1) {
+            result = result < 0 ? square : dag.binary('*', result, square, node.position);
+        }
+        remaining >>= 1;
+        if (remaining != 0) {
+            square = dag.binary('*', square, square, node.position);
+        }
+    }
+    return result;
+}
+
+// x^0.5 is sqrt(x). pow(-0, 0.5) is +0 where sqrt gives -0, and a
+// negative x fails as a square root instead of as a power.
+int RewriteHalfPower(DagBuilder& dag, const DagNode& node) {
+    double exponent;
+    if (node.type == NodeType::Operator && node.op == '^' && dag.constantValue(node.right, exponent) &&
+        exponent == 0.5) {
+        return dag.call(MathFunction::Sqrt, node.left, node.position);
+    }
+    return -1;
+}
+
+// log(x) is ln(x)/ln(10); the division becomes a multiply by a
+// precomputed reciprocal. A non-positive x fails as ln instead of log.
+int RewriteCommonLogarithm(DagBuilder& dag, const DagNode& node) {
+    if (node.type != NodeType::Function || node.function != MathFunction::Log) {
+        return -1;
+    }
+    int natural = dag.call(MathFunction::Ln, node.left, node.position);
+    return dag.binary('*', natural, dag.constant(1.0 / std::log(10.0), node.position), node.position);
+}
+
+enum RewriteEffect {
+    KeepsResults = 0,
+    ChangesRounding = 1,
+    ChangesErrors = 2
+};
+
+struct RewriteRule {
+    int effects;
+    int (*apply)(DagBuilder& dag, const DagNode& node);
+};
+
+// Tried in order; the first that applies wins.
+const RewriteRule rewriteRules[] = {
+    { KeepsResults, RewriteUnitPower },
+    { KeepsResults, RewriteUnitFactor },
+    { KeepsResults, RewriteExactReciprocal },
+    { ChangesRounding, RewriteAnyReciprocal },
+    { ChangesRounding, RewritePowerChain },
+    { ChangesRounding | ChangesErrors, RewriteHalfPower },
+    { ChangesRounding | ChangesErrors, RewriteCommonLogarithm },
+};
+
+bool RuleAllowed(const RewriteRule& rule, const OptimizerOptions& options) {
+    return ((rule.effects & ChangesRounding) == 0 || options.fastMath) &&
+           ((rule.effects & ChangesErrors) == 0 || !options.checkErrors);
+}
+
+// Builds one DAG from every tree and lowers it into program. When
+// resultSlots is given, each tree's value is moved into a fresh temporary
+// with a Result instruction, in order; otherwise there is one tree and
+// its value is left on the stack.
+void OptimizeTrees(const std::vector<const std::vector<Node>*>& trees, Bytecode& program,
+                   std::vector<unsigned int>* resultSlots, const OptimizerOptions& options, OptimizerStats& stats) {
+    size_t nodeCount = 0;
+    for (const std::vector<Node>* tree : trees) {
+        nodeCount += tree->size();
+    }
+
+    Calculator calculator;
+    DagBuilder dag(nodeCount + trees.size(), stats);
+    std::vector<int> dagIndex;
+    std::vector<int> roots;
+
+    for (const std::vector<Node>* tree : trees) {
+        const std::vector<Node>& nodes = *tree;
+        dagIndex.resize(nodes.size());
+
+        // Nodes are visited in post-order, so operands are interned before
+        // the nodes that use them and the DAG is topologically sorted too.
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const Node& node = nodes[i];
+            DagNode candidate = { node.type, node.op, node.function, node.value, node.value, -1, -1, node.position,
+                                  node.slot, node.length };
+
+            if (node.type == NodeType::Operator || node.type == NodeType::Function) {
+                candidate.left = dagIndex[node.left];
+                candidate.right = node.type == NodeType::Operator ? dagIndex[node.right] : -1;
+
+                const DagNode& left = dag.nodes[candidate.left];
+                const DagNode* right = candidate.right >= 0 ? &dag.nodes[candidate.right] : NULL;
+                if (options.foldConstants && left.type == NodeType::Number &&
+                    (right == NULL || right->type == NodeType::Number)) {
+                    bool ok = node.type == NodeType::Operator
+                        ? FoldOperator(calculator, node.op, left.degrees, right->degrees, candidate.degrees) &&
+                          FoldOperator(calculator, node.op, left.radians, right->radians, candidate.radians)
+                        : FoldFunction(calculator, node.function, left.degrees, true, candidate.degrees) &&
+                          FoldFunction(calculator, node.function, left.radians, false, candidate.radians);
+                    if (ok) {
+                        candidate.type = NodeType::Number;
+                        candidate.left = -1;
+                        candidate.right = -1;
+                        stats.folded++;
+                    }
+                }
+            }
+
+            int rewritten = -1;
+            if (candidate.left >= 0) {
+                for (const RewriteRule& rule : rewriteRules) {
+                    if (RuleAllowed(rule, options) && (rewritten = rule.apply(dag, candidate)) >= 0) {
+                        stats.rewritten++;
+                        break;
+                    }
+                }
+            }
+            dagIndex[i] = rewritten >= 0 ? rewritten : dag.intern(candidate, true);
+        }
+
+        // An empty expression evaluates to 0.
+        roots.push_back(nodes.empty() ? dag.constant(0.0, 0) : dagIndex.back());
+        stats.nodesBefore += nodes.size();
+        stats.expressions++;
+    }
+
+    // Count the uses of every node reachable from a root; operands of
+    // folded nodes are not reachable.
+    std::vector<unsigned int> uses(dag.nodes.size(), 0);
+    int highest = 0;
+    for (int root : roots) {
+        uses[root]++;
+        highest = std::max(highest, root);
+    }
+    for (int id = highest; id >= 0; id--) {
+        if (uses[id] == 0) {
+            continue;
+        }
+        stats.nodesAfter++;
+        if (dag.nodes[id].left >= 0) {
+            uses[dag.nodes[id].left]++;
+        }
+        if (dag.nodes[id].right >= 0) {
+            uses[dag.nodes[id].right]++;
+        }
+    }
+
+    // Depth-first lowering with an explicit stack, left operand first as
+    // in the tree; a node used again later, by its own tree or a later
+    // one, is stored to a temporary the first time and loaded after that.
+    std::vector<int> temporaries(dag.nodes.size(), -1);
+    std::vector<std::pair<int, bool>> work;
+    unsigned int temporaryCount = 0;
+
+    for (int root : roots) {
+        work.push_back(std::make_pair(root, false));
+
+        while (!work.empty()) {
+            int id = work.back().first;
+            bool expanded = work.back().second;
+            work.pop_back();
+            const DagNode& node = dag.nodes[id];
+
+            if (node.type == NodeType::Number) {
+                if (Bits(node.degrees) == Bits(node.radians)) {
+                    program.emitConstant(node.degrees, node.position);
+                } else {
+                    program.emitModeConstant(node.degrees, node.radians, node.position);
+                }
+            } else if (node.type == NodeType::Variable) {
+                program.emitVariable(node.slot, node.position, node.length);
+            } else if (temporaries[id] >= 0) {
+                program.emitLoad(static_cast<unsigned int>(temporaries[id]), node.position);
+            } else if (!expanded) {
+                work.push_back(std::make_pair(id, true));
+                if (node.right >= 0) {
+                    work.push_back(std::make_pair(node.right, false));
+                }
+                work.push_back(std::make_pair(node.left, false));
+            } else {
+                if (node.type == NodeType::Operator) {
+                    program.emitOperator(node.op, node.position);
+                } else {
+                    program.emitCall(node.function, node.position);
+                }
+                if (uses[id] > 1) {
+                    temporaries[id] = static_cast<int>(temporaryCount);
+                    program.emitStore(temporaryCount++, node.position);
+                }
+            }
+        }
+
+        if (resultSlots != NULL) {
+            resultSlots->push_back(temporaryCount);
+            program.emitResult(temporaryCount++, dag.nodes[root].position);
+        }
+    }
+}
+
+}
+
+void OptimizeExpression(const std::vector<Node>& nodes, Bytecode& program, const OptimizerOptions& options,
+                        OptimizerStats& stats) {
+    program.clear();
+    if (nodes.empty()) {
+        return;
+    }
+    std::vector<const std::vector<Node>*> trees(1, &nodes);
+    OptimizeTrees(trees, program, NULL, options, stats);
+}
+
+void OptimizeExpressions(const std::vector<const std::vector<Node>*>& trees, Bytecode& program,
+                         std::vector<unsigned int>& resultSlots, const OptimizerOptions& options,
+                         OptimizerStats& stats) {
+    program.clear();
+    resultSlots.clear();
+    OptimizeTrees(trees, program, &resultSlots, options, stats);
+}
@@ -0,0 +1,69 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+#include "bytecode.h"
+#include "expression.h"
+
+// What optimization removed, summed over every expression it was given.
+// nodesBefore counts parsed tree nodes and nodesAfter the nodes left to
+// evaluate; folded counts operators and calls replaced by a constant,
+// shared the repeated subexpressions computed only once and rewritten the
+// nodes replaced by a cheaper equivalent.
+struct OptimizerStats {
+    size_t expressions;
+    size_t nodesBefore;
+    size_t nodesAfter;
+    size_t folded;
+    size_t shared;
+    size_t rewritten;
+};
+
+// Which transformations may run. The defaults never change a result or
+// an error. fastMath allows rewrites whose results can differ in the last
+// bits (x^2 as x*x: pow is not correctly rounded). Clearing checkErrors
+// as well allows rewrites that still reject the same inputs but report
+// them as a different error (x^0.5 as sqrt(x) fails negative x as a
+// square root, not a power).
+struct OptimizerOptions {
+    bool foldConstants;
+    bool fastMath;
+    bool checkErrors;
+
+    OptimizerOptions() : foldConstants(true), fastMath(false), checkErrors(true) {}
+};
+
+// Lowers a parsed tree (post-order, as CompiledExpression stores it) to
+// program, which is cleared first:
+//
+// - Subtrees built only from literals, pi and e are folded to a constant.
+//   The angle mode is not known until evaluation, so each is folded in
+//   both modes; where the two values differ (sin(30), but not sqrt(2)),
+//   the program picks one at run time. A subtree that fails in either mode
+//   is left in place, so it still reports its error, with its position,
+//   when evaluated.
+// - Nodes matching a rewrite rule that options allow are replaced by a
+//   cheaper equivalent: x^1 and x*1 by x, division by a power of two by a
+//   multiply; with fastMath, division by any constant by a multiply and
+//   x^n (n up to 16) by a multiply chain; with checkErrors cleared as
+//   well, x^0.5 by sqrt(x) and log(x) by ln(x) times 1/ln(10).
+// - Identical subtrees are merged into one node of a DAG, evaluated at its
+//   first use and kept in a temporary for the others.
+//
+// Every operator and function is pure and evaluation order is preserved,
+// so under the default options the program returns exactly the
+// unoptimized results and errors.
+void OptimizeExpression(const std::vector<CompiledExpression::Node>& nodes, Bytecode& program,
+                        const OptimizerOptions& options, OptimizerStats& stats);
+
+// Lowers several trees into one program that computes them all, as
+// above, with identical subtrees shared across trees as well as within
+// them. The value of trees[k] is left in temporary resultSlots[k] (see
+// OpCode::Result) and nothing is left on the stack. An empty tree's value
+// is 0.
+void OptimizeExpressions(const std::vector<const std::vector<CompiledExpression::Node>*>& trees,
+                         Bytecode& program, std::vector<unsigned int>& resultSlots,
+                         const OptimizerOptions& options, OptimizerStats& stats);
+
+#endif
@@ -0,0 +1,402 @@
+#include "resultcache.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const uint32_t noEntry = 0xFFFFFFFFu;
+
+// Small caches use fewer shards rather than tiny ones: a shard of a few
+// entries evicts what a single LRU list of the same total size would keep.
+const size_t minShardCapacity = 64;
+
+// Characters that always end a token, so a space after them is never
+// significant. '+' and '-' are missing because they can continue a number
+// ("2e+ 1" is not "2e+1").
+bool EndsToken(char c) {
+    return c == '(' || c == ')' || c == '*' || c == '/' || c == '%' || c == '^';
+}
+
+// Characters that no token runs into, so a space before them is never
+// significant. '(' is missing because it joins a function name into a
+// call ("sin (30)" is not "sin(30)").
+bool StartsToken(char c) {
+    return c == ')' || c == '*' || c == '/' || c == '%' || c == '^';
+}
+
+// Calls emit(c) for each character of the normalized form of text.
+template <typename Emit>
+void Normalize(const char* text, size_t length, Emit emit) {
+    char previous = '(';
+    size_t i = 0;
+    while (i < length) {
+        if (text[i] != ' ') {
+            previous = text[i];
+            emit(text[i]);
+            i++;
+            continue;
+        }
+
+        size_t next = i;
+        while (next < length && text[next] == ' ') {
+            next++;
+        }
+        if (next < length && !EndsToken(previous) && !StartsToken(text[next])) {
+            emit(' ');
+        }
+        i = next;
+    }
+}
+
+uint64_t MixWord(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 29);
+}
+
+// Little-endian whatever the platform, so both paths of HashKey agree.
+uint64_t LoadWord(const char* text, size_t count) {
+    uint64_t word = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (count == 8) {
+        std::memcpy(&word, text, 8);
+        return word;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        word |= static_cast<uint64_t>(static_cast<unsigned char>(text[i])) << (8 * i);
+    }
+    return word;
+}
+
+// Hashes the normalized text eight characters at a time, finished with a
+// multiply-xorshift so both the high (shard) and low (slot) bits are well
+// mixed. Text without spaces is already normalized and is read a word at
+// a time; otherwise the normalized characters are packed into the same
+// words as they are produced.
+uint64_t HashKey(const char* text, size_t length, AngleMode mode, size_t& normalizedLength) {
+    uint64_t hash = 14695981039346656037ull;
+    if (std::memchr(text, ' ', length) == NULL) {
+        size_t i = 0;
+        for (; i + 8 <= length; i += 8) {
+            hash = MixWord(hash, LoadWord(text + i, 8));
+        }
+        if (i < length) {
+            hash = MixWord(hash, LoadWord(text + i, length - i));
+        }
+        normalizedLength = length;
+    } else {
+        uint64_t word = 0;
+        size_t count = 0;
+        Normalize(text, length, [&](char c) {
+            word |= static_cast<uint64_t>(static_cast<unsigned char>(c)) << (8 * (count % 8));
+            if (++count % 8 == 0) {
+                hash = MixWord(hash, word);
+                word = 0;
+            }
+        });
+        if (count % 8 != 0) {
+            hash = MixWord(hash, word);
+        }
+        normalizedLength = count;
+    }
+
+    hash ^= (static_cast<uint64_t>(mode) + 1) << 56 ^ normalizedLength;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Normalizing only ever drops spaces, so text whose normalized length is
+// its own length is already normalized and compares directly.
+bool KeyEquals(const std::string& key, const char* text, size_t length) {
+    if (key.size() == length) {
+        return key.compare(0, length, text, length) == 0;
+    }
+    size_t matched = 0;
+    bool equal = true;
+    Normalize(text, length, [&](char c) {
+        if (equal && matched < key.size() && key[matched] == c) {
+            matched++;
+        } else {
+            equal = false;
+        }
+    });
+    return equal && matched == key.size();
+}
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+}
+
+// One independently locked LRU list. Entries are stored in a vector that
+// grows to the shard's capacity and are then recycled from the tail; the
+// index is an open-addressing table of entry numbers (plus one, so zero
+// marks an empty slot) with linear probing. missed has a bit per hash
+// bucket of texts that missed once; it is cleared after a quarter as many
+// misses as it has bits, which keeps it sparse enough that few texts seen
+// once are admitted, and forgets old misses.
+struct ResultCache::Shard {
+    struct Entry {
+        std::string key;
+        uint64_t hash;
+        AngleMode mode;
+        double value;
+        uint32_t newer;
+        uint32_t older;
+    };
+
+    std::mutex mutex;
+    size_t capacity;
+    std::vector<Entry> entries;
+    std::vector<uint32_t> slots;
+    size_t mask;
+    std::vector<uint64_t> missed;
+    size_t missedSinceClear;
+    uint32_t newest;
+    uint32_t oldest;
+    size_t hits;
+    size_t misses;
+    size_t insertions;
+    size_t evictions;
+
+    explicit Shard(size_t capacity);
+
+    size_t find(uint64_t hash, size_t normalizedLength, AngleMode mode, const char* text, size_t length) const;
+    bool admit(uint64_t hash);
+    void eraseSlot(size_t slot);
+    void unlink(uint32_t entry);
+    void pushNewest(uint32_t entry);
+    void reset();
+};
+
+ResultCache::Shard::Shard(size_t capacity)
+    : capacity(capacity), mask(RoundUpToPowerOfTwo(2 * capacity) - 1) {
+    entries.reserve(capacity);
+    slots.assign(mask + 1, 0);
+    missed.assign(std::max<size_t>(RoundUpToPowerOfTwo(32 * capacity), 1024) / 64, 0);
+    reset();
+}
+
+void ResultCache::Shard::reset() {
+    entries.clear();
+    std::fill(slots.begin(), slots.end(), 0);
+    std::fill(missed.begin(), missed.end(), 0);
+    missedSinceClear = 0;
+    newest = noEntry;
+    oldest = noEntry;
+    hits = 0;
+    misses = 0;
+    insertions = 0;
+    evictions = 0;
+}
+
+// Returns the index slot holding the entry for text, or slots.size().
+size_t ResultCache::Shard::find(uint64_t hash, size_t normalizedLength, AngleMode mode,
+                                const char* text, size_t length) const {
+    for (size_t slot = hash & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        const Entry& entry = entries[slots[slot] - 1];
+        if (entry.hash == hash && entry.mode == mode && entry.key.size() == normalizedLength &&
+            KeyEquals(entry.key, text, length)) {
+            return slot;
+        }
+    }
+    return slots.size();
+}
+
+// Always admits while the shard has room; once it is full, admits a hash
+// whose bucket missed before.
+bool ResultCache::Shard::admit(uint64_t hash) {
+    if (entries.size() < capacity) {
+        return true;
+    }
+    size_t bits = missed.size() * 64;
+    if (++missedSinceClear > bits / 4) {
+        std::fill(missed.begin(), missed.end(), 0);
+        missedSinceClear = 0;
+    }
+    size_t bit = (hash >> 16) & (bits - 1);
+    uint64_t flag = 1ull << (bit & 63);
+    bool seen = (missed[bit >> 6] & flag) != 0;
+    missed[bit >> 6] |= flag;
+    return seen;
+}
+
+// Backward-shift deletion: later members of the probe run move up so
+// that no lookup stops early at the hole.
+void ResultCache::Shard::eraseSlot(size_t slot) {
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; slots[next] != 0; next = (next + 1) & mask) {
+        size_t home = entries[slots[next] - 1].hash & mask;
+        bool homeInRun = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!homeInRun) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+    }
+    slots[hole] = 0;
+}
+
+void ResultCache::Shard::unlink(uint32_t entry) {
+    Entry& current = entries[entry];
+    if (current.newer != noEntry) {
+        entries[current.newer].older = current.older;
+    } else {
+        newest = current.older;
+    }
+    if (current.older != noEntry) {
+        entries[current.older].newer = current.newer;
+    } else {
+        oldest = current.newer;
+    }
+}
+
+void ResultCache::Shard::pushNewest(uint32_t entry) {
+    entries[entry].newer = noEntry;
+    entries[entry].older = newest;
+    if (newest != noEntry) {
+        entries[newest].newer = entry;
+    } else {
+        oldest = entry;
+    }
+    newest = entry;
+}
+
+ResultCache::ResultCache(size_t capacity, size_t shardCount) {
+    shardCount = RoundUpToPowerOfTwo(shardCount == 0 ? 1 : shardCount);
+    while (shardCount > 1 && shardCount * minShardCapacity > capacity) {
+        shardCount >>= 1;
+    }
+    size_t perShard = (capacity + shardCount - 1) / shardCount;
+    if (perShard == 0) {
+        perShard = 1;
+    }
+    this->capacity = perShard * shardCount;
+    for (size_t i = 0; i < shardCount; i++) {
+        shards.push_back(std::unique_ptr<Shard>(new Shard(perShard)));
+    }
+}
+
+ResultCache::~ResultCache() {
+}
+
+size_t ResultCache::getCapacity() const {
+    return capacity;
+}
+
+ResultCache::Shard& ResultCache::shardFor(uint64_t hash) {
+    return *shards[(hash >> 40) & (shards.size() - 1)];
+}
+
+bool ResultCache::lookup(const char* text, size_t length, AngleMode mode, double& value) {
+    Key key;
+    return lookup(text, length, mode, value, key);
+}
+
+bool ResultCache::lookup(const char* text, size_t length, AngleMode mode, double& value, Key& key) {
+    key.hash = HashKey(text, length, mode, key.length);
+    key.admit = false;
+    if (key.length == 0) {
+        return false;
+    }
+
+    Shard& shard = shardFor(key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t slot = shard.find(key.hash, key.length, mode, text, length);
+    if (slot == shard.slots.size()) {
+        shard.misses++;
+        key.admit = shard.admit(key.hash);
+        return false;
+    }
+
+    uint32_t entry = shard.slots[slot] - 1;
+    if (entry != shard.newest) {
+        shard.unlink(entry);
+        shard.pushNewest(entry);
+    }
+    value = shard.entries[entry].value;
+    shard.hits++;
+    return true;
+}
+
+void ResultCache::insert(const char* text, size_t length, AngleMode mode, double value) {
+    Key key;
+    key.hash = HashKey(text, length, mode, key.length);
+    key.admit = true;
+    insert(text, length, mode, value, key);
+}
+
+void ResultCache::insert(const char* text, size_t length, AngleMode mode, double value, const Key& key) {
+    if (key.length == 0 || !key.admit) {
+        return;
+    }
+
+    Shard& shard = shardFor(key.hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t slot = shard.find(key.hash, key.length, mode, text, length);
+    uint32_t entry;
+    if (slot != shard.slots.size()) {
+        entry = shard.slots[slot] - 1;
+        shard.unlink(entry);
+    } else {
+        if (shard.entries.size() < shard.capacity) {
+            shard.entries.push_back(Shard::Entry());
+            entry = static_cast<uint32_t>(shard.entries.size() - 1);
+        } else {
+            entry = shard.oldest;
+            Shard::Entry& evicted = shard.entries[entry];
+            size_t evictedSlot = evicted.hash & shard.mask;
+            while (shard.slots[evictedSlot] != entry + 1) {
+                evictedSlot = (evictedSlot + 1) & shard.mask;
+            }
+            shard.eraseSlot(evictedSlot);
+            shard.unlink(entry);
+            shard.evictions++;
+        }
+
+        Shard::Entry& fresh = shard.entries[entry];
+        if (key.length == length) {
+            fresh.key.assign(text, length);
+        } else {
+            fresh.key.resize(key.length);
+            char* out = &fresh.key[0];
+            Normalize(text, length, [&](char c) { *out++ = c; });
+        }
+        fresh.hash = key.hash;
+        fresh.mode = mode;
+
+        for (slot = key.hash & shard.mask; shard.slots[slot] != 0; slot = (slot + 1) & shard.mask) {
+        }
+        shard.slots[slot] = entry + 1;
+        shard.insertions++;
+    }
+
+    shard.entries[entry].value = value;
+    shard.pushNewest(entry);
+}
+
+ResultCache::Stats ResultCache::getStats() const {
+    Stats stats = Stats();
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        stats.hits += shard->hits;
+        stats.misses += shard->misses;
+        stats.insertions += shard->insertions;
+        stats.evictions += shard->evictions;
+        stats.size += shard->entries.size();
+    }
+    return stats;
+}
+
+void ResultCache::clear() {
+    for (const std::unique_ptr<Shard>& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->reset();
+    }
+}
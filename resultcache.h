@@ -0,0 +1,87 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "context.h"
+
+// A bounded LRU cache of evaluation results, keyed on the expression text
+// and the angle mode. Attach one to any number of EvaluationContexts with
+// setResultCache(); TryEvaluateExpression then consults it before
+// compiling.
+//
+// Keys are normalized by dropping the spaces the lexer would skip anyway:
+// leading and trailing spaces, spaces after '(' ')' '*' '/' '%' '^' and
+// spaces before ')' '*' '/' '%' '^' (so "( 1 + 2 ) * 3" and "(1 + 2)*3"
+// share an entry). Other spaces can separate tokens ("2e +1" is not
+// "2e+1", "sin (30)" is not "sin(30)"), so they are kept, collapsed to
+// one. Blank text and failed evaluations are never cached: an error's
+// positions refer to the exact text that produced it.
+//
+// Entries live in a fixed number of shards, each behind its own mutex and
+// evicting its own least recently used entry, so threads mostly touch
+// different locks. Lookups never allocate, and once a shard is full an
+// insert reuses the evicted entry's key buffer.
+//
+// A full shard admits a text only on its second miss within a while (a
+// bitmap of recently missed hashes, cleared as it fills), so a cache much
+// smaller than the set of distinct texts is not churned by texts seen
+// once: each of those would otherwise cost an insert and an eviction.
+class ResultCache {
+public:
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t insertions;
+        size_t evictions;
+        size_t size;
+    };
+
+    static const size_t defaultShardCount = 16;
+
+    // capacity is the total number of entries, spread evenly over
+    // shardCount shards (a power of two, reduced for small caches);
+    // getCapacity() reports it after rounding up to whole shards.
+    explicit ResultCache(size_t capacity, size_t shardCount = defaultShardCount);
+    ~ResultCache();
+
+    size_t getCapacity() const;
+
+    // What lookup() works out about a text: the hash of its normalized
+    // form, that form's length and whether a miss should be inserted.
+    // Handing it to insert() after a miss saves normalizing and hashing
+    // the text again.
+    struct Key {
+        uint64_t hash;
+        size_t length;
+        bool admit;
+    };
+
+    bool lookup(const char* text, size_t length, AngleMode mode, double& value);
+    bool lookup(const char* text, size_t length, AngleMode mode, double& value, Key& key);
+    void insert(const char* text, size_t length, AngleMode mode, double value);
+
+    // key must come from lookup() on the same text and mode; nothing is
+    // inserted when the lookup did not admit the text.
+    void insert(const char* text, size_t length, AngleMode mode, double value, const Key& key);
+
+    Stats getStats() const;
+    void clear();
+
+private:
+    struct Shard;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t capacity;
+
+    Shard& shardFor(uint64_t hash);
+
+    ResultCache(const ResultCache&);
+    ResultCache& operator=(const ResultCache&);
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "threadpool.h"
+
+WorkStealingPool::WorkStealingPool(size_t threadCount)
+    : workerCount(threadCount == 0 ? 1 : threadCount), body(NULL),
+      generation(0), remaining(0), stopping(false) {
+    for (size_t i = 0; i < workerCount; i++) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+
+    for (size_t i = 1; i < workerCount; i++) {
+        threads.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t WorkStealingPool::size() const {
+    return workerCount;
+}
+
+bool WorkStealingPool::takeTask(size_t worker, size_t& task) {
+    {
+        WorkerQueue& own = *queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t offset = 1; offset < workerCount; offset++) {
+        WorkerQueue& victim = *queues[(worker + offset) % workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkStealingPool::drain(size_t worker) {
+    size_t task;
+    while (takeTask(worker, task)) {
+        try {
+            (*body)(task, worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--remaining == 0) {
+            finished.notify_all();
+        }
+    }
+}
+
+void WorkStealingPool::workerLoop(size_t worker) {
+    size_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping && generation == seen) {
+                wake.wait(lock);
+            }
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        drain(worker);
+    }
+}
+
+void WorkStealingPool::parallelFor(size_t taskCount, const std::function<void(size_t, size_t)>& body) {
+    if (taskCount == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        remaining = taskCount;
+        failure = std::exception_ptr();
+    }
+
+    // Each worker starts with a contiguous range so neighbouring chunks
+    // stay on one core unless somebody runs out of work.
+    for (size_t worker = 0; worker < workerCount; worker++) {
+        size_t first = taskCount * worker / workerCount;
+        size_t last = taskCount * (worker + 1) / workerCount;
+
+        WorkerQueue& queue = *queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        for (size_t task = first; task < last; task++) {
+            queue.tasks.push_back(task);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (remaining > 0) {
+            finished.wait(lock);
+        }
+        this->body = NULL;
+        error = failure;
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+// A fixed set of workers, each owning a deque of task indices. A worker
+// takes tasks from the front of its own deque and, once that is empty,
+// steals from the back of the others, so uneven chunks still keep every
+// core busy. The calling thread acts as worker 0 while parallelFor() runs.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threadCount);
+    ~WorkStealingPool();
+
+    size_t size() const;
+
+    // Runs body(task, worker) for every task in [0, taskCount) and returns
+    // once all of them have finished. worker is in [0, size()) and is never
+    // shared by two concurrent calls, so it can index per-worker state.
+    // The first exception thrown by body is rethrown here.
+    void parallelFor(size_t taskCount, const std::function<void(size_t, size_t)>& body);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    size_t workerCount;
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(size_t, size_t)>* body;
+    size_t generation;
+    size_t remaining;
+    bool stopping;
+    std::exception_ptr failure;
+
+    void workerLoop(size_t worker);
+    void drain(size_t worker);
+    bool takeTask(size_t worker, size_t& task);
+
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "variables.h"
+#include "functions.h"
+#include "lexer.h"
+#include <cctype>
+
+namespace {
+
+uint64_t HashName(const char* name, size_t length) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+}
+
+VariableTable::VariableTable() : index(16, 0) {
+}
+
+bool VariableTable::isValidName(const char* name, size_t length) {
+    if (length == 0 || !isalpha(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+    for (size_t i = 1; i < length; i++) {
+        if (!isalnum(static_cast<unsigned char>(name[i])) && name[i] != '_') {
+            return false;
+        }
+    }
+    MathFunction function;
+    return !IsConstant(std::string(name, length)) && !LookupFunction(name, length, function);
+}
+
+// The index is an open-addressing table of slots plus one (zero marks an
+// empty entry), kept at most half full.
+unsigned int VariableTable::find(const char* name, size_t length) const {
+    size_t mask = index.size() - 1;
+    for (size_t entry = HashName(name, length) & mask; index[entry] != 0; entry = (entry + 1) & mask) {
+        const std::string& candidate = names[index[entry] - 1];
+        if (candidate.size() == length && candidate.compare(0, length, name, length) == 0) {
+            return index[entry] - 1;
+        }
+    }
+    return notFound;
+}
+
+unsigned int VariableTable::define(const std::string& name) {
+    unsigned int slot = find(name.data(), name.size());
+    if (slot != notFound) {
+        return slot;
+    }
+    if (!isValidName(name.data(), name.size())) {
+        return notFound;
+    }
+
+    slot = static_cast<unsigned int>(names.size());
+    names.push_back(name);
+    values.push_back(0.0);
+    if (2 * names.size() > index.size()) {
+        index.assign(2 * index.size(), 0);
+        rebuildIndex();
+    } else {
+        size_t mask = index.size() - 1;
+        size_t entry = HashName(name.data(), name.size()) & mask;
+        while (index[entry] != 0) {
+            entry = (entry + 1) & mask;
+        }
+        index[entry] = slot + 1;
+    }
+    return slot;
+}
+
+void VariableTable::rebuildIndex() {
+    size_t mask = index.size() - 1;
+    for (size_t slot = 0; slot < names.size(); slot++) {
+        size_t entry = HashName(names[slot].data(), names[slot].size()) & mask;
+        while (index[entry] != 0) {
+            entry = (entry + 1) & mask;
+        }
+        index[entry] = static_cast<uint32_t>(slot + 1);
+    }
+}
+
+void VariableTable::set(unsigned int slot, double value) {
+    values[slot] = value;
+}
+
+double VariableTable::get(unsigned int slot) const {
+    return values[slot];
+}
+
+bool VariableTable::set(const std::string& name, double value) {
+    unsigned int slot = define(name);
+    if (slot == notFound) {
+        return false;
+    }
+    values[slot] = value;
+    return true;
+}
+
+const std::string& VariableTable::getName(unsigned int slot) const {
+    return names[slot];
+}
+
+size_t VariableTable::size() const {
+    return names.size();
+}
+
+const double* VariableTable::getValues() const {
+    return values.data();
+}
+
+double* VariableTable::getValues() {
+    return values.data();
+}
@@ -0,0 +1,51 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Named values that expressions can refer to ("x * rate + qty"). Each name
+// is given a slot when defined; the lexer resolves a name to its slot once,
+// at compile time, and evaluation reads getValues()[slot] with no lookup.
+//
+// Names are a letter followed by letters, digits and '_' ("unit_price"),
+// like the lexer's identifiers. pi, e and function names are reserved. A
+// name that is also the start of an implicit call ("sine", normally
+// sin(e)) refers to the variable once defined.
+//
+// Attach a table to a context with EvaluationContext::setVariables().
+// Expressions must be evaluated with the table they were compiled
+// against (or one defining the same slots), since only slots are kept.
+class VariableTable {
+public:
+    static const unsigned int notFound = 0xFFFFFFFFu;
+
+    VariableTable();
+
+    static bool isValidName(const char* name, size_t length);
+
+    // Returns the slot of name, adding it with value 0 when new, or
+    // notFound when name is not a valid variable name.
+    unsigned int define(const std::string& name);
+    unsigned int find(const char* name, size_t length) const;
+
+    void set(unsigned int slot, double value);
+    double get(unsigned int slot) const;
+    bool set(const std::string& name, double value);
+
+    const std::string& getName(unsigned int slot) const;
+    size_t size() const;
+    const double* getValues() const;
+    double* getValues();
+
+private:
+    std::vector<std::string> names;
+    std::vector<double> values;
+    std::vector<uint32_t> index;
+
+    void rebuildIndex();
+};
+
+#endif
@@ -0,0 +1,375 @@
+#include "vectormath.h"
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CALC_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const double notANumber = std::numeric_limits<double>::quiet_NaN();
+
+// Scalar definitions, matching Calculator's methods apart from returning
+// NaN for domain errors. These handle the tails, the out-of-range lanes
+// and CPUs without AVX2.
+double ScalarSin(double x) { return std::sin(x); }
+double ScalarCos(double x) { return std::cos(x); }
+double ScalarSqrt(double x) { return x < 0 ? notANumber : std::sqrt(x); }
+double ScalarLn(double x) { return x <= 0 ? notANumber : std::log(x); }
+double ScalarSinh(double x) { return std::sinh(x); }
+double ScalarCosh(double x) { return std::cosh(x); }
+double ScalarTanh(double x) { return std::tanh(x); }
+
+double ScalarTan(double x) {
+    return std::abs(std::cos(x)) < 1e-10 ? notANumber : std::tan(x);
+}
+
+template <double (*Function)(double)>
+void ScalarLoop(const double* input, double* output, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        output[i] = Function(input[i]);
+    }
+}
+
+#ifdef CALC_HAVE_AVX2
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+bool CpuHasAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+// Adding 1.5 * 2^52 rounds a double of magnitude below 2^51 to an integer
+// and leaves that integer in the low mantissa bits.
+const double roundingMagic = 6755399441055744.0;
+
+AVX2_TARGET inline __m256d Abs(__m256d x) {
+    return _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+}
+
+AVX2_TARGET inline bool AllBelow(__m256d magnitude, double limit) {
+    // NaN compares false, so NaN lanes count as out of range.
+    __m256d inRange = _mm256_cmp_pd(magnitude, _mm256_set1_pd(limit), _CMP_LE_OQ);
+    return _mm256_movemask_pd(inRange) == 0xF;
+}
+
+// e^x for |x| <= 708: x = k ln2 + r with |r| <= ln2/2, e^r from its
+// degree-13 Taylor polynomial, and 2^k built directly in the exponent.
+AVX2_TARGET inline __m256d ExpCore(__m256d x) {
+    const __m256d magic = _mm256_set1_pd(roundingMagic);
+    __m256d shifted = _mm256_fmadd_pd(x, _mm256_set1_pd(1.4426950408889634), magic);
+    __m256d k = _mm256_sub_pd(shifted, magic);
+
+    __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(0.6931471805599453), x);
+    r = _mm256_fnmadd_pd(k, _mm256_set1_pd(2.3190468138462996e-17), r);
+
+    __m256d p = _mm256_set1_pd(1.0 / 6227020800.0);
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 479001600.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 39916800.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 3628800.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 362880.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 40320.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 5040.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 720.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 120.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 24.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 6.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(0.5));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+
+    __m256i exponent = _mm256_sub_epi64(_mm256_castpd_si256(shifted), _mm256_castpd_si256(magic));
+    exponent = _mm256_slli_epi64(_mm256_add_epi64(exponent, _mm256_set1_epi64x(1023)), 52);
+    return _mm256_mul_pd(p, _mm256_castsi256_pd(exponent));
+}
+
+// ln x for positive, normal, finite x (fdlibm's e_log.c): x = 2^e m with
+// m in [sqrt(2)/2, sqrt(2)), then a minimax polynomial in s = f / (2 + f)
+// where f = m - 1.
+AVX2_TARGET inline __m256d LnCore(__m256d x) {
+    const __m256i mantissaMask = _mm256_set1_epi64x(0x000FFFFFFFFFFFFFLL);
+    const __m256i oneBits = _mm256_set1_epi64x(0x3FF0000000000000LL);
+    const __m256i twoTo52Bits = _mm256_set1_epi64x(0x4330000000000000LL);
+
+    __m256i bits = _mm256_castpd_si256(x);
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, mantissaMask), oneBits));
+
+    // 2^52 + biased exponent, read back as a double, gives the exponent.
+    __m256d biased = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), twoTo52Bits));
+    __m256d e = _mm256_sub_pd(biased, _mm256_set1_pd(4503599627370496.0 + 1023.0));
+
+    __m256d large = _mm256_cmp_pd(m, _mm256_set1_pd(1.4142135623730951), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), large);
+    e = _mm256_add_pd(e, _mm256_and_pd(large, _mm256_set1_pd(1.0)));
+
+    __m256d f = _mm256_sub_pd(m, _mm256_set1_pd(1.0));
+    __m256d s = _mm256_div_pd(f, _mm256_add_pd(f, _mm256_set1_pd(2.0)));
+    __m256d z = _mm256_mul_pd(s, s);
+    __m256d w = _mm256_mul_pd(z, z);
+
+    __m256d t1 = _mm256_fmadd_pd(w, _mm256_set1_pd(1.531383769920937332e-01), _mm256_set1_pd(2.222219843214978396e-01));
+    t1 = _mm256_fmadd_pd(w, t1, _mm256_set1_pd(3.999999999940941908e-01));
+    t1 = _mm256_mul_pd(w, t1);
+    __m256d t2 = _mm256_fmadd_pd(w, _mm256_set1_pd(1.479819860511658591e-01), _mm256_set1_pd(1.818357216161805012e-01));
+    t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(2.857142874366239149e-01));
+    t2 = _mm256_fmadd_pd(w, t2, _mm256_set1_pd(6.666666666666735130e-01));
+    t2 = _mm256_mul_pd(z, t2);
+    __m256d R = _mm256_add_pd(t1, t2);
+
+    __m256d hfsq = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_mul_pd(f, f));
+    __m256d tail = _mm256_fmadd_pd(s, _mm256_add_pd(hfsq, R), _mm256_mul_pd(e, _mm256_set1_pd(1.90821492927058770002e-10)));
+    __m256d result = _mm256_sub_pd(_mm256_sub_pd(hfsq, tail), f);
+    return _mm256_fmsub_pd(e, _mm256_set1_pd(6.93147180369123816490e-01), result);
+}
+
+// Reduces x to r in [-pi/4, pi/4] with x = n pi/2 + r, using a three-part
+// pi/2 with FMA (accurate for |n| < 2^20), and evaluates fdlibm's sin and
+// cos kernels on r. quadrant receives n as an integer.
+AVX2_TARGET inline void SinCosCore(__m256d x, __m256d& sinR, __m256d& cosR, __m256i& quadrant) {
+    const __m256d magic = _mm256_set1_pd(roundingMagic);
+    __m256d shifted = _mm256_fmadd_pd(x, _mm256_set1_pd(0.6366197723675814), magic);
+    __m256d n = _mm256_sub_pd(shifted, magic);
+    quadrant = _mm256_castpd_si256(shifted);
+
+    __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(1.5707963267948966), x);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(6.123233995736766e-17), r);
+    r = _mm256_fnmadd_pd(n, _mm256_set1_pd(-1.4973849048591698e-33), r);
+
+    __m256d z = _mm256_mul_pd(r, r);
+
+    __m256d ps = _mm256_fmadd_pd(z, _mm256_set1_pd(1.58969099521155010221e-10), _mm256_set1_pd(-2.50507602534068634195e-08));
+    ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(2.75573137070700676789e-06));
+    ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(-1.98412698298579493134e-04));
+    ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(8.33333333332248946124e-03));
+    ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(-1.66666666666666324348e-01));
+    sinR = _mm256_fmadd_pd(_mm256_mul_pd(z, r), ps, r);
+
+    __m256d pc = _mm256_fmadd_pd(z, _mm256_set1_pd(-1.13596475577881948265e-11), _mm256_set1_pd(2.08757232129817482790e-09));
+    pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(-2.75573143513906633035e-07));
+    pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(2.48015872894767294178e-05));
+    pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(-1.38888888888741095749e-03));
+    pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(4.16666666666666019037e-02));
+    pc = _mm256_mul_pd(z, pc);
+    __m256d hz = _mm256_mul_pd(_mm256_set1_pd(0.5), z);
+    __m256d w = _mm256_sub_pd(_mm256_set1_pd(1.0), hz);
+    __m256d correction = _mm256_sub_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), w), hz);
+    cosR = _mm256_add_pd(w, _mm256_fmadd_pd(z, pc, correction));
+}
+
+// Lane mask of quadrants with the given bit set.
+AVX2_TARGET inline __m256d QuadrantBit(__m256i quadrant, long long bit) {
+    __m256i mask = _mm256_set1_epi64x(bit);
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant, mask), mask));
+}
+
+AVX2_TARGET inline __m256d FlipSign(__m256d value, __m256d flip) {
+    return _mm256_xor_pd(value, _mm256_and_pd(flip, _mm256_set1_pd(-0.0)));
+}
+
+AVX2_TARGET inline __m256d SinVector(__m256d x) {
+    __m256d s, c;
+    __m256i quadrant;
+    SinCosCore(x, s, c, quadrant);
+    __m256d result = _mm256_blendv_pd(s, c, QuadrantBit(quadrant, 1));
+    return FlipSign(result, QuadrantBit(quadrant, 2));
+}
+
+AVX2_TARGET inline __m256d CosVector(__m256d x) {
+    __m256d s, c;
+    __m256i quadrant;
+    SinCosCore(x, s, c, quadrant);
+    quadrant = _mm256_add_epi64(quadrant, _mm256_set1_epi64x(1));
+    __m256d result = _mm256_blendv_pd(s, c, QuadrantBit(quadrant, 1));
+    return FlipSign(result, QuadrantBit(quadrant, 2));
+}
+
+AVX2_TARGET inline __m256d TanVector(__m256d x) {
+    __m256d s, c;
+    __m256i quadrant;
+    SinCosCore(x, s, c, quadrant);
+    __m256i shifted = _mm256_add_epi64(quadrant, _mm256_set1_epi64x(1));
+    __m256d sinX = FlipSign(_mm256_blendv_pd(s, c, QuadrantBit(quadrant, 1)), QuadrantBit(quadrant, 2));
+    __m256d cosX = FlipSign(_mm256_blendv_pd(s, c, QuadrantBit(shifted, 1)), QuadrantBit(shifted, 2));
+
+    __m256d undefined = _mm256_cmp_pd(Abs(cosX), _mm256_set1_pd(1e-10), _CMP_LT_OQ);
+    return _mm256_blendv_pd(_mm256_div_pd(sinX, cosX), _mm256_set1_pd(notANumber), undefined);
+}
+
+AVX2_TARGET inline __m256d SqrtVector(__m256d x) {
+    __m256d negative = _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ);
+    return _mm256_blendv_pd(_mm256_sqrt_pd(x), _mm256_set1_pd(notANumber), negative);
+}
+
+// sinh x = x (1 + x^2/3! + ... + x^14/15!) for |x| < 0.5, where the exp
+// form would cancel, and (e^|x| - e^-|x|) / 2 with x's sign above that.
+AVX2_TARGET inline __m256d SinhPolynomial(__m256d x, __m256d z) {
+    __m256d p = _mm256_set1_pd(1.0 / 1307674368000.0);
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 6227020800.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 39916800.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 362880.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 5040.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 120.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 6.0));
+    return _mm256_fmadd_pd(_mm256_mul_pd(p, z), x, x);
+}
+
+AVX2_TARGET inline __m256d CoshPolynomial(__m256d z) {
+    __m256d p = _mm256_set1_pd(1.0 / 87178291200.0);
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 479001600.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 3628800.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 40320.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 720.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0 / 24.0));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(0.5));
+    return _mm256_fmadd_pd(p, z, _mm256_set1_pd(1.0));
+}
+
+AVX2_TARGET inline __m256d SinhVector(__m256d x) {
+    __m256d magnitude = Abs(x);
+    __m256d sign = _mm256_and_pd(x, _mm256_set1_pd(-0.0));
+    __m256d e = ExpCore(magnitude);
+    __m256d large = _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_sub_pd(e, _mm256_div_pd(_mm256_set1_pd(1.0), e)));
+    large = _mm256_or_pd(large, sign);
+    __m256d small = SinhPolynomial(x, _mm256_mul_pd(x, x));
+    return _mm256_blendv_pd(large, small, _mm256_cmp_pd(magnitude, _mm256_set1_pd(0.5), _CMP_LT_OQ));
+}
+
+AVX2_TARGET inline __m256d CoshVector(__m256d x) {
+    __m256d e = ExpCore(Abs(x));
+    return _mm256_mul_pd(_mm256_set1_pd(0.5), _mm256_add_pd(e, _mm256_div_pd(_mm256_set1_pd(1.0), e)));
+}
+
+// tanh(20) rounds to 1, so larger magnitudes are clamped before e^2|x|.
+// NaN lanes never get here: min() would turn them into 20.
+AVX2_TARGET inline __m256d TanhVector(__m256d x) {
+    __m256d magnitude = _mm256_min_pd(Abs(x), _mm256_set1_pd(20.0));
+    __m256d sign = _mm256_and_pd(x, _mm256_set1_pd(-0.0));
+    __m256d e = ExpCore(_mm256_add_pd(magnitude, magnitude));
+    __m256d large = _mm256_sub_pd(_mm256_set1_pd(1.0),
+                                  _mm256_div_pd(_mm256_set1_pd(2.0), _mm256_add_pd(e, _mm256_set1_pd(1.0))));
+    large = _mm256_or_pd(large, sign);
+    __m256d z = _mm256_mul_pd(x, x);
+    __m256d small = _mm256_div_pd(SinhPolynomial(x, z), CoshPolynomial(z));
+    return _mm256_blendv_pd(large, small, _mm256_cmp_pd(Abs(x), _mm256_set1_pd(0.5), _CMP_LT_OQ));
+}
+
+// Range predicates: blocks where any lane fails go through the scalar
+// function instead.
+AVX2_TARGET inline bool TrigInRange(__m256d x) {
+    return AllBelow(Abs(x), 1e5);
+}
+
+AVX2_TARGET inline bool HyperbolicInRange(__m256d x) {
+    return AllBelow(Abs(x), 708.0);
+}
+
+AVX2_TARGET inline bool AnyInRange(__m256d) {
+    return true;
+}
+
+AVX2_TARGET inline bool LnInRange(__m256d x) {
+    __m256d normal = _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::min()), _CMP_GE_OQ);
+    __m256d finite = _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::max()), _CMP_LE_OQ);
+    return _mm256_movemask_pd(_mm256_and_pd(normal, finite)) == 0xF;
+}
+
+template <__m256d (*Kernel)(__m256d), bool (*InRange)(__m256d), double (*Scalar)(double)>
+AVX2_TARGET void Avx2Loop(const double* input, double* output, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(input + i);
+        if (InRange(x)) {
+            _mm256_storeu_pd(output + i, Kernel(x));
+        } else {
+            for (size_t j = i; j < i + 4; j++) {
+                output[j] = Scalar(input[j]);
+            }
+        }
+    }
+    for (; i < count; i++) {
+        output[i] = Scalar(input[i]);
+    }
+}
+
+#else
+
+bool CpuHasAvx2() {
+    return false;
+}
+
+#endif
+
+SimdLevel DetectSimdLevel() {
+    return CpuHasAvx2() ? SimdLevel::AVX2 : SimdLevel::Scalar;
+}
+
+const SimdLevel supportedLevel = DetectSimdLevel();
+std::atomic<int> activeLevel(static_cast<int>(supportedLevel));
+
+bool UseAvx2() {
+    return activeLevel.load(std::memory_order_relaxed) == static_cast<int>(SimdLevel::AVX2);
+}
+
+}
+
+SimdLevel GetSimdLevel() {
+    return static_cast<SimdLevel>(activeLevel.load());
+}
+
+void SetSimdLevel(SimdLevel level) {
+    if (static_cast<int>(level) > static_cast<int>(supportedLevel)) {
+        level = supportedLevel;
+    }
+    activeLevel.store(static_cast<int>(level));
+}
+
+const char* GetSimdLevelName(SimdLevel level) {
+    return level == SimdLevel::AVX2 ? "AVX2" : "scalar";
+}
+
+#ifdef CALC_HAVE_AVX2
+#define DISPATCH(kernel, inRange, scalar)                                   \
+    if (UseAvx2()) {                                                        \
+        Avx2Loop<kernel, inRange, scalar>(input, output, count);            \
+    } else {                                                                \
+        ScalarLoop<scalar>(input, output, count);                           \
+    }
+#else
+#define DISPATCH(kernel, inRange, scalar) ScalarLoop<scalar>(input, output, count);
+#endif
+
+void VectorSin(const double* input, double* output, size_t count) {
+    DISPATCH(SinVector, TrigInRange, ScalarSin)
+}
+
+void VectorCos(const double* input, double* output, size_t count) {
+    DISPATCH(CosVector, TrigInRange, ScalarCos)
+}
+
+void VectorTan(const double* input, double* output, size_t count) {
+    DISPATCH(TanVector, TrigInRange, ScalarTan)
+}
+
+void VectorSqrt(const double* input, double* output, size_t count) {
+    DISPATCH(SqrtVector, AnyInRange, ScalarSqrt)
+}
+
+void VectorLn(const double* input, double* output, size_t count) {
+    DISPATCH(LnCore, LnInRange, ScalarLn)
+}
+
+void VectorSinh(const double* input, double* output, size_t count) {
+    DISPATCH(SinhVector, HyperbolicInRange, ScalarSinh)
+}
+
+void VectorCosh(const double* input, double* output, size_t count) {
+    DISPATCH(CoshVector, HyperbolicInRange, ScalarCosh)
+}
+
+void VectorTanh(const double* input, double* output, size_t count) {
+    DISPATCH(TanhVector, HyperbolicInRange, ScalarTanh)
+}
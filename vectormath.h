@@ -0,0 +1,44 @@
+#ifndef VECTORMATH_H
+#define VECTORMATH_H
+
+#include <cstddef>
+
+// Batch kernels behind Calculator's array overloads. Each function reads
+// count values from input and writes count results to output; output may
+// be the same array as input but must not otherwise overlap it. Angles are
+// in radians. Domain errors produce NaN instead of throwing: sqrt of a
+// negative, ln of a non-positive value, and tan where
+// |cos(x)| < 1e-10 (the same test as Calculator::tangent).
+//
+// On x86 CPUs with AVX2 and FMA the kernels evaluate four values at a time
+// with polynomial approximations; elsewhere, and for the count % 4 tail,
+// they loop over the libm functions that the scalar Calculator methods
+// use. Values outside a kernel's fast range (NaN, infinities, |x| > 1e5
+// for sin/cos/tan, |x| > 708 for the hyperbolic functions, zero, negative
+// and subnormal inputs to ln) are also passed to libm, so results
+// differ from the scalar methods only through polynomial rounding.
+// Maximum error against libm, measured by calc-bench over its test ranges:
+//
+//   sqrt                0 ULP (correctly rounded in both)
+//   ln, sin, cos, cosh  1 ULP
+//   tan, sinh           2 ULP
+//   tanh                3 ULP
+enum class SimdLevel { Scalar, AVX2 };
+
+// The instruction set the kernels currently use. It starts at the best
+// level the CPU supports; SetSimdLevel can lower it (for comparisons) but
+// never raise it past what the CPU supports.
+SimdLevel GetSimdLevel();
+void SetSimdLevel(SimdLevel level);
+const char* GetSimdLevelName(SimdLevel level);
+
+void VectorSin(const double* input, double* output, size_t count);
+void VectorCos(const double* input, double* output, size_t count);
+void VectorTan(const double* input, double* output, size_t count);
+void VectorSqrt(const double* input, double* output, size_t count);
+void VectorLn(const double* input, double* output, size_t count);
+void VectorSinh(const double* input, double* output, size_t count);
+void VectorCosh(const double* input, double* output, size_t count);
+void VectorTanh(const double* input, double* output, size_t count);
+
+#endif